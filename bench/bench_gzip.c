@@ -0,0 +1,64 @@
+// gzip of a small /echo-sized body: a fresh deflate stream per call, as
+// mycompress used to do, against the per-thread pooled stream it uses now.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "app/arena.h"
+#include "app/files.h"
+#include "app/str.h"
+
+#define ITERATIONS 20000
+
+static str_t fresh_stream_compress(Arena *a, str_t src) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return (str_t){0};
+    uLong cap = deflateBound(&strm, (uLong)src.len);
+    byte *out = arena_alloc_align(a, cap, 1);
+    strm.next_in = (Bytef *)src.data;
+    strm.avail_in = (uInt)src.len;
+    strm.next_out = (Bytef *)out;
+    strm.avail_out = (uInt)cap;
+    deflate(&strm, Z_FINISH);
+    size_t len = strm.total_out;
+    deflateEnd(&strm);
+    return (str_t){.data = out, .len = len};
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+    str_t body = SL("the quick brown fox jumps over the lazy dog, twice: "
+                    "the quick brown fox jumps over the lazy dog");
+    size_t checksum = 0;
+
+    Arena arena = arena_new(1 << 16);
+    double start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        checksum += fresh_stream_compress(&arena, body).len;
+        arena_rest(&arena);
+    }
+    double fresh = now_sec() - start;
+
+    start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        checksum += mycompress(&arena, body).len;
+        arena_rest(&arena);
+    }
+    double pooled = now_sec() - start;
+    arena_destroy(&arena);
+
+    printf("fresh deflate stream: %8.1f ns/body\n", fresh * 1e9 / ITERATIONS);
+    printf("pooled deflate stream: %7.1f ns/body (%.1fx)\n",
+           pooled * 1e9 / ITERATIONS, fresh / pooled);
+    printf("(checksum %zu)\n", checksum);
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Request head parsing: the state-machine parser against the split-based
+// parser it replaced, kept here verbatim as legacy_parse_headers.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "app/arena.h"
+#include "app/http.h"
+#include "app/str.h"
+
+#define ITERATIONS 1000000
+
+typedef struct {
+    str_t method;
+    str_t url;
+    str_t version;
+    http_header_vec_t headers;
+} legacy_request_t;
+
+static bool legacy_parse_headers(Arena *a_ptr, str_t requestheader_str,
+                                 legacy_request_t *http_request_ptr) {
+    str_vec_t rows = str_split_s(a_ptr, requestheader_str, S(CRLF));
+
+    str_vec_t first_row = str_split_s(a_ptr, strvec_get(rows, 0), S(" "));
+
+    http_request_ptr->method = strvec_get(first_row, 0);
+    http_request_ptr->url = strvec_get(first_row, 1);
+    http_request_ptr->version = strvec_get(first_row, 2);
+
+    for (size_t i = 1; i < strvec_len(rows); i++) {
+        str_vec_t header_parts =
+            str_split_s(a_ptr, strvec_get(rows, i), S(":"));
+
+        http_header_t h = {.key = str_trim(strvec_get(header_parts, 0)),
+                           .value = str_trim(strvec_get(header_parts, 1))};
+
+        http_header_vec_push(a_ptr, &(http_request_ptr->headers), h);
+    }
+
+    return true;
+}
+
+static const char request[] =
+    "GET /files/some/longer/path/index.html?query=1 HTTP/1.1\r\n"
+    "Host: localhost:4221\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+    "\r\n";
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+    str_t input = {.data = (byte *)request, .len = sizeof(request) - 1};
+    // The legacy parser took the head without the final blank line.
+    str_t head = {.data = (byte *)request, .len = sizeof(request) - 5};
+    size_t checksum = 0;
+
+    Arena arena = arena_new(1 << 20);
+    double start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        legacy_request_t r = {.headers = http_header_vec_new(&arena, 10)};
+        legacy_parse_headers(&arena, head, &r);
+        checksum += http_header_vec_len(r.headers);
+        arena_rest(&arena);
+    }
+    double legacy = now_sec() - start;
+    arena_destroy(&arena);
+
+    start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        http_request_t r = {0};
+        http_parser_t p;
+        http_parser_init(&p);
+        if (http_parser_execute(&p, input, &r) != HTTP_PARSE_DONE) {
+            fprintf(stderr, "parse failed\n");
+            return 1;
+        }
+        checksum += r.header_count;
+    }
+    double parser = now_sec() - start;
+
+    printf("legacy split parser: %8.1f ns/request\n",
+           legacy * 1e9 / ITERATIONS);
+    printf("state-machine parser: %7.1f ns/request (%.1fx)\n",
+           parser * 1e9 / ITERATIONS, legacy / parser);
+    printf("(checksum %zu)\n", checksum);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Response head serialization: the direct-write serializer against the
+// str_buffer/int_to_str one it replaced, kept here as legacy_status_line
+// plus per-header iovec segments.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "app/arena.h"
+#include "app/http.h"
+#include "app/str.h"
+
+#define ITERATIONS 1000000
+
+static str_t legacy_status_line(Arena *a, http_response_t *response) {
+    str_buffer_t status_line = str_buffer_new(a, 64);
+    str_buffer_append_str(a, &status_line, S("HTTP/1.1 "));
+    str_buffer_append_str(a, &status_line,
+                          int_to_str(a, response->status_code));
+    str_buffer_append_str(a, &status_line, S(" "));
+    str_buffer_append_str(a, &status_line,
+                          http_status_message(response->status_code));
+    str_buffer_append_str(a, &status_line, S(CRLF));
+    return str_buffer_to_str(status_line);
+}
+
+static void legacy_response_to_iovec(Arena *a, http_response_t *response,
+                                     size_t body_len, http_iovec_t *out) {
+    http_header_vec_push(a, &response->headers,
+                         (http_header_t){.key = S("Content-Length"),
+                                         .value = int_to_str(a, (int)body_len)});
+    http_iovec_push(out, legacy_status_line(a, response));
+    for (size_t i = 0; i < http_header_vec_len(response->headers); i++) {
+        http_header_t h = http_header_vec_get(response->headers, i);
+        http_iovec_push(out, h.key);
+        http_iovec_push(out, S(": "));
+        http_iovec_push(out, h.value);
+        http_iovec_push(out, S(CRLF));
+    }
+    http_iovec_push(out, S(CRLF));
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static http_response_t make_response(Arena *a) {
+    http_response_t r = {.status_code = HTTP_STATUS_OK,
+                         .headers = http_header_vec_new(a, 10),
+                         .content_length = -1,
+                         .body_fd = -1};
+    http_header_vec_push(a, &r.headers,
+                         (http_header_t){.key = SL("Content-Type"),
+                                         .value = SL("text/plain")});
+    return r;
+}
+
+int main(void) {
+    size_t checksum = 0;
+    http_iovec_t out;
+
+    Arena arena = arena_new(1 << 20);
+    double start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        http_response_t r = make_response(&arena);
+        http_iovec_reset(&out);
+        legacy_response_to_iovec(&arena, &r, 1234, &out);
+        checksum += out.remaining;
+        arena_rest(&arena);
+    }
+    double legacy = now_sec() - start;
+
+    start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        http_response_t r = make_response(&arena);
+        r.content_length = 1234;
+        http_iovec_reset(&out);
+        response_to_iovec(&arena, &r, &out);
+        checksum += out.remaining;
+        arena_rest(&arena);
+    }
+    double direct = now_sec() - start;
+    arena_destroy(&arena);
+
+    printf("legacy serializer: %8.1f ns/response\n",
+           legacy * 1e9 / ITERATIONS);
+    printf("direct-write serializer: %3.1f ns/response (%.1fx)\n",
+           direct * 1e9 / ITERATIONS, legacy / direct);
+    printf("(checksum %zu)\n", checksum);
+    return 0;
+}
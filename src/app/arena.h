@@ -1,23 +1,29 @@
 #pragma once
 
+#include "arena_stats.h"
 #include "log.h"
 #include "types.h"
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-typedef struct {
-    byte *ptr;
-    size_t size;
-} Arena_Header;
-
-typedef struct {
-    byte *base;
-    size_t offset;
+// One block of arena memory. Chunks are chained newest first; only the
+// newest one is allocated from.
+typedef struct Arena_Chunk {
+    struct Arena_Chunk *prev;
     size_t cap;
+    _Alignas(max_align_t) byte data[];
+} Arena_Chunk;
 
-    Arena_Header headers[10000];
-    size_t header_size;
+// Bump allocator that grows by chaining chunks instead of running out.
+// Allocations are never freed one by one; arena_rest() drops them all.
+typedef struct {
+    Arena_Chunk *chunk;
+    size_t offset;     // bytes used in chunk
+    size_t chunk_size; // size of new chunks, unless one allocation needs more
+    byte *last;        // most recent allocation, which realloc grows in place
+    size_t peak;       // most of the first chunk in use, as of arena_rest()
 } Arena;
 
 static inline size_t align_up(size_t x, size_t align) {
@@ -26,69 +32,164 @@ static inline size_t align_up(size_t x, size_t align) {
     return (x + mask) & ~mask;
 }
 
+static inline Arena_Chunk *arena_chunk_new(size_t cap, Arena_Chunk *prev) {
+    Arena_Chunk *c = (Arena_Chunk *)malloc(sizeof(Arena_Chunk) + cap);
+    if (c == NULL)
+        return NULL;
+    c->prev = prev;
+    c->cap = cap;
+    return c;
+}
+
 static inline Arena arena_new(size_t capacity) {
-    Arena a;
-    a.base = (byte*)malloc(capacity);
-    a.cap = a.base ? capacity : 0;
-    a.offset = 0;
-    a.header_size = 0;
+    Arena a = {.chunk = arena_chunk_new(capacity, NULL),
+               .offset = 0,
+               .chunk_size = capacity,
+               .last = NULL,
+               .peak = 0};
     return a;
 }
 
-static inline void arena_rest(Arena *a) { a->offset = 0; }
+// Position to roll the arena back to with arena_restore().
+typedef struct {
+    Arena_Chunk *chunk;
+    size_t offset;
+} Arena_Mark;
+
+static inline void arena_note_peak(Arena *a) {
+    if (a->chunk != NULL && a->chunk->prev != NULL)
+        a->peak = SIZE_MAX; // the first chunk filled up
+    else if (a->offset > a->peak)
+        a->peak = a->offset;
+}
+
+// Allocations from before the mark stop growing in place: grown past the
+// mark, they would be cut short by arena_restore() and overwritten.
+static inline Arena_Mark arena_save(Arena *a) {
+    a->last = NULL;
+    return (Arena_Mark){.chunk = a->chunk, .offset = a->offset};
+}
+
+// Drops everything allocated since the mark was taken, including chunks
+// chained on since. Marks taken after this one become invalid.
+static inline void arena_restore(Arena *a, Arena_Mark m) {
+    arena_note_peak(a);
+    Arena_Chunk *c = a->chunk;
+    while (c != m.chunk) {
+        Arena_Chunk *prev = c->prev;
+        free(c);
+        c = prev;
+    }
+    a->chunk = c;
+    a->offset = m.offset;
+    a->last = NULL;
+}
+
+// Forgets every allocation. The first chunk is kept for reuse; the ones a
+// large request chained on are given back.
+static inline void arena_rest(Arena *a) {
+    arena_note_peak(a);
+#ifdef ARENA_STATS
+    // Resetting an arena that holds nothing, such as one already reset on
+    // its way back to the pool, ends no cycle.
+    size_t footprint = a->offset;
+    for (Arena_Chunk *f = a->chunk; f != NULL && f->prev != NULL; f = f->prev)
+        footprint += f->prev->cap;
+    if (footprint > 0)
+        ARENA_STAT_CYCLE(footprint);
+#endif
+    Arena_Chunk *c = a->chunk;
+    while (c != NULL && c->prev != NULL) {
+        Arena_Chunk *prev = c->prev;
+        free(c);
+        c = prev;
+    }
+    a->chunk = c;
+    a->offset = 0;
+    a->last = NULL;
+}
 
 static inline void arena_destroy(Arena *a) {
     if (a == NULL)
         return;
-    free(a->base);
-    a->base = NULL;
+    Arena_Chunk *c = a->chunk;
+    while (c != NULL) {
+        Arena_Chunk *prev = c->prev;
+        free(c);
+        c = prev;
+    }
+    a->chunk = NULL;
     a->offset = 0;
-    a->cap = 0;
+    a->last = NULL;
 }
 
 static inline double bytes_to_mb(size_t bytes) {
     return (double)bytes / (1024.0 * 1024.0);
 }
 
-static inline void *arena_alloc_align(Arena *a, size_t size, size_t align) {
-    size_t new_pos_byte_offset = align_up(a->offset, align);
-    // printf("->> %f %f %f\n", bytes_to_mb(size), bytes_to_mb(a->cap),
-    // bytes_to_mb(a->offset));
-    assert(size < a->cap - new_pos_byte_offset);
+// Offset in the current chunk where an allocation of size/align would
+// start, or SIZE_MAX when it does not fit.
+static inline size_t arena_fit(const Arena *a, size_t size, size_t align) {
+    if (a->chunk == NULL)
+        return SIZE_MAX;
+    uintptr_t base = (uintptr_t)a->chunk->data;
+    size_t start = align_up(base + a->offset, align) - base;
+    if (start > a->chunk->cap || size > a->chunk->cap - start)
+        return SIZE_MAX;
+    return start;
+}
 
-    byte *ptr = a->base + new_pos_byte_offset;
-    a->offset = new_pos_byte_offset + size;
+static inline void *arena_alloc_align(Arena *a, size_t size, size_t align) {
+    size_t start = arena_fit(a, size, align);
+    if (start == SIZE_MAX) {
+        size_t cap = a->chunk_size;
+        if (cap < size + align)
+            cap = size + align;
+        Arena_Chunk *c = arena_chunk_new(cap, a->chunk);
+        if (c == NULL)
+            return NULL;
+        a->chunk = c;
+        a->offset = 0;
+        start = arena_fit(a, size, align);
+        ARENA_STAT(CHUNK_GROWTHS, 1);
+    }
+    ARENA_STAT(ALLOCS, 1);
+    ARENA_STAT(BYTES, size);
 
-    Arena_Header h = {.ptr = ptr, .size = size};
-    a->headers[a->header_size++] = h;
+    byte *ptr = a->chunk->data + start;
+    a->offset = start + size;
+    a->last = ptr;
     return ptr;
 }
 
-static inline void *arena_realloc_align(Arena *a, byte *ptr, size_t size,
-                                        size_t align) {
-    int header_index = -1;
-    for (size_t i = 0; i < a->header_size; i++) {
-        if (a->headers[i].ptr == ptr) {
-            header_index = i;
+// ptr must come from this arena with old_size bytes (or be NULL). The most
+// recent allocation grows in place while its chunk has room; anything else
+// is copied to a new allocation.
+static inline void *arena_realloc_align(Arena *a, void *ptr, size_t old_size,
+                                        size_t size, size_t align) {
+    if (ptr == NULL)
+        return arena_alloc_align(a, size, align);
+    if (ptr == a->last) {
+        size_t start = (size_t)((byte *)ptr - a->chunk->data);
+        if (size <= a->chunk->cap - start) {
+            a->offset = start + size;
+            ARENA_STAT(REALLOC_IN_PLACE, 1);
+            return ptr;
         }
     }
-    assert(header_index != -1);
-    size_t old_size = a->headers[header_index].size;
-    if ((size_t)(header_index) == a->header_size - 1) {
-        assert(a->offset + size - old_size < a->cap);
-        a->offset += (size - old_size);
-        a->headers[header_index].size = size;
+    if (size <= old_size)
         return ptr;
-    }
 
-    byte *new_ptr = (byte *)arena_alloc_align(a, size, align);
-    assert(new_ptr != NULL);
-    memcpy(ptr, new_ptr, old_size);
+    ARENA_STAT(REALLOC_COPY, 1);
+    void *new_ptr = arena_alloc_align(a, size, align);
+    if (new_ptr != NULL)
+        memcpy(new_ptr, ptr, old_size);
     return new_ptr;
 }
 
-static inline void *arena_realloc(Arena *a, byte *ptr, size_t size) {
-    return arena_realloc_align(a, ptr, size, _Alignof(max_align_t));
+static inline void *arena_realloc(Arena *a, void *ptr, size_t old_size,
+                                  size_t size) {
+    return arena_realloc_align(a, ptr, old_size, size, _Alignof(max_align_t));
 }
 
 static inline void *arena_alloc(Arena *a, size_t size) {
@@ -0,0 +1,131 @@
+#include "arena_pool.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct {
+    Arena arenas[ARENA_POOL_LOCAL];
+    size_t count;
+    bool registered; // with the key, so that thread exit flushes it
+} local_pool_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_key_t key;
+    size_t arena_size;
+    size_t max_cached;
+    bool trim;
+    bool initialized; // the key exists
+    Arena *depot;
+    size_t count;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static _Thread_local local_pool_t local;
+static _Thread_local Arena scratch[2];
+
+// Returns an arena to the depot, or frees it when the depot is full.
+static void depot_put(Arena *a) {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.count < pool.max_cached) {
+        pool.depot[pool.count++] = *a;
+        a->chunk = NULL;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    arena_destroy(a);
+}
+
+// Thread exit: pooled arenas go to the depot, scratch arenas are freed.
+static void local_flush(void *arg) {
+    local_pool_t *l = arg;
+    while (l->count > 0)
+        depot_put(&l->arenas[--l->count]);
+    arena_destroy(&scratch[0]);
+    arena_destroy(&scratch[1]);
+}
+
+static void local_register(void) {
+    if (!local.registered) {
+        pthread_setspecific(pool.key, &local);
+        local.registered = true;
+    }
+}
+
+void arena_pool_init(size_t arena_size, size_t max_cached, bool trim) {
+    pool.depot = max_cached ? malloc(max_cached * sizeof(Arena)) : NULL;
+    if (max_cached && pool.depot == NULL) {
+        LOG_ERROR("arena pool: out of memory, pooling disabled");
+        max_cached = 0;
+    }
+    if (pthread_key_create(&pool.key, local_flush) != 0) {
+        LOG_ERROR("arena pool: pthread_key_create failed, pooling disabled");
+        max_cached = 0;
+    }
+    pool.initialized = true;
+    pool.arena_size = arena_size;
+    pool.max_cached = max_cached;
+    pool.trim = trim;
+}
+
+Arena arena_pool_get(size_t capacity) {
+    if (pool.max_cached == 0 || capacity != pool.arena_size)
+        return arena_new(capacity);
+
+    if (local.count > 0)
+        return local.arenas[--local.count];
+
+    Arena a = {0};
+    pthread_mutex_lock(&pool.lock);
+    if (pool.count > 0)
+        a = pool.depot[--pool.count];
+    pthread_mutex_unlock(&pool.lock);
+    return a.chunk != NULL ? a : arena_new(capacity);
+}
+
+// Gives the first chunk's pages past ARENA_POOL_WARM back to the kernel if
+// the arena ever used them; they fault back in, zeroed, on next use.
+static void arena_trim(Arena *a) {
+    if (a->peak <= ARENA_POOL_WARM)
+        return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t data = (uintptr_t)a->chunk->data;
+    size_t used = a->peak < a->chunk->cap ? a->peak : a->chunk->cap;
+    uintptr_t from = align_up(data + ARENA_POOL_WARM, page);
+    uintptr_t to = (data + used) & ~(uintptr_t)(page - 1);
+    if (to > from && madvise((void *)from, to - from, MADV_DONTNEED) != 0)
+        LOG_ERROR("arena pool: madvise failed");
+    a->peak = ARENA_POOL_WARM;
+}
+
+void arena_pool_put(Arena *a) {
+    if (a->chunk == NULL)
+        return;
+    arena_rest(a);
+    if (pool.max_cached == 0 || a->chunk->cap != pool.arena_size) {
+        arena_destroy(a);
+        return;
+    }
+    if (pool.trim)
+        arena_trim(a);
+
+    if (local.count < ARENA_POOL_LOCAL) {
+        local_register();
+        local.arenas[local.count++] = *a;
+        a->chunk = NULL;
+        return;
+    }
+    depot_put(a);
+}
+
+Arena *arena_scratch(const Arena *conflict) {
+    Arena *a = conflict == &scratch[0] ? &scratch[1] : &scratch[0];
+    if (a->chunk == NULL) {
+        // Made up front so that restoring to a mark keeps the first chunk.
+        *a = arena_new(ARENA_SCRATCH_SIZE);
+        if (pool.initialized)
+            local_register();
+    }
+    return a;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+// Recycles connection arenas so that short-lived connections skip the
+// malloc, free and page faults of a fresh arena. Each thread keeps a few
+// arenas at hand without locking; beyond that they go to a shared depot
+// holding at most max_cached, and anything past that is freed.
+
+#define ARENA_POOL_LOCAL 4
+// With trimming on, an arena going back to the pool keeps this much of its
+// first chunk resident and hands the pages past it back to the kernel.
+#define ARENA_POOL_WARM (1 << 16) // 64KB
+
+// Only arenas of arena_size bytes are pooled. max_cached == 0 turns the
+// pool off. Call before any thread uses the pool.
+void arena_pool_init(size_t arena_size, size_t max_cached, bool trim);
+
+// A pooled arena when there is one of this capacity, else arena_new().
+Arena arena_pool_get(size_t capacity);
+// Resets the arena and keeps it for reuse, or destroys it.
+void arena_pool_put(Arena *a);
+
+// Per-thread scratch arenas for temporaries that die before the function
+// that made them returns:
+//
+//     Arena *scratch = arena_scratch(a);
+//     Arena_Mark mark = arena_save(scratch);
+//     ... build temporaries in scratch, results in a ...
+//     arena_restore(scratch, mark);
+//
+// `conflict` is the arena results go to; it may itself be a scratch arena
+// further up the stack, so the other one is handed out.
+#define ARENA_SCRATCH_SIZE (1 << 16) // 64KB
+Arena *arena_scratch(const Arena *conflict);
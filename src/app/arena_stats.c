@@ -0,0 +1,139 @@
+#include "arena_stats.h"
+
+#ifdef ARENA_STATS
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+_Thread_local Arena_Thread_Stats *arena_thread_stats;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_once_t once;
+    pthread_key_t key;
+    Arena_Thread_Stats *live;
+    Arena_Stats retired; // folded in from exited threads
+} stats = {.lock = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+// Used when a thread's block cannot be allocated; counts may then mix.
+static Arena_Thread_Stats fallback;
+
+static void fold(Arena_Stats *into, const Arena_Thread_Stats *t) {
+    for (int i = 0; i < ARENA_STAT_COUNT; i++) {
+        uint64_t v = atomic_load_explicit(&t->v[i], memory_order_relaxed);
+        if (i == ARENA_STAT_PEAK)
+            into->v[i] = v > into->v[i] ? v : into->v[i];
+        else
+            into->v[i] += v;
+    }
+}
+
+static void thread_exit(void *arg) {
+    Arena_Thread_Stats *t = arg;
+    pthread_mutex_lock(&stats.lock);
+    fold(&stats.retired, t);
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        stats.live = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    pthread_mutex_unlock(&stats.lock);
+    // Other destructors may still use arenas on this thread; count that
+    // in the fallback rather than in freed memory, or in a new block that
+    // nothing would free.
+    arena_thread_stats = &fallback;
+    free(t);
+}
+
+static void make_key(void) { pthread_key_create(&stats.key, thread_exit); }
+
+Arena_Thread_Stats *arena_stats_register(void) {
+    pthread_once(&stats.once, make_key);
+    Arena_Thread_Stats *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        arena_thread_stats = &fallback;
+        return &fallback;
+    }
+    pthread_mutex_lock(&stats.lock);
+    t->next = stats.live;
+    if (stats.live)
+        stats.live->prev = t;
+    stats.live = t;
+    pthread_mutex_unlock(&stats.lock);
+    pthread_setspecific(stats.key, t);
+    arena_thread_stats = t;
+    return t;
+}
+
+void arena_stats_snapshot(Arena_Stats *out) {
+    pthread_mutex_lock(&stats.lock);
+    *out = stats.retired;
+    for (Arena_Thread_Stats *t = stats.live; t != NULL; t = t->next)
+        fold(out, t);
+    pthread_mutex_unlock(&stats.lock);
+    fold(out, &fallback);
+}
+
+#define APPEND(...)                                                            \
+    do {                                                                       \
+        int n_ = snprintf(buf + (len < cap ? len : cap),                       \
+                          len < cap ? cap - len : 0, __VA_ARGS__);             \
+        if (n_ > 0)                                                            \
+            len += (size_t)n_;                                                 \
+    } while (0)
+
+size_t arena_stats_report(char *buf, size_t cap) {
+    Arena_Stats total;
+    arena_stats_snapshot(&total);
+    size_t len = 0;
+    const uint64_t *v = total.v;
+
+    APPEND("allocs %" PRIu64 "\nbytes %" PRIu64 "\n"
+           "realloc_in_place %" PRIu64 "\nrealloc_copy %" PRIu64 "\n"
+           "chunk_growths %" PRIu64 "\ncycles %" PRIu64 "\n"
+           "peak_cycle_bytes %" PRIu64 "\n",
+           v[ARENA_STAT_ALLOCS], v[ARENA_STAT_BYTES],
+           v[ARENA_STAT_REALLOC_IN_PLACE], v[ARENA_STAT_REALLOC_COPY],
+           v[ARENA_STAT_CHUNK_GROWTHS], v[ARENA_STAT_CYCLES],
+           v[ARENA_STAT_PEAK]);
+    // How many cycles fit in an arena of each size: what to size for.
+    for (int i = 0; i < ARENA_STATS_BUCKETS; i++) {
+        if (i < ARENA_STATS_BUCKETS - 1)
+            APPEND("cycles_below_%zuk %" PRIu64 "\n", (size_t)1 << i,
+                   v[ARENA_STAT_HIST + i]);
+        else
+            APPEND("cycles_above_%zuk %" PRIu64 "\n", (size_t)1 << (i - 1),
+                   v[ARENA_STAT_HIST + i]);
+    }
+
+    pthread_mutex_lock(&stats.lock);
+    int thread = 0;
+    for (Arena_Thread_Stats *t = stats.live; t != NULL; t = t->next) {
+        APPEND("thread %d: allocs %" PRIu64 " bytes %" PRIu64
+               " realloc_in_place %" PRIu64 " realloc_copy %" PRIu64
+               " chunk_growths %" PRIu64 " cycles %" PRIu64
+               " peak_cycle_bytes %" PRIu64 "\n",
+               thread++,
+               atomic_load_explicit(&t->v[ARENA_STAT_ALLOCS],
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->v[ARENA_STAT_BYTES],
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->v[ARENA_STAT_REALLOC_IN_PLACE],
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->v[ARENA_STAT_REALLOC_COPY],
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->v[ARENA_STAT_CHUNK_GROWTHS],
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->v[ARENA_STAT_CYCLES],
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->v[ARENA_STAT_PEAK],
+                                    memory_order_relaxed));
+    }
+    pthread_mutex_unlock(&stats.lock);
+    return len;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Arena accounting, compiled in with -DARENA_STATS (make ARENA_STATS=1) and
+// free otherwise. Each thread counts into its own block without locking;
+// a report sums the live threads' blocks with what exited threads left.
+
+// Cycle footprints (bytes an arena held when it was reset) are bucketed by
+// power of two: bucket i counts footprints below 2^(i + 10), the last one
+// everything larger.
+#define ARENA_STATS_BUCKETS 16 // below 1KB .. below 16MB, then 16MB and up
+
+typedef enum {
+    ARENA_STAT_ALLOCS,
+    ARENA_STAT_BYTES, // requested, alignment padding excluded
+    ARENA_STAT_REALLOC_IN_PLACE,
+    ARENA_STAT_REALLOC_COPY,
+    ARENA_STAT_CHUNK_GROWTHS,
+    ARENA_STAT_CYCLES, // arena_rest() calls on a non-empty arena
+    ARENA_STAT_PEAK,   // largest cycle footprint; a maximum, not a sum
+    ARENA_STAT_HIST,
+    ARENA_STAT_COUNT = ARENA_STAT_HIST + ARENA_STATS_BUCKETS,
+} arena_stat_t;
+
+typedef struct {
+    uint64_t v[ARENA_STAT_COUNT];
+} Arena_Stats;
+
+#ifdef ARENA_STATS
+
+typedef struct Arena_Thread_Stats {
+    // Written only by the owning thread, read by reports.
+    _Atomic uint64_t v[ARENA_STAT_COUNT];
+    struct Arena_Thread_Stats *prev;
+    struct Arena_Thread_Stats *next;
+} Arena_Thread_Stats;
+
+extern _Thread_local Arena_Thread_Stats *arena_thread_stats;
+Arena_Thread_Stats *arena_stats_register(void);
+
+static inline Arena_Thread_Stats *arena_stats_thread(void) {
+    Arena_Thread_Stats *t = arena_thread_stats;
+    return t != NULL ? t : arena_stats_register();
+}
+
+static inline void arena_stat_add(arena_stat_t stat, uint64_t n) {
+    _Atomic uint64_t *c = &arena_stats_thread()->v[stat];
+    atomic_store_explicit(
+        c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static inline void arena_stat_cycle(size_t footprint) {
+    Arena_Thread_Stats *t = arena_stats_thread();
+    size_t bucket = 0;
+    while (bucket < ARENA_STATS_BUCKETS - 1 &&
+           footprint >= ((size_t)1 << (bucket + 10)))
+        bucket++;
+    arena_stat_add(ARENA_STAT_CYCLES, 1);
+    arena_stat_add(ARENA_STAT_HIST + bucket, 1);
+    if (footprint > atomic_load_explicit(&t->v[ARENA_STAT_PEAK],
+                                         memory_order_relaxed))
+        atomic_store_explicit(&t->v[ARENA_STAT_PEAK], footprint,
+                              memory_order_relaxed);
+}
+
+#define ARENA_STAT(stat, n) arena_stat_add(ARENA_STAT_##stat, (n))
+#define ARENA_STAT_CYCLE(footprint) arena_stat_cycle(footprint)
+
+// Process-wide totals.
+void arena_stats_snapshot(Arena_Stats *out);
+// Writes a plain-text report, the totals followed by one line per live
+// thread, snprintf style: returns the length it wanted.
+size_t arena_stats_report(char *buf, size_t cap);
+
+#else
+
+#define ARENA_STAT(stat, n) ((void)0)
+#define ARENA_STAT_CYCLE(footprint) ((void)0)
+
+#endif
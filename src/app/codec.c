@@ -0,0 +1,224 @@
+#include "codec.h"
+#include "log.h"
+#include "zlib_pool.h"
+
+#include <limits.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <pthread.h>
+#include <zstd.h>
+#endif
+
+// SL() for static initializers, which take no compound literals.
+#define CODEC_NAME(lit) {.data = (byte *)("" lit), .len = sizeof(lit) - 1}
+
+// gzip and deflate: the codec stream is the pooled z_stream itself.
+
+static codec_stream_t *zlib_begin(zlib_format_t format, codec_level_t level) {
+    int zlevel = level == CODEC_LEVEL_BEST ? Z_BEST_COMPRESSION
+                                           : ZLIB_POOL_LEVEL;
+    return (codec_stream_t *)zlib_deflater_get(format, zlevel);
+}
+
+static codec_stream_t *gzip_begin(codec_level_t level, size_t src_size) {
+    (void)src_size;
+    return zlib_begin(ZLIB_FORMAT_GZIP, level);
+}
+
+static codec_stream_t *deflate_begin(codec_level_t level, size_t src_size) {
+    (void)src_size;
+    return zlib_begin(ZLIB_FORMAT_ZLIB, level);
+}
+
+static codec_status_t zlib_step(codec_stream_t *s, codec_io_t *io,
+                                bool finish) {
+    z_stream *strm = (z_stream *)s;
+    uInt in_len = io->in_len < UINT_MAX ? (uInt)io->in_len : UINT_MAX;
+    uInt out_len = io->out_len < UINT_MAX ? (uInt)io->out_len : UINT_MAX;
+    strm->next_in = (Bytef *)io->in;
+    strm->avail_in = in_len;
+    strm->next_out = (Bytef *)io->out;
+    strm->avail_out = out_len;
+    // Z_FINISH only once the last of the input fits in this call.
+    bool last = finish && in_len == io->in_len;
+    int ret = deflate(strm, last ? Z_FINISH : Z_NO_FLUSH);
+
+    io->in += in_len - strm->avail_in;
+    io->in_len -= in_len - strm->avail_in;
+    io->out += out_len - strm->avail_out;
+    io->out_len -= out_len - strm->avail_out;
+    if (ret == Z_STREAM_END)
+        return CODEC_DONE;
+    if (ret == Z_OK || ret == Z_BUF_ERROR)
+        return CODEC_MORE;
+    LOG_ERROR("codec: deflate failed: ret=%d", ret);
+    return CODEC_ERROR;
+}
+
+static void zlib_end(codec_stream_t *s) { zlib_deflater_put((z_stream *)s); }
+
+// compressBound covers the zlib wrapper; gzip's is 12 bytes longer.
+static size_t gzip_bound(size_t len) { return compressBound(len) + 12; }
+static size_t deflate_bound(size_t len) { return compressBound(len); }
+
+static const codec_t gzip_codec = {.id = CODEC_GZIP,
+                                   .name = CODEC_NAME("gzip"),
+                                   .begin = gzip_begin,
+                                   .step = zlib_step,
+                                   .end = zlib_end,
+                                   .bound = gzip_bound};
+
+static const codec_t deflate_codec = {.id = CODEC_DEFLATE,
+                                      .name = CODEC_NAME("deflate"),
+                                      .begin = deflate_begin,
+                                      .step = zlib_step,
+                                      .end = zlib_end,
+                                      .bound = deflate_bound};
+
+#ifdef HAVE_ZSTD
+
+// Highest level worth spending on cached variants; beyond it the ratio
+// barely moves and the context gets large.
+#define ZSTD_BEST_LEVEL 19
+#define ZSTD_POOL_LOCAL 4
+
+static int zstd_level = 3; // zstd's own default
+
+static struct {
+    pthread_once_t once;
+    pthread_key_t key;
+} zstd_pool = {.once = PTHREAD_ONCE_INIT};
+
+static _Thread_local struct {
+    ZSTD_CCtx *idle[ZSTD_POOL_LOCAL];
+    size_t count;
+    bool registered;
+} zstd_local;
+
+static void zstd_local_flush(void *arg) {
+    (void)arg;
+    while (zstd_local.count > 0)
+        ZSTD_freeCCtx(zstd_local.idle[--zstd_local.count]);
+}
+
+static void zstd_make_key(void) {
+    if (pthread_key_create(&zstd_pool.key, zstd_local_flush) != 0)
+        LOG_ERROR("codec: pthread_key_create failed");
+}
+
+static codec_stream_t *zstd_begin(codec_level_t level, size_t src_size) {
+    ZSTD_CCtx *cctx = zstd_local.count > 0
+                          ? zstd_local.idle[--zstd_local.count]
+                          : ZSTD_createCCtx();
+    if (cctx == NULL)
+        return NULL;
+    // A known size lets zstd pick a window no larger than the input.
+    int zlevel = level == CODEC_LEVEL_BEST ? ZSTD_BEST_LEVEL : zstd_level;
+    if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                            zlevel)) ||
+        ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(
+            cctx, src_size == CODEC_SIZE_UNKNOWN ? ZSTD_CONTENTSIZE_UNKNOWN
+                                                 : src_size))) {
+        LOG_ERROR("codec: setting up zstd failed");
+        ZSTD_freeCCtx(cctx);
+        return NULL;
+    }
+    return (codec_stream_t *)cctx;
+}
+
+static codec_status_t zstd_step(codec_stream_t *s, codec_io_t *io,
+                                bool finish) {
+    ZSTD_inBuffer in = {.src = io->in, .size = io->in_len, .pos = 0};
+    ZSTD_outBuffer out = {.dst = io->out, .size = io->out_len, .pos = 0};
+    size_t left = ZSTD_compressStream2((ZSTD_CCtx *)s, &out, &in,
+                                       finish ? ZSTD_e_end : ZSTD_e_continue);
+    io->in += in.pos;
+    io->in_len -= in.pos;
+    io->out += out.pos;
+    io->out_len -= out.pos;
+    if (ZSTD_isError(left)) {
+        LOG_ERROR("codec: zstd failed: %s", ZSTD_getErrorName(left));
+        return CODEC_ERROR;
+    }
+    return finish && left == 0 ? CODEC_DONE : CODEC_MORE;
+}
+
+static void zstd_end(codec_stream_t *s) {
+    ZSTD_CCtx *cctx = (ZSTD_CCtx *)s;
+    // Drops any unfinished frame; the level is set again on reuse.
+    if (ZSTD_isError(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only)) ||
+        zstd_local.count == ZSTD_POOL_LOCAL) {
+        ZSTD_freeCCtx(cctx);
+        return;
+    }
+    if (!zstd_local.registered) {
+        pthread_once(&zstd_pool.once, zstd_make_key);
+        pthread_setspecific(zstd_pool.key, &zstd_local);
+        zstd_local.registered = true;
+    }
+    zstd_local.idle[zstd_local.count++] = cctx;
+}
+
+static size_t zstd_bound(size_t len) { return ZSTD_compressBound(len); }
+
+static const codec_t zstd_codec = {.id = CODEC_ZSTD,
+                                   .name = CODEC_NAME("zstd"),
+                                   .begin = zstd_begin,
+                                   .step = zstd_step,
+                                   .end = zstd_end,
+                                   .bound = zstd_bound};
+
+void codec_set_zstd_level(int level) { zstd_level = level; }
+
+#else
+
+void codec_set_zstd_level(int level) { (void)level; }
+
+#endif
+
+const codec_t *codec_get(codec_id_t id) {
+    switch (id) {
+    case CODEC_GZIP:
+        return &gzip_codec;
+    case CODEC_DEFLATE:
+        return &deflate_codec;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        return &zstd_codec;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+str_t codec_compress(Arena *a, const codec_t *codec, str_t src) {
+    codec_stream_t *s = codec->begin(CODEC_LEVEL_CONFIGURED, src.len);
+    if (s == NULL)
+        return (str_t){0};
+
+    size_t cap = codec->bound(src.len);
+    byte *out = arena_alloc_align(a, cap, 1);
+    codec_io_t io = {.in = src.data, .in_len = src.len, .out = out,
+                     .out_len = cap};
+    codec_status_t status = CODEC_MORE;
+    while (out != NULL && status == CODEC_MORE) {
+        status = codec->step(s, &io, true);
+        if (status == CODEC_MORE && io.out_len == 0) {
+            // Past the bound after all; the buffer may move.
+            size_t used = cap;
+            out = arena_realloc_align(a, out, cap, cap * 2, 1);
+            cap *= 2;
+            io.out = out + used;
+            io.out_len = cap - used;
+        }
+    }
+    codec->end(s);
+    if (out == NULL || status != CODEC_DONE)
+        return (str_t){0};
+
+    size_t len = cap - io.out_len;
+    // Give back the unused part of the bound-sized buffer.
+    out = arena_realloc_align(a, out, cap, len, 1);
+    return (str_t){.data = out, .len = len};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "str.h"
+
+// Content codings the server can produce, behind one streaming interface
+// so that whole bodies, streamed bodies and cached file variants share the
+// same code. zstd is there when built with HAVE_ZSTD (libzstd found).
+
+typedef enum {
+    CODEC_IDENTITY,
+    CODEC_GZIP,
+    CODEC_DEFLATE, // the zlib format, as HTTP's "deflate" coding means
+    CODEC_ZSTD,
+    CODEC_COUNT,
+} codec_id_t;
+
+typedef enum {
+    CODEC_LEVEL_CONFIGURED,
+    CODEC_LEVEL_BEST, // for results that are cached and sent many times
+} codec_level_t;
+
+typedef enum {
+    CODEC_MORE, // call again, with more output room or input
+    CODEC_DONE, // the stream is complete
+    CODEC_ERROR,
+} codec_status_t;
+
+// One step's input and output room; step() advances both.
+typedef struct {
+    const byte *in;
+    size_t in_len;
+    byte *out;
+    size_t out_len;
+} codec_io_t;
+
+typedef struct codec_stream codec_stream_t;
+
+typedef struct {
+    codec_id_t id;
+    str_t name; // the Content-Encoding token
+    // Encoders come from per-thread pools. src_size is the exact input
+    // size when known, else CODEC_SIZE_UNKNOWN.
+    codec_stream_t *(*begin)(codec_level_t level, size_t src_size);
+    // With finish set no input follows what io holds.
+    codec_status_t (*step)(codec_stream_t *s, codec_io_t *io, bool finish);
+    void (*end)(codec_stream_t *s);
+    // Output size that a body of len bytes very likely fits in.
+    size_t (*bound)(size_t len);
+} codec_t;
+
+#define CODEC_SIZE_UNKNOWN ((size_t)-1)
+
+// NULL for identity and for codings this build lacks.
+const codec_t *codec_get(codec_id_t id);
+
+// zstd level for CODEC_LEVEL_CONFIGURED; ignored without HAVE_ZSTD.
+void codec_set_zstd_level(int level);
+
+// Encodes src whole into a; {0} on failure.
+str_t codec_compress(Arena *a, const codec_t *codec, str_t src);
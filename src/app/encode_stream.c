@@ -0,0 +1,183 @@
+#include "encode_stream.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    const codec_t *codec;
+    codec_stream_t *encoder;
+    // Exactly one input: data (what is left of an in-memory body), fd, or
+    // inner.
+    str_t data;
+    int fd;
+    off_t fd_offset;
+    size_t fd_left;
+    http_body_source_t inner;
+    byte *in_buf; // ENCODE_STREAM_IN bytes, for fd and inner
+    str_t pending; // input not yet taken by the encoder
+    bool in_done;  // pending is the last of the input
+    bool finished;
+} encode_stream_t;
+
+// Reads the next piece of input into pending. Returns false on a read
+// error.
+static bool encode_stream_refill(encode_stream_t *e) {
+    if (e->inner.read != NULL) {
+        ssize_t n = e->inner.read(e->inner.ctx, e->in_buf, ENCODE_STREAM_IN);
+        if (n < 0)
+            return false;
+        e->pending = (str_t){.data = e->in_buf, .len = (size_t)n};
+        e->in_done = n == 0;
+        return true;
+    }
+    if (e->fd != -1) {
+        size_t want =
+            e->fd_left < ENCODE_STREAM_IN ? e->fd_left : ENCODE_STREAM_IN;
+        ssize_t n;
+        do {
+            n = pread(e->fd, e->in_buf, want, e->fd_offset);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) // 0: the file shrank under us
+            return false;
+        e->fd_offset += n;
+        e->fd_left -= (size_t)n;
+        e->pending = (str_t){.data = e->in_buf, .len = (size_t)n};
+        e->in_done = e->fd_left == 0;
+        return true;
+    }
+    // An in-memory body is handed over in one piece.
+    e->pending = e->data;
+    e->data = (str_t){0};
+    e->in_done = true;
+    return true;
+}
+
+static ssize_t encode_stream_read(void *ctx, byte *buf, size_t cap) {
+    encode_stream_t *e = ctx;
+    if (e->finished)
+        return 0;
+    codec_io_t io = {.out = buf, .out_len = cap};
+
+    while (io.out_len > 0) {
+        if (e->pending.len == 0 && !e->in_done &&
+            !encode_stream_refill(e)) {
+            LOG_ERROR("encode stream: reading the body failed");
+            return -1;
+        }
+        io.in = e->pending.data;
+        io.in_len = e->pending.len;
+        codec_status_t status = e->codec->step(e->encoder, &io, e->in_done);
+        e->pending = (str_t){.data = (byte *)io.in, .len = io.in_len};
+        if (status == CODEC_DONE) {
+            e->finished = true;
+            break;
+        }
+        if (status == CODEC_ERROR)
+            return -1;
+    }
+    return (ssize_t)(cap - io.out_len);
+}
+
+static void encode_stream_close(void *ctx) {
+    encode_stream_t *e = ctx;
+    e->codec->end(e->encoder);
+    if (e->fd != -1)
+        close(e->fd);
+    if (e->inner.close)
+        e->inner.close(e->inner.ctx);
+}
+
+bool encode_stream_response(Arena *a, http_response_t *response,
+                            const codec_t *codec) {
+    encode_stream_t *e = arena_alloc(a, sizeof(*e));
+    if (e == NULL)
+        return false;
+    memset(e, 0, sizeof(*e));
+    e->codec = codec;
+    e->fd = -1;
+    size_t src_size = CODEC_SIZE_UNKNOWN;
+    if (response->body_source.read != NULL) {
+        e->inner = response->body_source;
+    } else if (response->body_fd != -1) {
+        e->fd = response->body_fd;
+        e->fd_left = response->body_fd_len;
+        src_size = e->fd_left;
+    } else {
+        e->data = response->body;
+        src_size = e->data.len;
+    }
+    if (e->inner.read != NULL || e->fd != -1) {
+        e->in_buf = arena_alloc_align(a, ENCODE_STREAM_IN, 1);
+        if (e->in_buf == NULL)
+            return false;
+    }
+
+    e->encoder = codec->begin(CODEC_LEVEL_CONFIGURED, src_size);
+    if (e->encoder == NULL) {
+        LOG_ERROR("encode stream: no %.*s encoder", STR_ARG(codec->name));
+        return false;
+    }
+    e->in_done = src_size == 0;
+
+    response->body_source = (http_body_source_t){
+        .read = encode_stream_read, .close = encode_stream_close, .ctx = e};
+    response->body = (str_t){0};
+    response->body_fd = -1;
+    response->body_fd_len = 0;
+    response->content_length = -1;
+    return true;
+}
+
+byte *encode_file(const codec_t *codec, int fd, size_t size, size_t *out_len) {
+    codec_stream_t *encoder = codec->begin(CODEC_LEVEL_BEST, size);
+    if (encoder == NULL) {
+        LOG_ERROR("encode file: no %.*s encoder", STR_ARG(codec->name));
+        return NULL;
+    }
+    size_t cap = codec->bound(size);
+    byte *out = malloc(cap ? cap : 1);
+    byte *in = malloc(ENCODE_STREAM_IN);
+    if (out == NULL || in == NULL) {
+        free(out);
+        free(in);
+        codec->end(encoder);
+        return NULL;
+    }
+
+    codec_io_t io = {.out = out, .out_len = cap};
+    codec_status_t status = CODEC_MORE;
+    off_t offset = 0;
+    while (status == CODEC_MORE) {
+        if (io.in_len == 0 && (size_t)offset < size) {
+            size_t left = size - (size_t)offset;
+            ssize_t n = pread(fd, in,
+                              left < ENCODE_STREAM_IN ? left : ENCODE_STREAM_IN,
+                              offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            offset += n;
+            io.in = in;
+            io.in_len = (size_t)n;
+        } else if (io.out_len == 0) {
+            // Outgrew the bound; let the caller stream it instead.
+            break;
+        }
+        status = codec->step(encoder, &io, (size_t)offset == size);
+    }
+    free(in);
+    codec->end(encoder);
+    if (status != CODEC_DONE) {
+        LOG_ERROR("encode file: %.*s failed", STR_ARG(codec->name));
+        free(out);
+        return NULL;
+    }
+
+    *out_len = cap - io.out_len;
+    byte *shrunk = realloc(out, *out_len ? *out_len : 1);
+    return shrunk != NULL ? shrunk : out;
+}
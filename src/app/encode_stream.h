@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "codec.h"
+#include "http.h"
+
+// Content encoding as a body source: the response body (in memory, a file
+// or another source) is compressed a window at a time as the connection
+// drains, so memory stays constant whatever the body size and the first
+// chunk goes out before the rest has been compressed.
+
+// Input read per refill for file and source bodies.
+#define ENCODE_STREAM_IN (1 << 14) // 16KB
+
+// Turns the response body into a stream encoded with codec, sent without
+// Content-Length; the stream takes over a file body's fd. Returns false,
+// leaving the response as it was, when the encoder cannot be set up.
+bool encode_stream_response(Arena *a, http_response_t *response,
+                            const codec_t *codec);
+
+// Encodes the first size bytes of fd whole, at the best level, for
+// caching. Returns a malloc'd buffer of *out_len bytes, or NULL on failure.
+byte *encode_file(const codec_t *codec, int fd, size_t size, size_t *out_len);
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include "http.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+
+#define MAX_EVENTS 256
+
+static bool make_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        perror("fcntl(F_GETFL)");
+        return false;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl(F_SETFL)");
+        return false;
+    }
+    return true;
+}
+
+static void close_conn(int epoll_fd, http_conn_t *conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    http_conn_destroy(conn);
+    free(conn);
+}
+
+// Edge-triggered listener: keep accepting until the backlog is drained.
+static void accept_all(int epoll_fd, int server_fd) {
+    while (true) {
+        int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (client_fd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept failed");
+            return;
+        }
+
+        http_conn_t *conn = malloc(sizeof(*conn));
+        if (conn == NULL) {
+            LOG_ERROR("out of memory for connection %d", client_fd);
+            close(client_fd);
+            continue;
+        }
+        if (!http_conn_init(conn, client_fd)) {
+            http_conn_destroy(conn);
+            free(conn);
+            continue;
+        }
+
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data = {.ptr = conn}};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            perror("epoll_ctl(ADD) failed");
+            http_conn_destroy(conn);
+            free(conn);
+            continue;
+        }
+
+        // Data may already be waiting; with edge triggering we would not be
+        // told about it again.
+        if (http_conn_drive(conn) == HTTP_CONN_DONE)
+            close_conn(epoll_fd, conn);
+    }
+}
+
+bool run_loop_epoll(int server_fd) {
+    if (!make_nonblocking(server_fd))
+        return false;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1 failed");
+        return false;
+    }
+
+    // The listener is tagged with a NULL pointer, connections with their
+    // http_conn_t.
+    struct epoll_event listen_ev = {.events = EPOLLIN | EPOLLET,
+                                    .data = {.ptr = NULL}};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &listen_ev) == -1) {
+        perror("epoll_ctl(ADD listener) failed");
+        close(epoll_fd);
+        return false;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            close(epoll_fd);
+            return false;
+        }
+
+        for (int i = 0; i < n; i++) {
+            http_conn_t *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_all(epoll_fd, server_fd);
+                continue;
+            }
+
+            if (http_conn_drive(conn) == HTTP_CONN_DONE)
+                close_conn(epoll_fd, conn);
+        }
+    }
+}
+
+#else
+
+bool run_loop_epoll(int server_fd) {
+    (void)server_fd;
+    LOG_ERROR("epoll event loop is only available on Linux");
+    return false;
+}
+
+#endif
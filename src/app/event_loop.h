@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Single-threaded edge-triggered epoll loop. Every accepted socket is made
+// non-blocking and driven through http_conn_drive whenever it becomes ready.
+// Only available on Linux; returns false elsewhere.
+bool run_loop_epoll(int server_fd);
@@ -0,0 +1,276 @@
+#include "file_cache.h"
+#include "log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_CACHE_BUCKETS 1024 // power of two
+
+struct file_cache_entry {
+    byte *path;
+    size_t path_len;
+    codec_id_t encoding;
+    file_stamp_t stamp; // of the source file
+    byte *data;
+    size_t size;
+
+    unsigned refs; // the cache's own reference counts as one while linked
+
+    struct file_cache_entry *bucket_next;
+    struct file_cache_entry *lru_prev; // towards most recently used
+    struct file_cache_entry *lru_next; // towards least recently used
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t budget;
+    size_t used;
+    uint64_t generation;
+    file_cache_entry_t *buckets[FILE_CACHE_BUCKETS];
+    file_cache_entry_t *lru_head;
+    file_cache_entry_t *lru_tail;
+} file_cache_t;
+
+static file_cache_t cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static size_t hash_path(str_t path) {
+    // FNV-1a
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < path.len; i++) {
+        h ^= (u8)path.data[i];
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h & (FILE_CACHE_BUCKETS - 1);
+}
+
+static void entry_free(file_cache_entry_t *e) {
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+static void lru_unlink(file_cache_entry_t *e) {
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache.lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache.lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(file_cache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head)
+        cache.lru_head->lru_prev = e;
+    cache.lru_head = e;
+    if (cache.lru_tail == NULL)
+        cache.lru_tail = e;
+}
+
+// Variants hash like their file, so they share its bucket.
+static file_cache_entry_t **bucket_slot(str_t path,
+                                        codec_id_t encoding) {
+    file_cache_entry_t **slot = &cache.buckets[hash_path(path)];
+    while (*slot) {
+        file_cache_entry_t *e = *slot;
+        if (e->encoding == encoding && e->path_len == path.len &&
+            memcmp(e->path, path.data, path.len) == 0)
+            return slot;
+        slot = &e->bucket_next;
+    }
+    return slot;
+}
+
+// Caller holds the lock.
+static void entry_remove(file_cache_entry_t **slot) {
+    file_cache_entry_t *e = *slot;
+    *slot = e->bucket_next;
+    lru_unlink(e);
+    cache.used -= e->size;
+    if (--e->refs == 0)
+        entry_free(e);
+}
+
+void file_cache_init(size_t budget_bytes) {
+    pthread_mutex_lock(&cache.lock);
+    cache.budget = budget_bytes;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+bool file_cache_enabled(void) { return cache.budget != 0; }
+
+uint64_t file_cache_generation(void) {
+    pthread_mutex_lock(&cache.lock);
+    uint64_t generation = cache.generation;
+    pthread_mutex_unlock(&cache.lock);
+    return generation;
+}
+
+file_cache_entry_t *file_cache_lookup(str_t path) {
+    pthread_mutex_lock(&cache.lock);
+    file_cache_entry_t *e = *bucket_slot(path, CODEC_IDENTITY);
+    if (e) {
+        e->refs++;
+        lru_unlink(e);
+        lru_push_front(e);
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return e;
+}
+
+file_cache_entry_t *file_cache_lookup_variant(str_t path,
+                                              codec_id_t encoding,
+                                              file_stamp_t stamp) {
+    pthread_mutex_lock(&cache.lock);
+    file_cache_entry_t **slot = bucket_slot(path, encoding);
+    file_cache_entry_t *e = *slot;
+    if (e && (e->stamp.size != stamp.size ||
+              e->stamp.mtime_ns != stamp.mtime_ns)) {
+        entry_remove(slot);
+        e = NULL;
+    }
+    if (e) {
+        e->refs++;
+        lru_unlink(e);
+        lru_push_front(e);
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return e;
+}
+
+static bool fits(size_t source_size, size_t size) {
+    return cache.budget != 0 && source_size <= FILE_CACHE_MAX_ENTRY &&
+           size <= cache.budget;
+}
+
+static file_cache_entry_t *entry_new(str_t path,
+                                     codec_id_t encoding,
+                                     byte *data, size_t size) {
+    file_cache_entry_t *e = calloc(1, sizeof(*e));
+    if (e == NULL) {
+        free(data);
+        return NULL;
+    }
+    e->path = malloc(path.len);
+    e->data = data;
+    if (e->path == NULL || e->data == NULL) {
+        entry_free(e);
+        return NULL;
+    }
+    memcpy(e->path, path.data, path.len);
+    e->path_len = path.len;
+    e->encoding = encoding;
+    e->size = size;
+    return e;
+}
+
+// Links e in place of any entry for the same path and encoding, evicting
+// as needed. Returns it referenced, or NULL (freeing it) when a write
+// raced with making it.
+static file_cache_entry_t *entry_insert(file_cache_entry_t *e,
+                                        uint64_t generation) {
+    str_t path = {.data = e->path, .len = e->path_len};
+    pthread_mutex_lock(&cache.lock);
+    if (cache.generation != generation) {
+        // The bytes may already be stale.
+        pthread_mutex_unlock(&cache.lock);
+        entry_free(e);
+        return NULL;
+    }
+
+    file_cache_entry_t **slot = bucket_slot(path, e->encoding);
+    if (*slot)
+        entry_remove(slot);
+    while (cache.used + e->size > cache.budget && cache.lru_tail) {
+        file_cache_entry_t *victim = cache.lru_tail;
+        entry_remove(bucket_slot((str_t){.data = victim->path,
+                                         .len = victim->path_len},
+                                 victim->encoding));
+    }
+
+    slot = bucket_slot(path, e->encoding);
+    *slot = e;
+    e->refs = 2; // the cache and the caller
+    lru_push_front(e);
+    cache.used += e->size;
+    pthread_mutex_unlock(&cache.lock);
+    return e;
+}
+
+file_cache_entry_t *file_cache_load(str_t path, int fd, size_t size,
+                                    file_stamp_t stamp, uint64_t generation) {
+    if (!fits(size, size))
+        return NULL;
+
+    file_cache_entry_t *e =
+        entry_new(path, CODEC_IDENTITY, malloc(size ? size : 1), size);
+    if (e == NULL)
+        return NULL;
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, e->data + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0)
+                perror("pread");
+            entry_free(e);
+            return NULL;
+        }
+        done += (size_t)n;
+    }
+    e->stamp = stamp;
+    return entry_insert(e, generation);
+}
+
+file_cache_entry_t *file_cache_insert_variant(str_t path,
+                                              codec_id_t encoding,
+                                              file_stamp_t stamp, byte *data,
+                                              size_t size,
+                                              uint64_t generation) {
+    if (!fits(stamp.size, size)) {
+        free(data);
+        return NULL;
+    }
+    file_cache_entry_t *e = entry_new(path, encoding, data, size);
+    if (e == NULL)
+        return NULL;
+    e->stamp = stamp;
+    return entry_insert(e, generation);
+}
+
+str_t file_cache_entry_data(file_cache_entry_t *entry) {
+    return (str_t){.data = entry->data, .len = entry->size};
+}
+
+file_stamp_t file_cache_entry_stamp(file_cache_entry_t *entry) {
+    return entry->stamp;
+}
+
+void file_cache_release(file_cache_entry_t *entry) {
+    pthread_mutex_lock(&cache.lock);
+    bool last = --entry->refs == 0;
+    pthread_mutex_unlock(&cache.lock);
+    if (last)
+        entry_free(entry);
+}
+
+void file_cache_invalidate(str_t path) {
+    pthread_mutex_lock(&cache.lock);
+    cache.generation++;
+    for (int encoding = 0; encoding < CODEC_COUNT; encoding++) {
+        file_cache_entry_t **slot = bucket_slot(path, encoding);
+        if (*slot)
+            entry_remove(slot);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+#include "files.h"
+#include "str.h"
+
+// Process-wide cache of whole file contents keyed by path and encoding,
+// bounded by a byte budget and evicted least-recently-used first. Entries
+// are reference counted so an evicted or invalidated entry stays alive
+// until the last response that points into it has been sent.
+//
+// Besides the file itself the cache holds compressed variants of it, so a
+// hot file is compressed once rather than on every request. Every entry
+// remembers the stamp of the file it was made from; a variant is only
+// served for the cached file with the same stamp.
+
+// Larger files go via sendfile, and their variants are compressed as they
+// are sent.
+#define FILE_CACHE_MAX_ENTRY (1 << 20) // 1MB
+
+typedef struct file_cache_entry file_cache_entry_t;
+
+// budget_bytes == 0 disables the cache; lookups then always miss.
+void file_cache_init(size_t budget_bytes);
+bool file_cache_enabled(void);
+
+// Returns a referenced entry or NULL on a miss.
+file_cache_entry_t *file_cache_lookup(str_t path);
+// Same for a variant, which must have been made from a file matching stamp;
+// a stale one is dropped.
+file_cache_entry_t *file_cache_lookup_variant(str_t path,
+                                              codec_id_t encoding,
+                                              file_stamp_t stamp);
+
+// Current invalidation generation; take it before opening a file to load.
+uint64_t file_cache_generation(void);
+
+// Reads size bytes from fd, the file as of stamp, into a new entry and
+// returns it referenced. Returns NULL when the cache is disabled, the file
+// is too large, the read fails, or the path was invalidated since
+// `generation` was taken.
+file_cache_entry_t *file_cache_load(str_t path, int fd, size_t size,
+                                    file_stamp_t stamp, uint64_t generation);
+
+// Adds a variant made from the file as of stamp, taking over data (from
+// malloc) either way. The file, rather than the variant, must be within
+// FILE_CACHE_MAX_ENTRY. Returns it referenced, or NULL under the same
+// conditions as file_cache_load.
+file_cache_entry_t *file_cache_insert_variant(str_t path,
+                                              codec_id_t encoding,
+                                              file_stamp_t stamp, byte *data,
+                                              size_t size,
+                                              uint64_t generation);
+
+str_t file_cache_entry_data(file_cache_entry_t *entry);
+file_stamp_t file_cache_entry_stamp(file_cache_entry_t *entry);
+void file_cache_release(file_cache_entry_t *entry);
+
+// Drops the entries for path, variants included, e.g. after the file was
+// rewritten.
+void file_cache_invalidate(str_t path);
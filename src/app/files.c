@@ -1,104 +1,78 @@
 #include "files.h"
 #include "arena.h"
+#include "arena_pool.h"
+#include "codec.h"
+#include "file_cache.h"
 #include "str.h"
+#include "zlib_pool.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
 
-str_t mycompress(Arena *a_ptr, str_t src) {
-    z_stream strm;
-    memset(&strm, 0, sizeof(strm));
-
-    uLongf out_cap = compressBound(src.len) + 18; // gzip overhead
-
-    byte *out_ptr = arena_alloc_align(a_ptr, out_cap, 1);
-    // Initialize gzip compression: level=default, method=deflate,
-    // windowBits=15+16 (gzip header/trailer), memLevel=8 (1..9),
-    // strategy=default
-    int ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
-                           Z_DEFAULT_STRATEGY);
-    if (ret != Z_OK) {
-        LOG_ERROR("error in deflateInit2");
-        return (str_t){0};
-    }
-
-    strm.next_in = (Bytef *)src.data;
-    strm.avail_in = (uInt)src.len;
-
-    strm.next_out = (Bytef *)out_ptr;
-    strm.avail_out = (uInt)out_cap;
-
-    do {
-        ret = deflate(&strm, Z_FINISH);
-        if (ret == Z_STREAM_END)
-            break;
-        if (ret != Z_OK && ret != Z_BUF_ERROR) {
-            LOG_ERROR("deflate failed: ret=%d in=%u out=%u", ret, strm.avail_in,
-                      strm.avail_out);
-            deflateEnd(&strm);
-            return (str_t){0};
-        }
-        if (strm.avail_out == 0) {
-            out_cap *= 2;
-            out_ptr = arena_realloc_align(a_ptr, out_ptr, out_cap * 2, 1);
-            assert(out_ptr != NULL);
-        }
-
-    } while (1);
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
-    if (ret != Z_STREAM_END) {
-        LOG_ERROR("error in deflate");
-        deflateEnd(&strm);
-        return (str_t){0};
-    }
-    deflateEnd(&strm);
-
-    return (str_t){.data = out_ptr, .len = strm.total_out};
+// gzip with the pooled deflater at the configured level.
+str_t mycompress(Arena *a_ptr, str_t src) {
+    return codec_compress(a_ptr, codec_get(CODEC_GZIP), src);
 }
 
 str_t mydecompress(Arena *a_ptr, str_t in) {
-    z_stream strm;
-    memset(&strm, 0, sizeof(strm));
-
-    int ret = inflateInit2(&strm, 15 + 32); // auto-detect zlib or gzip
-    if (ret != Z_OK) {
-        LOG_ERROR("error in inflateInit");
+    z_stream *strm = zlib_inflater_get(); // zlib or gzip
+    if (strm == NULL) {
+        LOG_ERROR("error getting an inflate stream");
         return (str_t){0};
     }
 
     uLongf out_cap = (1 << 10); // 1KB
     byte *out_ptr = arena_alloc_align(a_ptr, out_cap, 1);
-    strm.next_in = (Bytef *)in.data;
-    strm.avail_in = in.len;
-    strm.next_out = (Bytef *)out_ptr;
-    strm.avail_out = out_cap;
+    strm->next_in = (Bytef *)in.data;
+    strm->avail_in = in.len;
+    strm->next_out = (Bytef *)out_ptr;
+    strm->avail_out = out_cap;
 
+    int ret;
     do {
-        ret = inflate(&strm, Z_FINISH);
+        ret = inflate(strm, Z_FINISH);
         if (ret == Z_STREAM_END)
             break;
-        if (ret != Z_OK && ret != Z_BUF_ERROR) {
-            LOG_ERROR("inflate failed: ret=%d in=%u out=%u", ret, strm.avail_in,
-                      strm.avail_out);
-            inflateEnd(&strm);
+        // Z_BUF_ERROR with room left to write: the input is cut short.
+        if ((ret != Z_OK && ret != Z_BUF_ERROR) ||
+            (ret == Z_BUF_ERROR && strm->avail_out > 0)) {
+            LOG_ERROR("inflate failed: ret=%d in=%u out=%u", ret,
+                      strm->avail_in, strm->avail_out);
+            zlib_inflater_put(strm);
             return (str_t){0};
         }
-        if (strm.avail_out == 0) {
-            out_cap *= 2;
-            out_ptr = arena_realloc_align(a_ptr, out_ptr, out_cap * 2, 1);
+        if (strm->avail_out == 0) {
+            out_ptr = arena_realloc_align(a_ptr, out_ptr, out_cap, out_cap * 2,
+                                          1);
             assert(out_ptr != NULL);
+            // The buffer may have moved.
+            strm->next_out = (Bytef *)out_ptr + strm->total_out;
+            strm->avail_out = (uInt)out_cap;
+            out_cap *= 2;
         }
     } while (1);
 
-    inflateEnd(&strm);
-    return (str_t){.data = out_ptr, .len = strm.total_out};
+    size_t len = strm->total_out;
+    zlib_inflater_put(strm);
+    out_ptr = arena_realloc_align(a_ptr, out_ptr, out_cap, len, 1);
+    return (str_t){.data = out_ptr, .len = len};
 }
 
 read_result_t read_file(Arena *arena_ptr, str_t file_path) {
-    byte *path = str_to_char_ptr(arena_ptr, file_path);
-    if (path == NULL)
-        return (read_result_t){.error = true};
-
-    FILE *file = fopen(path, "r");
+    Arena *scratch = arena_scratch(arena_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    byte *path = str_to_char_ptr(scratch, file_path);
+    FILE *file = path ? fopen(path, "r") : NULL;
+    arena_restore(scratch, mark);
     if (file == NULL) {
         perror("fopen fails");
         if (errno == ENOENT)
@@ -127,15 +101,187 @@ close_file:
     return (read_result_t){.error = true};
 }
 
-bool file_write(Arena *arena_ptr, str_t content, str_t file_path) {
-    byte *path = str_to_char_ptr(arena_ptr, file_path);
-    if (path == NULL)
+static file_stamp_t stat_stamp(const struct stat *st) {
+#if defined(__APPLE__)
+    struct timespec mtime = st->st_mtimespec;
+#else
+    struct timespec mtime = st->st_mtim;
+#endif
+    return (file_stamp_t){.size = (size_t)st->st_size,
+                          .mtime_ns = (int64_t)mtime.tv_sec * 1000000000 +
+                                      mtime.tv_nsec};
+}
+
+open_result_t open_file(Arena *arena_ptr, str_t file_path) {
+    Arena *scratch = arena_scratch(arena_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    byte *path = str_to_char_ptr(scratch, file_path);
+    if (path == NULL) {
+        arena_restore(scratch, mark);
+        return (open_result_t){.fd = -1, .error = true};
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    arena_restore(scratch, mark);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return (open_result_t){
+                .fd = -1, .doesnt_exist = true, .error = true};
+        perror("open fails");
+        return (open_result_t){.fd = -1, .error = true};
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return (open_result_t){.fd = -1, .doesnt_exist = true, .error = true};
+    }
+
+    return (open_result_t){
+        .fd = fd, .size = (size_t)st.st_size, .stamp = stat_stamp(&st)};
+}
+
+bool file_stat(Arena *arena_ptr, str_t file_path, file_stamp_t *stamp) {
+    Arena *scratch = arena_scratch(arena_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    byte *path = str_to_char_ptr(scratch, file_path);
+    struct stat st;
+    bool ok = path != NULL && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+    arena_restore(scratch, mark);
+    if (ok)
+        *stamp = stat_stamp(&st);
+    return ok;
+}
+
+ssize_t file_send(int sock_fd, int file_fd, off_t *offset, size_t count) {
+#if defined(__linux__)
+    return sendfile(sock_fd, file_fd, offset, count);
+#elif defined(__APPLE__)
+    off_t len = (off_t)count;
+    int ret = sendfile(file_fd, sock_fd, *offset, &len, NULL, 0);
+    // A partial send on a non-blocking socket still reports EAGAIN.
+    if (len > 0) {
+        *offset += len;
+        return (ssize_t)len;
+    }
+    return ret == 0 ? 0 : -1;
+#elif defined(__FreeBSD__)
+    off_t sent = 0;
+    int ret = sendfile(file_fd, sock_fd, *offset, count, NULL, &sent, 0);
+    if (sent > 0) {
+        *offset += sent;
+        return (ssize_t)sent;
+    }
+    return ret == 0 ? 0 : -1;
+#else
+    char buf[1 << 14];
+    if (count > sizeof(buf))
+        count = sizeof(buf);
+    ssize_t n = pread(file_fd, buf, count, *offset);
+    if (n <= 0)
+        return n;
+    ssize_t sent = write(sock_fd, buf, (size_t)n);
+    if (sent > 0)
+        *offset += sent;
+    return sent;
+#endif
+}
+
+// Temp files are "<path>.part.XXXXXX", unique per upload.
+#define UPLOAD_TMP_SUFFIX ".part.XXXXXX"
+#define UPLOAD_TMP_SUFFIX_LEN (sizeof(UPLOAD_TMP_SUFFIX) - 1)
+
+bool file_upload_is_temp(str_t name) {
+    return name.len > UPLOAD_TMP_SUFFIX_LEN &&
+           memcmp(name.data + name.len - UPLOAD_TMP_SUFFIX_LEN, ".part.", 6) ==
+               0;
+}
+
+bool file_upload_begin(Arena *arena_ptr, file_upload_t *upload,
+                       str_t file_path) {
+    upload->fd = -1;
+    upload->failed = false;
+    upload->path = file_path;
+    upload->path_cstr = str_to_char_ptr(arena_ptr, file_path);
+    upload->tmp_path_cstr = arena_alloc_align(
+        arena_ptr, file_path.len + sizeof(UPLOAD_TMP_SUFFIX), 1);
+    if (upload->tmp_path_cstr != NULL) {
+        memcpy(upload->tmp_path_cstr, file_path.data, file_path.len);
+        memcpy(upload->tmp_path_cstr + file_path.len, UPLOAD_TMP_SUFFIX,
+               sizeof(UPLOAD_TMP_SUFFIX));
+    }
+    if (upload->path_cstr == NULL || upload->tmp_path_cstr == NULL)
         return false;
 
-    FILE *file = fopen(path, "wb");
+    // Concurrent uploads to one path each get their own file; the last to
+    // commit wins, whole.
+    upload->fd = mkstemp(upload->tmp_path_cstr);
+    if (upload->fd == -1) {
+        perror("open upload fails");
+        return false;
+    }
+    // mkstemp creates 0600; uploads are served like any other file.
+    if (fcntl(upload->fd, F_SETFD, FD_CLOEXEC) == -1 ||
+        fchmod(upload->fd, 0644) == -1) {
+        perror("open upload fails");
+        file_upload_abort(upload);
+        return false;
+    }
+    return true;
+}
+
+void file_upload_write(file_upload_t *upload, str_t chunk) {
+    while (!upload->failed && chunk.len > 0) {
+        ssize_t n = write(upload->fd, chunk.data, chunk.len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("write to upload fails");
+            upload->failed = true;
+            return;
+        }
+        chunk.data += n;
+        chunk.len -= (size_t)n;
+    }
+}
+
+bool file_upload_commit(file_upload_t *upload) {
+    if (upload->failed) {
+        file_upload_abort(upload);
+        return false;
+    }
+    if (close(upload->fd) == -1) {
+        perror("close upload fails");
+        upload->fd = -1;
+        file_upload_abort(upload);
+        return false;
+    }
+    upload->fd = -1;
+    if (rename(upload->tmp_path_cstr, upload->path_cstr) == -1) {
+        perror("rename upload fails");
+        file_upload_abort(upload);
+        return false;
+    }
+    file_cache_invalidate(upload->path);
+    return true;
+}
+
+void file_upload_abort(file_upload_t *upload) {
+    if (upload->fd != -1)
+        close(upload->fd);
+    upload->fd = -1;
+    unlink(upload->tmp_path_cstr);
+}
+
+bool file_write(Arena *arena_ptr, str_t content, str_t file_path) {
+    Arena *scratch = arena_scratch(arena_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    byte *path = str_to_char_ptr(scratch, file_path);
+    FILE *file = path ? fopen(path, "wb") : NULL;
+    arena_restore(scratch, mark);
     if (file == NULL) {
         perror("fopen fails");
-        goto close_file;
+        return false;
     }
 
     size_t n = fwrite(content.data, 1, content.len, file);
@@ -145,6 +291,7 @@ bool file_write(Arena *arena_ptr, str_t content, str_t file_path) {
     }
 
     fclose(file);
+    file_cache_invalidate(file_path);
     return true;
 
 close_file:
@@ -1,3 +1,7 @@
+#pragma once
+
+#include <sys/types.h>
+
 #include "arena.h"
 #include "str.h"
 #include "types.h"
@@ -8,8 +12,53 @@ typedef struct {
     bool doesnt_exist;
 } read_result_t;
 
+// Identifies one version of a file's contents, to tell whether something
+// derived from it is still current.
+typedef struct {
+    size_t size;
+    int64_t mtime_ns;
+} file_stamp_t;
+
+typedef struct {
+    int fd;
+    size_t size;
+    file_stamp_t stamp;
+    bool error;
+    bool doesnt_exist;
+} open_result_t;
+
+// A file being written piece by piece as a request body arrives. Data goes
+// to a temp file of its own next to path and is renamed over path on
+// commit, so readers never see a half-written upload.
+typedef struct {
+    int fd;
+    str_t path;
+    byte *path_cstr;
+    byte *tmp_path_cstr;
+    bool failed;
+} file_upload_t;
+
 str_t mycompress(Arena *a_ptr, str_t src);
 str_t mydecompress(Arena *a_ptr, str_t in);
 
 bool file_write(Arena *arena_ptr, str_t content, str_t file_path);
 read_result_t read_file(Arena *arena_ptr, str_t file_path);
+
+// True for the name of an upload's temp file, still being written.
+bool file_upload_is_temp(str_t name);
+bool file_upload_begin(Arena *arena_ptr, file_upload_t *upload,
+                       str_t file_path);
+// Appends chunk; after the first failure further writes are skipped and
+// commit reports the error.
+void file_upload_write(file_upload_t *upload, str_t chunk);
+bool file_upload_commit(file_upload_t *upload);
+void file_upload_abort(file_upload_t *upload);
+
+// Opens a regular file for streaming; the caller owns the returned fd.
+open_result_t open_file(Arena *arena_ptr, str_t file_path);
+// Stamp of a regular file without opening it; false if there is none.
+bool file_stat(Arena *arena_ptr, str_t file_path, file_stamp_t *stamp);
+// Sends up to count bytes of file_fd starting at *offset straight from the
+// page cache to sock_fd, advancing *offset. Same return convention as
+// write(2): -1 with errno EAGAIN when a non-blocking socket is full.
+ssize_t file_send(int sock_fd, int file_fd, off_t *offset, size_t count);
@@ -1,28 +1,48 @@
 #include "http.h"
+#include "arena_pool.h"
+#include "file_cache.h"
 #include "files.h"
+#include "encode_stream.h"
 #include "log.h"
+#include "negotiate.h"
+#include "router.h"
 #include "str.h"
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define BUF_SIZE 4096
+// Size line room in front of each streamed chunk: 16 hex digits and CRLF.
+#define STREAM_CHUNK_HEAD 18
+#define FILES_DIR "/tmp/data/codecrafters.io/http-server-tester/"
 
-http_request_t new_http_request(Arena *a_ptr) {
-    return (http_request_t){.headers = http_header_vec_new(a_ptr, 10)};
+static size_t max_body_size = (size_t)1 << 30; // 1GB
+static size_t compress_min_size = 0;
+// Built once by http_routes_init() before any connection is served.
+static http_router_t router;
+
+void http_set_max_body_size(size_t max_body) { max_body_size = max_body; }
+void http_set_compress_min_size(size_t min_size) {
+    compress_min_size = min_size;
 }
 
 http_response_t new_http_response(Arena *a_ptr) {
-    return (http_response_t){.headers = http_header_vec_new(a_ptr, 10)};
+    return (http_response_t){.headers = http_header_vec_new(a_ptr, 10),
+                             .content_length = -1,
+                             .body_fd = -1};
 }
 
-int find_header(http_header_vec_t headers_vec, str_t key) {
-    for (size_t i = 0; i < http_header_vec_len(headers_vec); i++) {
-        http_header_t h = http_header_vec_get(headers_vec, i);
-        if (str_cmp(h.key, key)) {
+int find_header(const http_request_t *request, str_t key) {
+    for (size_t i = 0; i < request->header_count; i++) {
+        if (str_casecmp(request->headers[i].key, key)) {
             return i;
         }
     }
@@ -30,371 +50,1362 @@ int find_header(http_header_vec_t headers_vec, str_t key) {
     return -1;
 }
 
-str_t response_to_str(Arena *a, http_response_t *response);
+static void http_conn_compact(http_conn_t *conn);
+static bool http_upload_path(Arena *a_ptr, http_request_t *request_ptr,
+                             str_t *path);
+void set_response_without_body(Arena *a_ptr, http_response_t *response,
+                               HTTP_STATUS_CODE statuc_code);
 
-void *handle_http_connection(void *arg) {
-    // This is a common C trick for passing an integer to a thread.
-    // The integer file descriptor is cast to a void* in the calling function
-    // and then cast back here. This avoids a malloc/free cycle.
-    // The cast to `intptr_t` is important to ensure the pointer value is
-    // converted to an integer of the correct size without data loss.
-    int fd = (int)(intptr_t)arg;
-    LOG_INFO("Handling HTTP connection from client %d", fd);
+bool http_conn_init(http_conn_t *conn, int fd) {
+    conn->fd = fd;
+    conn->state = HTTP_CONN_READING;
+    conn->arena = arena_pool_get(HTTP_CONN_ARENA_SIZE);
+    bool recv_ok = recv_buf_init(&conn->recv, HTTP_RECV_BUF_SIZE);
+    conn->should_close = false;
+    conn->file_fd = -1;
+    conn->stream = (http_body_source_t){0};
+    conn->release_count = 0;
+    conn->uploading = false;
+    http_iovec_reset(&conn->out);
+    http_conn_compact(conn);
+    if (conn->arena.chunk == NULL || !recv_ok) {
+        LOG_ERROR("out of memory for connection %d", fd);
+        return false;
+    }
+    return true;
+}
 
-    Arena cnn_arena = arena_new((1 << 21)); // 2MB
+static void http_conn_end_stream(http_conn_t *conn) {
+    if (conn->stream.close)
+        conn->stream.close(conn->stream.ctx);
+    conn->stream = (http_body_source_t){0};
+}
 
-    char remaining_byte_buf[(1 << 12)]; // 4KB
-    size_t remaing_byte_len = 0;
+// Lets go of whatever the last batch of response bodies was borrowing.
+static void http_conn_close_file(http_conn_t *conn) {
+    if (conn->file_fd != -1)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    conn->file_offset = 0;
+    conn->file_remaining = 0;
+    http_conn_end_stream(conn);
 
-    bool should_close = false;
-    while (!should_close) {
-        str_buffer_t read_bytes_buff =
-            str_buffer_new(&cnn_arena, (1 << 13)); // 8KB
+    for (int i = 0; i < conn->release_count; i++)
+        conn->releases[i].fn(conn->releases[i].ctx);
+    conn->release_count = 0;
+}
+
+void http_conn_destroy(http_conn_t *conn) {
+    http_conn_close_file(conn);
+    if (conn->uploading)
+        file_upload_abort(&conn->upload);
+    conn->uploading = false;
+    arena_pool_put(&conn->arena);
+    recv_buf_free(&conn->recv);
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+static void http_conn_next_request(http_conn_t *conn) {
+    conn->header_parsed = false;
+    conn->header_end_pos = 0;
+    conn->request_end_pos = 0;
+    conn->request = (http_request_t){0};
+    http_parser_init(&conn->parser);
+    conn->early_status = 0;
+    conn->body_len = 0;
+    conn->decoding_chunks = false;
+    conn->upload_remaining = 0;
+    conn->upload_chunked = false;
+}
+
+// Recycles the arena once every response pointing into it has been sent.
+// The receive buffer keeps the start of the next pipelined request as is.
+static void http_conn_compact(http_conn_t *conn) {
+    arena_rest(&conn->arena);
+    recv_buf_shrink(&conn->recv, HTTP_RECV_BUF_SIZE);
+    http_conn_next_request(conn);
+}
+
+static void rebase_str(str_t *s, uintptr_t old_head, size_t len,
+                       byte *new_head) {
+    uintptr_t p = (uintptr_t)s->data;
+    if (s->data != NULL && p >= old_head && p < old_head + len)
+        s->data = new_head + (p - old_head);
+}
+
+// Makes room for n more bytes in the receive buffer. The request being
+// parsed, or waiting for its body, holds slices of the buffer, so they
+// follow it if it moves. Only called between batches, when
+// no response points into the buffer.
+static bool http_conn_reserve(http_conn_t *conn, size_t n) {
+    uintptr_t old_head = (uintptr_t)recv_buf_head(&conn->recv);
+    size_t len = recv_buf_len(&conn->recv);
+    if (!recv_buf_reserve(&conn->recv, n))
+        return false;
+
+    byte *new_head = recv_buf_head(&conn->recv);
+    if ((uintptr_t)new_head == old_head)
+        return true;
+
+    http_request_t *r = &conn->request;
+    rebase_str(&r->method, old_head, len, new_head);
+    rebase_str(&r->url, old_head, len, new_head);
+    rebase_str(&r->version, old_head, len, new_head);
+    // One past header_count: the parser may be halfway through a header.
+    for (size_t i = 0; i <= r->header_count && i < MAX_HEADERS; i++) {
+        rebase_str(&r->headers[i].key, old_head, len, new_head);
+        rebase_str(&r->headers[i].value, old_head, len, new_head);
+    }
+    for (size_t i = 0; i < r->param_count; i++)
+        rebase_str(&r->params[i].value, old_head, len, new_head);
+    return true;
+}
+
+// Free space wanted before a read: a full body in one go when its length
+// is known, otherwise BUF_SIZE.
+static size_t http_conn_read_size(http_conn_t *conn) {
+    size_t len = recv_buf_len(&conn->recv);
+    if (conn->header_parsed && conn->upload_remaining == 0 &&
+        conn->request_end_pos > len + BUF_SIZE)
+        return conn->request_end_pos - len;
+    return BUF_SIZE;
+}
+
+static bool http_conn_upload_pending(http_conn_t *conn) {
+    return conn->upload_remaining > 0 || conn->upload_chunked;
+}
 
-        for (size_t i = 0; i < remaing_byte_len; i++) {
-            str_buffer_append_char(&cnn_arena, &read_bytes_buff,
-                                   remaining_byte_buf[i]);
+// Writes the upload body found in data[0, n) to the file and returns how
+// many bytes belonged to it, chunk framing included. Bad framing or an
+// oversized chunked body ends the upload with an early error.
+static size_t http_conn_upload_body(http_conn_t *conn, byte *data, size_t n) {
+    if (conn->upload_remaining > 0) {
+        size_t body = n < conn->upload_remaining ? n : conn->upload_remaining;
+        file_upload_write(&conn->upload, (str_t){.data = data, .len = body});
+        conn->upload_remaining -= body;
+        return body;
+    }
+
+    size_t used = 0;
+    while (conn->upload_chunked && used < n) {
+        size_t consumed;
+        str_t chunk;
+        http_parse_status_t status = http_chunked_decode(
+            &conn->chunks, (str_t){.data = data + used, .len = n - used},
+            &consumed, &chunk);
+        used += consumed;
+        conn->body_len += chunk.len;
+        if (conn->body_len > max_body_size) {
+            conn->early_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+            conn->upload_chunked = false;
+        } else if (status == HTTP_PARSE_ERROR) {
+            conn->early_status = HTTP_STATUS_BAD_REQUEST;
+            conn->upload_chunked = false;
+        } else {
+            if (chunk.len > 0)
+                file_upload_write(&conn->upload, chunk);
+            if (status == HTTP_PARSE_DONE)
+                conn->upload_chunked = false;
         }
+    }
+    return used;
+}
 
-        bool header_parsed = false;
-        int header_end_pos = -1;
-        int request_end_pos = -1;
+// Accounts for n bytes just written to the tail of the receive buffer.
+// Body bytes of a streamed upload go straight to the file; only what
+// follows the body (a pipelined request) stays buffered.
+static void http_conn_received(http_conn_t *conn, size_t n) {
+    byte *data = recv_buf_tail(&conn->recv);
+    if (http_conn_upload_pending(conn)) {
+        size_t body = http_conn_upload_body(conn, data, n);
+        memmove(data, data + body, n - body);
+        n -= body;
+    }
+    recv_buf_commit(&conn->recv, n);
+}
 
-        http_request_t http_request = new_http_request(&cnn_arena);
+bool http_conn_feed(http_conn_t *conn, const char *data, size_t len) {
+    if (!http_conn_reserve(conn, len)) {
+        LOG_ERROR("Out of memory growing the receive buffer");
+        return false;
+    }
+    memcpy(recv_buf_tail(&conn->recv), data, len);
+    http_conn_received(conn, len);
+    return true;
+}
 
-        while (request_end_pos == -1 ||
-               read_bytes_buff.len < (size_t)request_end_pos) {
-            char buf[BUF_SIZE];
-            ssize_t n = read(fd, buf, sizeof(buf));
+// Starts streaming the body to disk if the request is an upload. Body bytes
+// that arrived together with the headers are written out and cut from the
+// read buffer, which from then on only holds the headers and whatever
+// follows the body.
+static bool http_conn_begin_upload(http_conn_t *conn, size_t content_length,
+                                   bool chunked) {
+    str_t path;
+    if (!http_upload_path(&conn->arena, &conn->request, &path))
+        return false;
+    if (!file_upload_begin(&conn->arena, &conn->upload, path)) {
+        conn->early_status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        return true;
+    }
+    conn->uploading = true;
+    conn->request.upload = &conn->upload;
+
+    conn->upload_remaining = content_length;
+    conn->upload_chunked = chunked;
+    byte *body = recv_buf_head(&conn->recv) + conn->header_end_pos;
+    size_t buffered = recv_buf_len(&conn->recv) - conn->header_end_pos;
+    size_t n = http_conn_upload_body(conn, body, buffered);
+    memmove(body, body + n, buffered - n);
+    conn->recv.end -= n;
+    return true;
+}
+
+// Decodes the chunked body buffered so far, packing the data right after
+// the headers. Returns false while the last chunk has yet to arrive.
+static bool http_conn_decode_chunks(http_conn_t *conn) {
+    byte *head = recv_buf_head(&conn->recv);
+    size_t len = recv_buf_len(&conn->recv);
+    while (conn->chunk_pos < len) {
+        size_t consumed;
+        str_t chunk;
+        http_parse_status_t status = http_chunked_decode(
+            &conn->chunks,
+            (str_t){.data = head + conn->chunk_pos,
+                    .len = len - conn->chunk_pos},
+            &consumed, &chunk);
+        conn->chunk_pos += consumed;
+        if (status == HTTP_PARSE_ERROR) {
+            conn->early_status = HTTP_STATUS_BAD_REQUEST;
+            conn->decoding_chunks = false;
+            break;
+        }
+        if (conn->body_len + chunk.len > HTTP_MAX_BUFFERED_BODY) {
+            conn->early_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+            conn->decoding_chunks = false;
+            break;
+        }
+        if (chunk.len > 0)
+            memmove(head + conn->header_end_pos + conn->body_len, chunk.data,
+                    chunk.len);
+        conn->body_len += chunk.len;
+        // The framing stays buffered until the request is done, so it is
+        // held to the same limit: tiny chunks with long extensions would
+        // otherwise grow the buffer without growing the body.
+        if (conn->chunk_pos - conn->header_end_pos - conn->body_len >
+            HTTP_MAX_BUFFERED_BODY) {
+            conn->early_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+            conn->decoding_chunks = false;
+            break;
+        }
+        if (status == HTTP_PARSE_DONE) {
+            conn->request_end_pos = conn->chunk_pos;
+            conn->decoding_chunks = false;
+            break;
+        }
+    }
+    return !conn->decoding_chunks;
+}
+
+// Returns true once the receive buffer holds a complete request (headers
+// and Content-Length bytes of body, unless the body is streamed to a file).
+bool http_conn_request_ready(http_conn_t *conn) {
+    if (!conn->header_parsed) {
+        str_t pending = {.data = recv_buf_head(&conn->recv),
+                         .len = recv_buf_len(&conn->recv)};
+        http_parse_status_t status =
+            http_parser_execute(&conn->parser, pending, &conn->request);
+        if (status == HTTP_PARSE_AGAIN && pending.len <= HTTP_MAX_HEADER_SIZE)
+            return false;
+
+        conn->header_parsed = true;
+        if (status == HTTP_PARSE_ERROR) {
+            conn->early_status = HTTP_STATUS_BAD_REQUEST;
+            return true;
+        }
+        if (status != HTTP_PARSE_DONE) {
+            conn->early_status = HTTP_STATUS_HEADER_FIELDS_TOO_LARGE;
+            return true;
+        }
+
+        conn->header_end_pos = conn->parser.pos;
+        conn->request_end_pos = conn->header_end_pos;
+
+        size_t content_length = 0;
+        str_t value;
+        bool has_length = http_request_header(
+            &conn->request, HTTP_HEADER_CONTENT_LENGTH, &value);
+        if (has_length && !str_to_size(value, &content_length)) {
+            conn->early_status = HTTP_STATUS_BAD_REQUEST;
+            return true;
+        }
+
+        bool chunked = http_request_header(
+            &conn->request, HTTP_HEADER_TRANSFER_ENCODING, &value);
+        if (chunked) {
+            // Both framings at once is how requests get smuggled, and
+            // HTTP/1.0 has no chunked coding.
+            if (has_length || str_cmp(conn->request.version, SL("HTTP/1.0"))) {
+                conn->early_status = HTTP_STATUS_BAD_REQUEST;
+                return true;
+            }
+            if (!str_casecmp(value, SL("chunked"))) {
+                conn->early_status = HTTP_STATUS_NOT_IMPLEMENTED;
+                return true;
+            }
+            http_chunked_init(&conn->chunks);
+        }
+
+        if (content_length > max_body_size) {
+            conn->early_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+            return true;
+        }
+        if ((content_length > 0 || chunked) &&
+            http_conn_begin_upload(conn, content_length, chunked))
+            return !http_conn_upload_pending(conn);
+        if (content_length > HTTP_MAX_BUFFERED_BODY) {
+            conn->early_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+            return true;
+        }
+        conn->body_len = content_length;
+        conn->request_end_pos += content_length;
+        if (chunked) {
+            conn->decoding_chunks = true;
+            conn->chunk_pos = conn->header_end_pos;
+        }
+    }
+
+    if (conn->decoding_chunks && !http_conn_decode_chunks(conn))
+        return false;
+    return recv_buf_len(&conn->recv) >= conn->request_end_pos &&
+           !http_conn_upload_pending(conn);
+}
+
+// Chunked framing needs HTTP/1.1; an HTTP/1.0 client gets the raw body and
+// learns where it ends when the connection closes.
+static void http_conn_begin_stream(http_conn_t *conn,
+                                   http_response_t *response) {
+    conn->stream = response->body_source;
+    conn->stream_chunked = !str_cmp(conn->request.version, SL("HTTP/1.0"));
+    if (conn->stream_chunked) {
+        http_header_vec_push(&conn->arena, &response->headers,
+                             (http_header_t){.key = SL("Transfer-Encoding"),
+                                             .value = SL("chunked")});
+    } else if (!conn->should_close) {
+        http_header_vec_push(
+            &conn->arena, &response->headers,
+            (http_header_t){.key = SL("Connection"), .value = SL("close")});
+        conn->should_close = true;
+    }
+    conn->stream_buf = arena_alloc_align(
+        &conn->arena, STREAM_CHUNK_HEAD + HTTP_STREAM_CHUNK + 2,
+        _Alignof(byte));
+}
+
+bool http_conn_stream_next(http_conn_t *conn) {
+    if (conn->stream.read == NULL)
+        return false;
+    http_iovec_reset(&conn->out);
+
+    byte *data = conn->stream_buf + STREAM_CHUNK_HEAD;
+    ssize_t n = conn->stream.read(conn->stream.ctx, data, HTTP_STREAM_CHUNK);
+    if (n < 0) {
+        // Too late for an error status; cutting the connection short is
+        // the only way to tell the client the body is incomplete.
+        LOG_ERROR("Response body source failed");
+        conn->should_close = true;
+        http_conn_end_stream(conn);
+        return false;
+    }
+    if (n == 0) {
+        http_conn_end_stream(conn);
+        if (!conn->stream_chunked)
+            return false;
+        http_iovec_push(&conn->out, SL("0" CRLF CRLF));
+        return true;
+    }
+    if (!conn->stream_chunked) {
+        http_iovec_push(&conn->out, (str_t){.data = data, .len = (size_t)n});
+        return true;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    byte *start = data;
+    *--start = '\n';
+    *--start = '\r';
+    for (size_t v = (size_t)n; v > 0; v >>= 4)
+        *--start = hex[v & 15];
+    memcpy(data + n, CRLF, 2);
+    http_iovec_push(&conn->out,
+                    (str_t){.data = start, .len = (size_t)(data + n + 2 - start)});
+    return true;
+}
+
+static void http_conn_handle_one(http_conn_t *conn) {
+    conn->request.body =
+        (str_t){.data = recv_buf_head(&conn->recv) + conn->header_end_pos,
+                .len = conn->uploading ? 0 : conn->body_len};
+
+    http_response_t http_response = new_http_response(&conn->arena);
+    LOG_DEBUG("Received request: %.*s", (int)conn->request_end_pos,
+              recv_buf_head(&conn->recv));
+    if (conn->early_status != 0) {
+        // The body was never read, so the connection cannot be reused.
+        if (conn->uploading)
+            file_upload_abort(&conn->upload);
+        conn->uploading = false;
+        set_response_without_body(&conn->arena, &http_response,
+                                  conn->early_status);
+        http_header_vec_push(
+            &conn->arena, &http_response.headers,
+            (http_header_t){.key = SL("Connection"), .value = SL("close")});
+        conn->should_close = true;
+    } else {
+        conn->should_close =
+            handle_http_request(&conn->arena, &conn->request, &http_response);
+        // The handler commits the upload; anything left over failed.
+        if (conn->uploading && conn->upload.fd != -1)
+            file_upload_abort(&conn->upload);
+        conn->uploading = false;
+    }
+    if (conn->should_close)
+        LOG_DEBUG("Connection will be closed after this response");
+
+    if (http_response.body_source.read != NULL)
+        http_conn_begin_stream(conn, &http_response);
+
+    response_to_iovec(&conn->arena, &http_response, &conn->out);
+    conn->file_fd = http_response.body_fd;
+    conn->file_offset = 0;
+    conn->file_remaining = http_response.body_fd_len;
+    if (http_response.body_release) {
+        conn->releases[conn->release_count++] = (http_body_release_t){
+            .fn = http_response.body_release,
+            .ctx = http_response.body_release_ctx};
+    }
+}
+
+// Answers the ready request and every complete request queued behind it,
+// appending all responses to conn->out. A batch ends early when the
+// connection is closing, a response streams a file or a body source (its
+// body must follow its own headers), or the iovec/release slots run low.
+void http_conn_handle(http_conn_t *conn) {
+    do {
+        http_conn_handle_one(conn);
+        // Consuming only moves the head; the bytes stay put until the
+        // batch has been written.
+        recv_buf_consume(&conn->recv, conn->request_end_pos);
+        http_conn_next_request(conn);
+
+        if (conn->should_close || conn->file_fd != -1 ||
+            conn->stream.read != NULL ||
+            conn->release_count == HTTP_MAX_PIPELINE ||
+            HTTP_MAX_IOV - conn->out.count < HTTP_PIPELINE_IOV_RESERVE)
+            break;
+    } while (http_conn_request_ready(conn));
+}
+
+bool http_conn_response_done(http_conn_t *conn) {
+    http_conn_close_file(conn);
+    if (conn->should_close)
+        return false;
+    http_iovec_reset(&conn->out);
+    // A request whose headers are parsed but whose body is still arriving
+    // keeps its headers in the arena, so compaction waits for the next batch.
+    if (!conn->header_parsed)
+        http_conn_compact(conn);
+    return true;
+}
+
+http_conn_status_t http_conn_drive(http_conn_t *conn) {
+    while (true) {
+        switch (conn->state) {
+        case HTTP_CONN_READING: {
+            if (http_conn_request_ready(conn)) {
+                conn->state = HTTP_CONN_HANDLING;
+                break;
+            }
+
+            if (!http_conn_reserve(conn, http_conn_read_size(conn))) {
+                LOG_ERROR("Out of memory growing the receive buffer");
+                conn->state = HTTP_CONN_CLOSED;
+                break;
+            }
+            ssize_t n = read(conn->fd, recv_buf_tail(&conn->recv),
+                             recv_buf_free_space(&conn->recv));
             if (n == 0) {
-                goto end_cnn;
+                conn->state = HTTP_CONN_CLOSED;
+                break;
             }
             if (n < 0) {
+                if (errno == EINTR)
+                    break;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return HTTP_CONN_WANT_READ;
                 perror("read failed");
-                goto end_cnn;
+                conn->state = HTTP_CONN_CLOSED;
+                break;
             }
 
-            for (size_t i = 0; i < (size_t)n; i++) {
-                str_buffer_append_char(&cnn_arena, &read_bytes_buff, buf[i]);
-            }
+            http_conn_received(conn, (size_t)n);
+            break;
+        }
+
+        case HTTP_CONN_HANDLING:
+            http_conn_handle(conn);
+            conn->state = HTTP_CONN_WRITING;
+            break;
 
-            if (!header_parsed) {
-                int crlf_token_start =
-                    str_find(str_buffer_to_str(read_bytes_buff), S(CRLF_CRLF));
-                if (crlf_token_start != -1) {
-                    header_parsed = true;
-                    parse_HTTP_headers(
-                        &cnn_arena,
-                        str_span(str_buffer_to_str(read_bytes_buff), 0,
-                                 crlf_token_start),
-                        &http_request);
-
-                    header_end_pos = crlf_token_start + strlen(CRLF_CRLF);
-                    request_end_pos = header_end_pos;
-
-                    int index =
-                        find_header(http_request.headers, S("Content-Length"));
-                    if (index != -1) {
-                        http_header_t h =
-                            http_header_vec_get(http_request.headers, index);
-                        int content_length = str_atoi(h.value);
-                        request_end_pos += content_length;
-                    }
+        case HTTP_CONN_WRITING: {
+            http_iovec_t *out = &conn->out;
+            while (out->remaining > 0) {
+                // HTTP_MAX_IOV stays below IOV_MAX on Linux and macOS.
+                ssize_t n = writev(conn->fd, out->iov + out->index,
+                                   out->count - out->index);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return HTTP_CONN_WANT_WRITE;
+                if (n <= 0) {
+                    perror("writev");
+                    conn->state = HTTP_CONN_CLOSED;
+                    break;
                 }
+                http_iovec_advance(out, (size_t)n);
             }
-        }
+            if (conn->state == HTTP_CONN_CLOSED)
+                break;
 
-        str_t full_request =
-            str_span(str_buffer_to_str(read_bytes_buff), 0, request_end_pos);
-        str_t body = str_span(full_request, header_end_pos, request_end_pos);
-
-        http_request.body = body;
-
-        http_response_t http_response = new_http_response(&cnn_arena);
-        LOG_INFO("Received request: %.*s", (int)full_request.len,
-                 full_request.data);
-        should_close =
-            handle_http_request(&cnn_arena, &http_request, &http_response);
-        if (should_close)
-            LOG_INFO("Connection will be closed after this response");
-        else
-            LOG_INFO("Keeping connection alive");
-        str_t response_str = response_to_str(&cnn_arena, &http_response);
-
-        size_t total_send = 0;
-        while (total_send < response_str.len) {
-            ssize_t n = write(fd, response_str.data + total_send,
-                              response_str.len - total_send);
-            if (n <= 0) {
-                perror("write");
-                goto end_cnn;
+            while (conn->file_remaining > 0) {
+                ssize_t n = file_send(conn->fd, conn->file_fd,
+                                      &conn->file_offset, conn->file_remaining);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return HTTP_CONN_WANT_WRITE;
+                if (n <= 0) {
+                    perror("sendfile");
+                    conn->state = HTTP_CONN_CLOSED;
+                    break;
+                }
+                conn->file_remaining -= (size_t)n;
             }
-            total_send += n;
+            if (conn->state == HTTP_CONN_CLOSED)
+                break;
+            if (http_conn_stream_next(conn))
+                break;
+
+            conn->state = http_conn_response_done(conn) ? HTTP_CONN_READING
+                                                        : HTTP_CONN_CLOSED;
+            break;
         }
 
-        size_t leftover = read_bytes_buff.len - request_end_pos;
-        if (leftover > sizeof(remaining_byte_buf))
-            leftover = sizeof(remaining_byte_buf);
-        memcpy(remaining_byte_buf, read_bytes_buff.data + request_end_pos,
-               leftover);
-        remaing_byte_len = leftover;
-        arena_rest(&cnn_arena);
-        printf("finished one request-response cycle\n");
+        case HTTP_CONN_CLOSED:
+            return HTTP_CONN_DONE;
+        }
     }
+}
 
-end_cnn:
-    arena_destroy(&cnn_arena);
-    close(fd);
+// Best-effort canned 408 for a request that stopped arriving. Nothing else
+// is in flight on the connection, so a single write is enough.
+static void http_reject_timeout(int fd) {
+    static const char response[] = "HTTP/1.1 408 Request Timeout" CRLF
+                                   "Content-Length: 0" CRLF
+                                   "Connection: close" CRLF CRLF;
+    if (write(fd, response, sizeof(response) - 1) < 0)
+        perror("write");
+}
+
+void *handle_http_connection(void *arg) {
+    // This is a common C trick for passing an integer to a thread.
+    // The integer file descriptor is cast to a void* in the calling function
+    // and then cast back here. This avoids a malloc/free cycle.
+    // The cast to `intptr_t` is important to ensure the pointer value is
+    // converted to an integer of the correct size without data loss.
+    int fd = (int)(intptr_t)arg;
+    LOG_INFO("Handling HTTP connection from client %d", fd);
+
+    // On a blocking socket a single call runs the connection to completion.
+    // It only returns WANT_READ when a receive timeout (set by the thread
+    // pool) expired: idle between requests the connection just closes,
+    // partway through one the client is told why.
+    http_conn_t conn;
+    if (http_conn_init(&conn, fd) &&
+        http_conn_drive(&conn) == HTTP_CONN_WANT_READ &&
+        (recv_buf_len(&conn.recv) > 0 || conn.uploading))
+        http_reject_timeout(fd);
+    http_conn_destroy(&conn);
     return NULL;
 }
 
+// Best-effort canned 503 for connections we refuse to queue. The socket is
+// still blocking here, and the response is small enough to fit in the send
+// buffer, so a single write is enough.
+void http_reject_unavailable(int fd) {
+    static const char response[] = "HTTP/1.1 503 Service Unavailable" CRLF
+                                   "Content-Length: 0" CRLF
+                                   "Connection: close" CRLF CRLF;
+    if (write(fd, response, sizeof(response) - 1) < 0)
+        perror("write");
+}
+
+// code, reason phrase
+#define HTTP_STATUS_LIST(X)                                                    \
+    X(OK, 200, "OK")                                                           \
+    X(CREATED_SUCCESSFULLY, 201, "Created")                                    \
+    X(BAD_REQUEST, 400, "Bad Request")                                         \
+    X(NOT_FOUND, 404, "Not Found")                                             \
+    X(METHOD_NOT_ALLOWED, 405, "Method Not Allowed")                           \
+    X(REQUEST_TIMEOUT, 408, "Request Timeout")                                 \
+    X(PAYLOAD_TOO_LARGE, 413, "Payload Too Large")                             \
+    X(HEADER_FIELDS_TOO_LARGE, 431, "Request Header Fields Too Large")         \
+    X(INTERNAL_SERVER_ERROR, 500, "Internal Server Error")                     \
+    X(NOT_IMPLEMENTED, 501, "Not Implemented")                                 \
+    X(SERVICE_UNAVAILABLE, 503, "Service Unavailable")
+
 str_t http_status_message(HTTP_STATUS_CODE code) {
     switch (code) {
-    case HTTP_STATUS_OK:
-        return S("OK");
-    case HTTP_STATUS_BAD_REQUEST:
-        return S("Bad Request");
-    case HTTP_STATUS_NOT_FOUND:
-        return S("Not Found");
-    case HTTP_STATUS_INTERNAL_SERVER_ERROR:
-        return S("Internal Server Error");
-    case HTTP_STATUS_CREATED_SUCCESSFULLY:
-        return S("Created");
+#define X(name, num, reason)                                                   \
+    case HTTP_STATUS_##name:                                                   \
+        return SL(reason);
+        HTTP_STATUS_LIST(X)
+#undef X
     default:
-        return S("Unknown Status");
+        return SL("Unknown Status");
     }
 }
 
-str_t response_to_str(Arena *a, http_response_t *response) {
-    str_buffer_t response_buffer =
-        str_buffer_new(a, http_header_vec_len(response->headers) * 10 +
-                              response->body.len + 100);
-
-    // add status line
-    str_buffer_append_str(a, &response_buffer, S("HTTP/1.1 "));
-    str_buffer_append_str(a, &response_buffer,
-                          int_to_str(a, response->status_code));
-    str_buffer_append_str(a, &response_buffer, S(" "));
-    str_buffer_append_str(a, &response_buffer,
-                          http_status_message(response->status_code));
-    str_buffer_append_str(a, &response_buffer, S(CRLF));
-
-    // add headers
-    for (size_t i = 0; i < http_header_vec_len(response->headers); i++) {
+// The complete status line, CRLF included.
+static str_t http_status_line(HTTP_STATUS_CODE code) {
+    switch (code) {
+#define X(name, num, reason)                                                   \
+    case HTTP_STATUS_##name:                                                   \
+        return SL("HTTP/1.1 " #num " " reason CRLF);
+        HTTP_STATUS_LIST(X)
+#undef X
+    default:
+        return SL("HTTP/1.1 500 Internal Server Error" CRLF);
+    }
+}
+
+static byte *put(byte *p, str_t s) {
+    memcpy(p, s.data, s.len);
+    return p + s.len;
+}
+
+static byte *put_2digits(byte *p, int v) {
+    *p++ = (byte)('0' + v / 10);
+    *p++ = (byte)('0' + v % 10);
+    return p;
+}
+
+#define HTTP_SERVER_NAME "httpserver"
+#define DATE_BLOCK_LEN                                                         \
+    (sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT" CRLF                         \
+            "Server: " HTTP_SERVER_NAME CRLF) -                                 \
+     1)
+
+// The Date and Server header lines, re-rendered once a second by whichever
+// thread first notices the second changed. Readers copy the text under a
+// sequence lock: an odd seq means a rewrite is in progress.
+static struct {
+    _Atomic unsigned seq;
+    _Atomic time_t second;
+    byte text[DATE_BLOCK_LEN];
+} date_cache;
+
+static void date_cache_refresh(time_t now) {
+    static const char days[7][4] = {"Sun", "Mon", "Tue", "Wed",
+                                    "Thu", "Fri", "Sat"};
+    static const char months[12][4] = {"Jan", "Feb", "Mar", "Apr",
+                                       "May", "Jun", "Jul", "Aug",
+                                       "Sep", "Oct", "Nov", "Dec"};
+    unsigned seq = atomic_load_explicit(&date_cache.seq, memory_order_relaxed);
+    if ((seq & 1) ||
+        !atomic_compare_exchange_strong_explicit(&date_cache.seq, &seq,
+                                                 seq + 1, memory_order_relaxed,
+                                                 memory_order_relaxed))
+        return; // another thread is already at it
+    atomic_thread_fence(memory_order_release);
+
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    // Date: Sun, 06 Nov 1994 08:49:37 GMT
+    byte *p = date_cache.text;
+    p = put(p, SL("Date: "));
+    p = put(p, (str_t){.data = (byte *)days[tm.tm_wday], .len = 3});
+    p = put(p, SL(", "));
+    p = put_2digits(p, tm.tm_mday);
+    *p++ = ' ';
+    p = put(p, (str_t){.data = (byte *)months[tm.tm_mon], .len = 3});
+    *p++ = ' ';
+    p = put_2digits(p, (tm.tm_year + 1900) / 100);
+    p = put_2digits(p, (tm.tm_year + 1900) % 100);
+    *p++ = ' ';
+    p = put_2digits(p, tm.tm_hour);
+    *p++ = ':';
+    p = put_2digits(p, tm.tm_min);
+    *p++ = ':';
+    p = put_2digits(p, tm.tm_sec);
+    put(p, SL(" GMT" CRLF "Server: " HTTP_SERVER_NAME CRLF));
+    atomic_store_explicit(&date_cache.second, now, memory_order_relaxed);
+    atomic_store_explicit(&date_cache.seq, seq + 2, memory_order_release);
+}
+
+// Copies the current Date and Server lines to out (DATE_BLOCK_LEN bytes).
+static void http_write_date_block(byte *out) {
+    // The coarse clock is a plain memory read; its few ms of lag do not
+    // matter at one-second resolution.
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    time_t now = ts.tv_sec;
+    if (atomic_load_explicit(&date_cache.second, memory_order_relaxed) != now)
+        date_cache_refresh(now);
+    for (;;) {
+        unsigned seq =
+            atomic_load_explicit(&date_cache.seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy(out, date_cache.text, DATE_BLOCK_LEN);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&date_cache.seq, memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+// Status line and headers, written straight into one arena buffer that is
+// sized up front.
+static str_t response_head(Arena *a, http_response_t *response) {
+    str_t status = http_status_line(response->status_code);
+    size_t header_count = http_header_vec_len(response->headers);
+
+    size_t len = status.len + DATE_BLOCK_LEN + 2;
+    if (response->content_length >= 0)
+        len += SL("Content-Length: ").len + U64_DEC_MAX + 2;
+    for (size_t i = 0; i < header_count; i++) {
         http_header_t h = http_header_vec_get(response->headers, i);
-        str_buffer_append_str(a, &response_buffer, h.key);
-        str_buffer_append_str(a, &response_buffer, S(": "));
-        str_buffer_append_str(a, &response_buffer, h.value);
-        str_buffer_append_str(a, &response_buffer, S(CRLF));
+        len += h.key.len + h.value.len + 4;
     }
-    str_buffer_append_str(a, &response_buffer, S(CRLF));
-    // add body
-    str_buffer_append_str(a, &response_buffer, response->body);
-    return str_buffer_to_str(response_buffer);
+
+    byte *start = arena_alloc_align(a, len, _Alignof(byte));
+    byte *p = put(start, status);
+    http_write_date_block(p);
+    p += DATE_BLOCK_LEN;
+    for (size_t i = 0; i < header_count; i++) {
+        http_header_t h = http_header_vec_get(response->headers, i);
+        p = put(p, h.key);
+        p = put(p, SL(": "));
+        p = put(p, h.value);
+        p = put(p, SL(CRLF));
+    }
+    if (response->content_length >= 0) {
+        p = put(p, SL("Content-Length: "));
+        p += u64_to_dec(p, (uint64_t)response->content_length);
+        p = put(p, SL(CRLF));
+    }
+    p = put(p, SL(CRLF));
+    return (str_t){.data = start, .len = (size_t)(p - start)};
+}
+
+str_t response_to_str(Arena *a, http_response_t *response) {
+    str_t head = response_head(a, response);
+    if (response->body.len == 0)
+        return head;
+    return str_concat(a, head, response->body);
+}
+
+void http_iovec_reset(http_iovec_t *out) {
+    out->count = 0;
+    out->index = 0;
+    out->remaining = 0;
+}
+
+bool http_iovec_push(http_iovec_t *out, str_t s) {
+    if (s.len == 0)
+        return true;
+    if (out->count == HTTP_MAX_IOV)
+        return false;
+    out->iov[out->count++] =
+        (struct iovec){.iov_base = s.data, .iov_len = s.len};
+    out->remaining += s.len;
+    return true;
+}
+
+void http_iovec_advance(http_iovec_t *out, size_t n) {
+    out->remaining -= n;
+    while (n > 0) {
+        struct iovec *v = &out->iov[out->index];
+        if (n < v->iov_len) {
+            v->iov_base = (byte *)v->iov_base + n;
+            v->iov_len -= n;
+            return;
+        }
+        n -= v->iov_len;
+        out->index++;
+    }
+}
+
+// The whole head is one segment; the body is referenced in place.
+void response_to_iovec(Arena *a, http_response_t *response,
+                       http_iovec_t *out) {
+    http_iovec_push(out, response_head(a, response));
+    if (response->body_fd == -1)
+        http_iovec_push(out, response->body);
 }
 
 void set_response_without_body(Arena *a_ptr, http_response_t *response,
                                HTTP_STATUS_CODE statuc_code) {
-    http_header_t content_length = {.key = S("Content-Length"),
-                                    .value = S("0")};
-    http_header_vec_push(a_ptr, &response->headers, content_length);
+    (void)a_ptr;
+    response->content_length = 0;
     response->status_code = statuc_code;
 }
 
+// Streams the body from an open file; the connection closes fd once the
+// body has been sent.
+void set_response_with_file(Arena *a_ptr, http_response_t *response_ptr,
+                            int fd, size_t len, str_t content_type,
+                            int statuc_code) {
+    http_header_t content_type_header =
+        (http_header_t){.key = SL("Content-Type"), .value = content_type};
+    http_header_vec_push(a_ptr, &response_ptr->headers, content_type_header);
+
+    response_ptr->content_length = (int64_t)len;
+    response_ptr->status_code = statuc_code;
+    response_ptr->body_fd = fd;
+    response_ptr->body_fd_len = len;
+}
+
 void set_response_with_body(Arena *a_ptr, http_response_t *response_ptr,
                             str_t data, str_t content_type, int statuc_code) {
-    http_header_t content_length_header = {
-        .key = S("Content-Length"), .value = int_to_str(a_ptr, (int)data.len)};
     http_header_t content_type_header =
-        (http_header_t){.key = S("Content-Type"), .value = content_type};
+        (http_header_t){.key = SL("Content-Type"), .value = content_type};
     http_header_vec_push(a_ptr, &response_ptr->headers, content_type_header);
-    http_header_vec_push(a_ptr, &response_ptr->headers, content_length_header);
 
+    response_ptr->content_length = (int64_t)data.len;
     response_ptr->status_code = statuc_code;
     response_ptr->body = data;
 }
 
-bool handle_http_request(Arena *a_ptr, http_request_t *request_ptr,
-                         http_response_t *response_ptr) {
+// Pulls the body from `source` while the response is being sent; see
+// http_body_source_t.
+void set_response_with_stream(Arena *a_ptr, http_response_t *response_ptr,
+                              http_body_source_t source, str_t content_type,
+                              int statuc_code) {
+    http_header_t content_type_header =
+        (http_header_t){.key = SL("Content-Type"), .value = content_type};
+    http_header_vec_push(a_ptr, &response_ptr->headers, content_type_header);
 
-    // check if need to close connection
-    bool should_close = false;
-    int index = find_header(request_ptr->headers, S("Connection"));
-    if (index != -1) {
-        if (str_cmp(http_header_vec_get(request_ptr->headers, index).value,
-                    S("close"))) {
-            should_close = true;
-            http_header_t close_connection = {.key = S("Connection"),
-                                              .value = S("close")};
-            http_header_vec_push(a_ptr, &response_ptr->headers,
-                                 close_connection);
-        }
-    }
+    response_ptr->status_code = statuc_code;
+    response_ptr->body_source = source;
+}
+
+// Destination path when the request matches an upload route
+// (POST /files/:name), whose body we stream to disk.
+static bool http_upload_path(Arena *a_ptr, http_request_t *request_ptr,
+                             str_t *path) {
+    http_route_match_t match;
+    str_t name;
+    if (router_match(&router, request_ptr, &match) != HTTP_ROUTE_FOUND ||
+        !(match.route->flags & HTTP_ROUTE_UPLOAD) ||
+        !http_request_param(request_ptr, "name", &name))
+        return false;
+    *path = str_concat(a_ptr, SL(FILES_DIR), name);
+    return true;
+}
+
+// Content coding for the response; identity without Accept-Encoding.
+static codec_id_t http_negotiate_encoding(http_request_t *request_ptr) {
+    str_t accept_encoding;
+    if (!http_request_header(request_ptr, HTTP_HEADER_ACCEPT_ENCODING,
+                             &accept_encoding))
+        return CODEC_IDENTITY;
+    return negotiate_encoding(accept_encoding);
+}
 
-    str_t dir = S("/tmp/data/codecrafters.io/http-server-tester/");
-    str_vec_t urls = str_split_s(a_ptr, request_ptr->url, S("/"));
-    if (strvec_len(urls) == 0) {
-        set_response_without_body(a_ptr, response_ptr, HTTP_STATUS_OK);
-        return should_close;
+static void push_encoding_headers(Arena *a_ptr, http_response_t *response_ptr,
+                                  const codec_t *codec) {
+    if (codec != NULL)
+        http_header_vec_push(a_ptr, &response_ptr->headers,
+                             (http_header_t){.key = SL("Content-Encoding"),
+                                             .value = codec->name});
+    http_header_vec_push(
+        a_ptr, &response_ptr->headers,
+        (http_header_t){.key = SL("Vary"), .value = SL("Accept-Encoding")});
+}
+
+static void release_cached_file(void *ctx) { file_cache_release(ctx); }
+
+// Whether variants of file_path are kept at all; fills in its stamp.
+static bool file_takes_variants(Arena *a_ptr, str_t file_path,
+                                file_stamp_t *stamp) {
+    return file_cache_enabled() && file_stat(a_ptr, file_path, stamp) &&
+           stamp->size >= compress_min_size &&
+           stamp->size <= FILE_CACHE_MAX_ENTRY;
+}
+
+// Compresses the file whole at the best level and caches the result. Slow
+// for large files and zstd: only ever run off the request path.
+static file_cache_entry_t *build_variant(Arena *a_ptr, str_t file_path,
+                                         const codec_t *codec) {
+    uint64_t generation = file_cache_generation();
+    open_result_t result = open_file(a_ptr, file_path);
+    if (result.error || result.size > FILE_CACHE_MAX_ENTRY) {
+        if (result.fd != -1)
+            close(result.fd);
+        return NULL;
     }
+    size_t len;
+    byte *data = encode_file(codec, result.fd, result.size, &len);
+    close(result.fd);
+    if (data == NULL)
+        return NULL;
+    return file_cache_insert_variant(file_path, codec->id, result.stamp, data,
+                                     len, generation);
+}
 
-    str_t first_part = strvec_get(urls, 0);
-    if (str_cmp(request_ptr->method, S("POST"))) {
-        if (str_cmp(first_part, S("files"))) {
-            str_t file_name = strvec_get(urls, 1);
-            if (strvec_len(urls) != 2) {
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_INTERNAL_SERVER_ERROR);
-                return should_close;
-            }
+// Variants missed on the request path are built by one background thread,
+// in order. A job stays queued until built, so concurrent misses on a file
+// queue it once; a miss that finds the queue full is dropped and a later
+// one queues it again. Jobs carry the stamp of the cached file the variant
+// is for, so the builder can tell when that copy has gone out of date.
+#define VARIANT_QUEUE_CAP 64
 
-            str_t file_content = request_ptr->body;
-            str_t file_path = str_concat(a_ptr, dir, file_name);
+typedef struct {
+    byte *path; // malloc'd
+    size_t path_len;
+    codec_id_t codec;
+    file_stamp_t stamp;
+} variant_job_t;
 
-            if (!file_write(a_ptr, file_content, file_path)) {
-                LOG_ERROR("failed to write");
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_INTERNAL_SERVER_ERROR);
-                return should_close;
-            }
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_once_t once;
+    bool started;
+    variant_job_t jobs[VARIANT_QUEUE_CAP];
+    size_t head;
+    size_t len;
+} variant_queue = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                   .not_empty = PTHREAD_COND_INITIALIZER,
+                   .once = PTHREAD_ONCE_INIT};
 
-            set_response_without_body(a_ptr, response_ptr,
-                                      HTTP_STATUS_CREATED_SUCCESSFULLY);
-            return should_close;
+static bool stamp_equal(file_stamp_t a, file_stamp_t b) {
+    return a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+static void *variant_builder(void *arg) {
+    (void)arg;
+    Arena a = arena_new(1 << 12);
+    while (true) {
+        pthread_mutex_lock(&variant_queue.lock);
+        while (variant_queue.len == 0)
+            pthread_cond_wait(&variant_queue.not_empty, &variant_queue.lock);
+        // Only the head's slot is ours; others may be filled meanwhile.
+        variant_job_t job = variant_queue.jobs[variant_queue.head];
+        pthread_mutex_unlock(&variant_queue.lock);
+
+        Arena_Mark mark = arena_save(&a);
+        str_t path = {.data = job.path, .len = job.path_len};
+        const codec_t *codec = codec_get(job.codec);
+        file_stamp_t stamp;
+        bool exists = codec != NULL && file_stat(&a, path, &stamp);
+        if (exists && !stamp_equal(stamp, job.stamp)) {
+            // The file changed behind the cache's back. Dropping the stale
+            // copy makes the next request load the file as it is now.
+            file_cache_invalidate(path);
+        } else if (exists) {
+            // A miss racing the previous build of this file may have queued
+            // it again.
+            file_cache_entry_t *variant =
+                file_cache_lookup_variant(path, codec->id, stamp);
+            if (variant == NULL)
+                variant = build_variant(&a, path, codec);
+            if (variant != NULL)
+                file_cache_release(variant);
         }
+        arena_restore(&a, mark);
+
+        pthread_mutex_lock(&variant_queue.lock);
+        variant_queue.head = (variant_queue.head + 1) % VARIANT_QUEUE_CAP;
+        variant_queue.len--;
+        pthread_mutex_unlock(&variant_queue.lock);
+        free(job.path);
     }
+    return NULL;
+}
 
-    if (str_cmp(request_ptr->method, S("GET"))) {
-        if (str_cmp(first_part, S("files"))) {
-            str_t file_name = strvec_get(urls, 1);
-            if (strvec_len(urls) != 2) {
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_NOT_FOUND);
-                return should_close;
-            }
+static void variant_builder_start(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, variant_builder, NULL) != 0) {
+        LOG_ERROR("variant builder: pthread_create failed, variants are "
+                  "only made by --precompress");
+        return;
+    }
+    pthread_detach(thread);
+    variant_queue.started = true;
+}
 
-            str_t file_path = str_concat(a_ptr, dir, file_name);
-            read_result_t result = read_file(a_ptr, file_path);
-            if (result.doesnt_exist) {
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_NOT_FOUND);
-                return should_close;
-            }
+static void variant_build_later(str_t file_path, codec_id_t codec,
+                                file_stamp_t stamp) {
+    pthread_once(&variant_queue.once, variant_builder_start);
+    if (!variant_queue.started)
+        return;
+
+    pthread_mutex_lock(&variant_queue.lock);
+    bool queued = variant_queue.len == VARIANT_QUEUE_CAP;
+    for (size_t i = 0; i < variant_queue.len && !queued; i++) {
+        variant_job_t *job =
+            &variant_queue.jobs[(variant_queue.head + i) % VARIANT_QUEUE_CAP];
+        queued = job->codec == codec &&
+                 str_cmp((str_t){.data = job->path, .len = job->path_len},
+                         file_path);
+    }
+    byte *path = queued ? NULL : malloc(file_path.len);
+    if (path != NULL) {
+        memcpy(path, file_path.data, file_path.len);
+        size_t tail =
+            (variant_queue.head + variant_queue.len) % VARIANT_QUEUE_CAP;
+        variant_queue.jobs[tail] = (variant_job_t){.path = path,
+                                                   .path_len = file_path.len,
+                                                   .codec = codec,
+                                                   .stamp = stamp};
+        variant_queue.len++;
+        pthread_cond_signal(&variant_queue.not_empty);
+    }
+    pthread_mutex_unlock(&variant_queue.lock);
+}
+
+// The variant, encoded with codec, of the cached file and made from the
+// same version of it. NULL for files below compress_min_size, and on a
+// miss, which queues the variant to be built.
+static file_cache_entry_t *file_variant(str_t file_path, const codec_t *codec,
+                                        file_cache_entry_t *file) {
+    file_stamp_t stamp = file_cache_entry_stamp(file);
+    if (stamp.size < compress_min_size)
+        return NULL;
+    file_cache_entry_t *variant =
+        file_cache_lookup_variant(file_path, codec->id, stamp);
+    if (variant == NULL)
+        variant_build_later(file_path, codec->id, stamp);
+    return variant;
+}
 
-            if (result.error) {
-                LOG_ERROR("failed read file");
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_INTERNAL_SERVER_ERROR);
-                return should_close;
+static void *precompress_files(void *arg) {
+    (void)arg;
+    DIR *dir = opendir(FILES_DIR);
+    if (dir == NULL) {
+        LOG_ERROR("precompress: cannot open " FILES_DIR);
+        return NULL;
+    }
+    Arena a = arena_new(1 << 12);
+    size_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        str_t name = {.data = entry->d_name, .len = strlen(entry->d_name)};
+        // Skip dot files and uploads still being written.
+        if (name.len == 0 || name.data[0] == '.' || file_upload_is_temp(name))
+            continue;
+        Arena_Mark mark = arena_save(&a);
+        str_t path = str_concat(&a, SL(FILES_DIR), name);
+        // deflate is rarely asked for; its variants are made on demand.
+        codec_id_t codecs[] = {CODEC_GZIP, CODEC_ZSTD};
+        for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+            const codec_t *codec = codec_get(codecs[i]);
+            file_stamp_t stamp;
+            if (codec == NULL || !file_takes_variants(&a, path, &stamp))
+                continue;
+            file_cache_entry_t *variant =
+                file_cache_lookup_variant(path, codec->id, stamp);
+            if (variant == NULL)
+                variant = build_variant(&a, path, codec);
+            if (variant != NULL) {
+                file_cache_release(variant);
+                count++;
             }
-            set_response_with_body(a_ptr, response_ptr, result.content,
-                                   S("application/octet-stream"),
-                                   HTTP_STATUS_OK);
-            return should_close;
         }
+        arena_restore(&a, mark);
+    }
+    closedir(dir);
+    arena_destroy(&a);
+    LOG_INFO("precompress: %zu variants cached", count);
+    return NULL;
+}
 
-        if (str_cmp(first_part, S("echo"))) {
-            // encoding
-
-            bool gzip = false;
-            int index = find_header(request_ptr->headers, S("Accept-Encoding"));
-            if (index != -1) {
-                http_header_t encoding_header =
-                    http_header_vec_get(request_ptr->headers, (size_t)index);
-
-                str_print(encoding_header.value);
-                str_vec_t available_encodings_list =
-                    str_split_s(a_ptr, encoding_header.value, S(","));
-                str_vec_t valid_encodings = strvec_new(a_ptr, 1);
-                for (size_t i = 0; i < strvec_len(available_encodings_list);
-                     i++) {
-
-                    str_t encoding = strvec_get(available_encodings_list, i);
-                    encoding = str_trim(encoding);
-                    if (str_cmp(encoding, S("gzip"))) {
-                        strvec_push(a_ptr, &valid_encodings, encoding);
-                        gzip = true;
-                    }
-                }
+void http_precompress_files(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, precompress_files, NULL) != 0) {
+        LOG_ERROR("precompress: pthread_create failed");
+        return;
+    }
+    pthread_detach(thread);
+}
 
-                if (strvec_len(valid_encodings) > 0) {
-                    str_t valid_encodings_str =
-                        str_join(a_ptr, valid_encodings, S(", "));
-                    if (strvec_len(valid_encodings) > 0) {
-                        http_header_t content_type_header =
-                            (http_header_t){.key = S("Content-Encoding"),
-                                            .value = valid_encodings_str};
-
-                        http_header_vec_push(a_ptr, &response_ptr->headers,
-                                             content_type_header);
-                    }
-                }
-            }
+// Hot files come straight from the file cache; misses small enough to cache
+// are loaded into it, anything larger is streamed with sendfile(). Clients
+// taking a content coding get the cached variant in it instead, once built;
+// until then the response stage compresses the file as it is sent.
+static void serve_file(Arena *a_ptr, http_request_t *request_ptr,
+                       http_response_t *response_ptr, str_t file_path) {
+    file_cache_entry_t *cached = file_cache_lookup(file_path);
+    if (cached == NULL) {
+        uint64_t generation = file_cache_generation();
+        open_result_t result = open_file(a_ptr, file_path);
+        if (result.doesnt_exist) {
+            set_response_without_body(a_ptr, response_ptr,
+                                      HTTP_STATUS_NOT_FOUND);
+            return;
+        }
 
-            str_t text = strvec_get(urls, 1);
-            if (strvec_len(urls) != 2) {
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_NOT_FOUND);
-                return should_close;
-            }
+        if (result.error) {
+            LOG_ERROR("failed open file");
+            set_response_without_body(a_ptr, response_ptr,
+                                      HTTP_STATUS_INTERNAL_SERVER_ERROR);
+            return;
+        }
 
-            str_t result = str_trim(text);
-            if (gzip)
-                result = mycompress(a_ptr, str_trim(text));
-            set_response_with_body(a_ptr, response_ptr, result, S("text/plain"),
+        cached = file_cache_load(file_path, result.fd, result.size,
+                                 result.stamp, generation);
+        if (cached == NULL) {
+            set_response_with_file(a_ptr, response_ptr, result.fd,
+                                   result.size, SL("application/octet-stream"),
                                    HTTP_STATUS_OK);
-            return should_close;
+            return;
         }
+        close(result.fd);
+    }
 
-        if (str_cmp(first_part, S("user-agent"))) {
-            int index = find_header(request_ptr->headers, S("User-Agent"));
-            if (index == -1) {
-                set_response_without_body(a_ptr, response_ptr,
-                                          HTTP_STATUS_BAD_REQUEST);
-                return should_close;
-            }
+    const codec_t *codec = codec_get(http_negotiate_encoding(request_ptr));
+    file_cache_entry_t *variant =
+        codec != NULL ? file_variant(file_path, codec, cached) : NULL;
+    if (variant != NULL) {
+        file_cache_release(cached);
+        set_response_with_body(a_ptr, response_ptr,
+                               file_cache_entry_data(variant),
+                               SL("application/octet-stream"), HTTP_STATUS_OK);
+        response_ptr->body_release = release_cached_file;
+        response_ptr->body_release_ctx = variant;
+        push_encoding_headers(a_ptr, response_ptr, codec);
+        return;
+    }
 
-            http_header_t h = http_header_vec_get(request_ptr->headers, index);
-            str_t user_agent = str_trim(h.value);
+    set_response_with_body(a_ptr, response_ptr, file_cache_entry_data(cached),
+                           SL("application/octet-stream"), HTTP_STATUS_OK);
+    response_ptr->body_release = release_cached_file;
+    response_ptr->body_release_ctx = cached;
+}
 
-            http_header_vec_push(a_ptr, &response_ptr->headers,
-                                 (http_header_t){.key = S("Content-Type"),
-                                                 .value = S("text/plain")});
-            http_header_vec_push(
-                a_ptr, &response_ptr->headers,
-                (http_header_t){.key = S("Content-Length"),
-                                .value =
-                                    int_to_str(a_ptr, (int)user_agent.len)});
-
-            set_response_with_body(a_ptr, response_ptr, str_trim(user_agent),
-                                   S("text/plain"), HTTP_STATUS_OK);
-            return should_close;
+static bool handle_root(Arena *a_ptr, http_request_t *request_ptr,
+                        http_response_t *response_ptr) {
+    (void)request_ptr;
+    set_response_without_body(a_ptr, response_ptr, HTTP_STATUS_OK);
+    return false;
+}
+
+static bool handle_echo(Arena *a_ptr, http_request_t *request_ptr,
+                        http_response_t *response_ptr) {
+    str_t text;
+    http_request_param(request_ptr, "text", &text);
+    set_response_with_body(a_ptr, response_ptr, str_trim(text),
+                           SL("text/plain"), HTTP_STATUS_OK);
+    return false;
+}
+
+static bool handle_user_agent(Arena *a_ptr, http_request_t *request_ptr,
+                              http_response_t *response_ptr) {
+    str_t user_agent;
+    if (!http_request_header(request_ptr, HTTP_HEADER_USER_AGENT,
+                             &user_agent)) {
+        set_response_without_body(a_ptr, response_ptr,
+                                  HTTP_STATUS_BAD_REQUEST);
+        return false;
+    }
+
+    set_response_with_body(a_ptr, response_ptr, str_trim(user_agent),
+                           SL("text/plain"), HTTP_STATUS_OK);
+    return false;
+}
+
+#ifdef ARENA_STATS
+static bool handle_arena_stats(Arena *a_ptr, http_request_t *request_ptr,
+                               http_response_t *response_ptr) {
+    (void)request_ptr;
+    // Sized first; threads starting in between only truncate the report.
+    size_t len = arena_stats_report(NULL, 0);
+    byte *buf = arena_alloc_align(a_ptr, len + 1, 1);
+    if (buf == NULL) {
+        set_response_without_body(a_ptr, response_ptr,
+                                  HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        return false;
+    }
+    size_t written = arena_stats_report((char *)buf, len + 1);
+    str_t report = {.data = buf, .len = written < len ? written : len};
+    set_response_with_body(a_ptr, response_ptr, report, SL("text/plain"),
+                           HTTP_STATUS_OK);
+    return false;
+}
+#endif
+
+static bool handle_get_file(Arena *a_ptr, http_request_t *request_ptr,
+                            http_response_t *response_ptr) {
+    str_t file_name;
+    http_request_param(request_ptr, "name", &file_name);
+    Arena *scratch = arena_scratch(a_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    serve_file(a_ptr, request_ptr, response_ptr,
+               str_concat(scratch, SL(FILES_DIR), file_name));
+    arena_restore(scratch, mark);
+    return false;
+}
+
+static bool handle_post_file(Arena *a_ptr, http_request_t *request_ptr,
+                             http_response_t *response_ptr) {
+    if (request_ptr->upload != NULL) {
+        if (!file_upload_commit(request_ptr->upload)) {
+            LOG_ERROR("failed to write");
+            set_response_without_body(a_ptr, response_ptr,
+                                      HTTP_STATUS_INTERNAL_SERVER_ERROR);
+            return false;
         }
+        set_response_without_body(a_ptr, response_ptr,
+                                  HTTP_STATUS_CREATED_SUCCESSFULLY);
+        return false;
     }
 
-    set_response_without_body(a_ptr, response_ptr, HTTP_STATUS_NOT_FOUND);
-    return should_close;
+    str_t file_name;
+    http_request_param(request_ptr, "name", &file_name);
+    Arena *scratch = arena_scratch(a_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    str_t file_path = str_concat(scratch, SL(FILES_DIR), file_name);
+    bool written = file_write(a_ptr, request_ptr->body, file_path);
+    arena_restore(scratch, mark);
+    if (!written) {
+        LOG_ERROR("failed to write");
+        set_response_without_body(a_ptr, response_ptr,
+                                  HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        return false;
+    }
+
+    set_response_without_body(a_ptr, response_ptr,
+                              HTTP_STATUS_CREATED_SUCCESSFULLY);
+    return false;
 }
 
-bool parse_HTTP_headers(Arena *a_ptr, str_t requestheader_str,
-                        http_request_t *http_request_ptr) {
-    str_vec_t rows = str_split_s(a_ptr, requestheader_str, S(CRLF));
+bool http_routes_init(void) {
+    router_init(&router);
+    bool ok =
+        router_add(&router, HTTP_METHOD_GET, "/", handle_root, 0) &&
+        router_add(&router, HTTP_METHOD_GET, "/echo/:text", handle_echo, 0) &&
+        router_add(&router, HTTP_METHOD_GET, "/user-agent", handle_user_agent,
+                   0) &&
+        router_add(&router, HTTP_METHOD_GET, "/files/:name", handle_get_file,
+                   0) &&
+        router_add(&router, HTTP_METHOD_POST, "/files/:name",
+                   handle_post_file, HTTP_ROUTE_UPLOAD);
+#ifdef ARENA_STATS
+    ok = ok && router_add(&router, HTTP_METHOD_GET, "/debug/arena-stats",
+                          handle_arena_stats, 0);
+#endif
+    return ok;
+}
 
-    str_vec_t first_row = str_split_s(a_ptr, strvec_get(rows, 0), S(" "));
+// 405 answer listing the methods the path does support.
+static void set_response_method_not_allowed(Arena *a_ptr,
+                                            http_response_t *response_ptr,
+                                            unsigned allowed) {
+    Arena *scratch = arena_scratch(a_ptr);
+    Arena_Mark mark = arena_save(scratch);
+    str_vec_t methods = strvec_new(scratch, HTTP_METHOD_COUNT);
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++)
+        if (allowed & (1u << m))
+            strvec_push(scratch, &methods, http_method_name(m));
+    http_header_vec_push(a_ptr, &response_ptr->headers,
+                         (http_header_t){.key = SL("Allow"),
+                                         .value = str_join(a_ptr, methods,
+                                                           SL(", "))});
+    arena_restore(scratch, mark);
+    set_response_without_body(a_ptr, response_ptr,
+                              HTTP_STATUS_METHOD_NOT_ALLOWED);
+}
 
-    http_request_ptr->method = strvec_get(first_row, 0);
-    http_request_ptr->url = strvec_get(first_row, 1);
-    http_request_ptr->version = strvec_get(first_row, 2);
+// Whether the handler already picked a Content-Encoding, e.g. a cached
+// variant.
+static bool response_encoded(http_response_t *response_ptr) {
+    for (size_t i = 0; i < http_header_vec_len(response_ptr->headers); i++) {
+        if (str_casecmp(http_header_vec_get(response_ptr->headers, i).key,
+                        SL("Content-Encoding")))
+            return true;
+    }
+    return false;
+}
 
-    for (size_t i = 1; i < strvec_len(rows); i++) {
-        str_vec_t header_parts =
-            str_split_s(a_ptr, strvec_get(rows, i), S(":"));
+// Content encoding, as negotiated, for any response with a body of at
+// least compress_min_size. A body that fits in one stream chunk is
+// compressed whole and keeps its Content-Length; larger ones, files and
+// sources are compressed as they are sent, in constant memory.
+static void http_encode_response(Arena *a_ptr, http_request_t *request_ptr,
+                                 http_response_t *response_ptr) {
+    bool has_body = response_ptr->body_source.read != NULL ||
+                    response_ptr->body_fd != -1 ||
+                    response_ptr->body.len > 0;
+    // Sources have no length up front and always qualify.
+    size_t known_len = response_ptr->body_fd != -1
+                           ? response_ptr->body_fd_len
+                           : response_ptr->body.len;
+    if (response_ptr->body_source.read == NULL &&
+        known_len < compress_min_size)
+        return;
+    if (!has_body || response_encoded(response_ptr))
+        return;
 
-        http_header_t h = {.key = str_trim(strvec_get(header_parts, 0)),
-                           .value = str_trim(strvec_get(header_parts, 1))};
+    const codec_t *codec = codec_get(http_negotiate_encoding(request_ptr));
+    if (codec == NULL) {
+        // Still tell caches the answer depends on Accept-Encoding.
+        push_encoding_headers(a_ptr, response_ptr, NULL);
+        return;
+    }
+    if (response_ptr->body_source.read == NULL &&
+        response_ptr->body_fd == -1 &&
+        response_ptr->body.len <= HTTP_STREAM_CHUNK) {
+        str_t compressed = codec_compress(a_ptr, codec, response_ptr->body);
+        if (compressed.data == NULL)
+            return;
+        response_ptr->body = compressed;
+        response_ptr->content_length = (int64_t)compressed.len;
+    } else if (!encode_stream_response(a_ptr, response_ptr, codec)) {
+        return;
+    }
+    push_encoding_headers(a_ptr, response_ptr, codec);
+}
+
+bool handle_http_request(Arena *a_ptr, http_request_t *request_ptr,
+                         http_response_t *response_ptr) {
 
-        http_header_vec_push(a_ptr, &(http_request_ptr->headers), h);
+    // check if need to close connection
+    bool should_close = false;
+    str_t connection;
+    if (http_request_header(request_ptr, HTTP_HEADER_CONNECTION, &connection)) {
+        if (str_casecmp(connection, SL("close"))) {
+            should_close = true;
+            http_header_t close_connection = {.key = SL("Connection"),
+                                              .value = SL("close")};
+            http_header_vec_push(a_ptr, &response_ptr->headers,
+                                 close_connection);
+        }
     }
 
-    return true;
+    http_route_match_t match;
+    switch (router_match(&router, request_ptr, &match)) {
+    case HTTP_ROUTE_FOUND:
+        if (match.route->handler(a_ptr, request_ptr, response_ptr))
+            should_close = true;
+        break;
+    case HTTP_ROUTE_METHOD_NOT_ALLOWED:
+        set_response_method_not_allowed(a_ptr, response_ptr, match.allowed);
+        break;
+    case HTTP_ROUTE_NOT_FOUND:
+        set_response_without_body(a_ptr, response_ptr, HTTP_STATUS_NOT_FOUND);
+        break;
+    }
+    http_encode_response(a_ptr, request_ptr, response_ptr);
+    return should_close;
 }
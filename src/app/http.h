@@ -1,9 +1,13 @@
 #pragma once
 
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "types.h"
 #include "str.h"
 #include "vector.h"
+#include "files.h"
+#include "recv_buf.h"
 
 #define CRLF "\r\n"
 #define CRLF_CRLF "\r\n\r\n"
@@ -13,13 +17,36 @@
 #define MAX_VERSION_LEN 16
 #define MAX_HEADER_NAME 64
 #define MAX_HEADER_VALUE 256
+// Path parameters a matched route can capture.
+#define HTTP_MAX_PARAMS 8
+#define HTTP_MAX_IOV 128
+// Pipelined requests answered in one batch, and the iovec room a batch
+// keeps free for the next response before it stops taking more.
+#define HTTP_MAX_PIPELINE 16
+#define HTTP_PIPELINE_IOV_RESERVE 2
+// Bodies that are not streamed to disk are held in the receive buffer.
+#define HTTP_MAX_BUFFERED_BODY (1 << 20) // 1MB
+// Receive buffer size a connection starts with and shrinks back to, and the
+// most header bytes it buffers while looking for the end of the headers.
+#define HTTP_RECV_BUF_SIZE (1 << 13)     // 8KB
+#define HTTP_MAX_HEADER_SIZE (1 << 16)   // 64KB
+// Per-connection arena, recycled through the arena pool.
+#define HTTP_CONN_ARENA_SIZE (1 << 21)   // 2MB
+// Largest chunk a streamed response body is cut into.
+#define HTTP_STREAM_CHUNK (1 << 14)      // 16KB
 
 typedef enum {
     HTTP_STATUS_OK = 200,
     HTTP_STATUS_CREATED_SUCCESSFULLY = 201,
     HTTP_STATUS_BAD_REQUEST = 400,
     HTTP_STATUS_NOT_FOUND = 404,
+    HTTP_STATUS_METHOD_NOT_ALLOWED = 405,
+    HTTP_STATUS_REQUEST_TIMEOUT = 408,
+    HTTP_STATUS_PAYLOAD_TOO_LARGE = 413,
+    HTTP_STATUS_HEADER_FIELDS_TOO_LARGE = 431,
     HTTP_STATUS_INTERNAL_SERVER_ERROR = 500,
+    HTTP_STATUS_NOT_IMPLEMENTED = 501,
+    HTTP_STATUS_SERVICE_UNAVAILABLE = 503,
 } HTTP_STATUS_CODE;
 
 typedef struct {
@@ -51,28 +78,273 @@ bool static inline http_header_vec_push(Arena* a_ptr, http_header_vec_t* v_ptr,
     return vector_push(a_ptr, &(v_ptr->inner), (void*)(&s));
 }
 
+// Request headers the server acts on. The parser recognises them by name
+// (case-insensitively) and records where they are in http_request_t.
+typedef enum {
+    HTTP_HEADER_UNKNOWN,
+    HTTP_HEADER_ACCEPT,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_ACCEPT_LANGUAGE,
+    HTTP_HEADER_AUTHORIZATION,
+    HTTP_HEADER_CACHE_CONTROL,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_COUNT,
+} http_header_id_t;
+
+typedef struct {
+    str_t name;
+    str_t value;
+} http_param_t;
+
+// All slices point into the connection's receive buffer.
 typedef struct {
     str_t method;
     str_t url;
     str_t version;
     str_t body;
-    http_header_vec_t headers;
+    http_header_t headers[MAX_HEADERS];
+    size_t header_count;
+    // 1 + index in `headers` of the first header of each known kind, 0 when
+    // the request does not have it.
+    unsigned char known[HTTP_HEADER_COUNT];
+    // Path parameters captured by the route the request matched.
+    http_param_t params[HTTP_MAX_PARAMS];
+    size_t param_count;
+    // Set when the body was streamed to disk instead of into `body`.
+    file_upload_t* upload;
 } http_request_t;
 
+typedef enum {
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_AGAIN,          // need more input
+    HTTP_PARSE_ERROR,          // malformed, answer 400
+    HTTP_PARSE_TOO_MANY_HEADERS,
+} http_parse_status_t;
+
+// Resumable request-line and header parser. It makes a single pass over
+// the input, filling the request with slices of it and allocating nothing;
+// on HTTP_PARSE_AGAIN call it again with the same buffer, grown. Offsets
+// are relative to the buffer start, so the buffer may move in between as
+// long as the slices already handed out are rebased.
+typedef struct {
+    int state;
+    size_t pos;  // next byte to look at; past the blank line once done
+    size_t mark; // start of the token being read
+} http_parser_t;
+
+http_header_id_t http_header_classify(str_t name);
+
+// Value of a known header; false when the request does not carry it.
+bool static inline http_request_header(const http_request_t* r,
+                                       http_header_id_t id, str_t* value)
+{
+    if (r->known[id] == 0)
+        return false;
+    *value = r->headers[r->known[id] - 1].value;
+    return true;
+}
+
+// Value of a path parameter; false when the matched route has none by that
+// name.
+bool static inline http_request_param(const http_request_t* r,
+                                      const char* name, str_t* value)
+{
+    for (size_t i = 0; i < r->param_count; i++) {
+        if (str_cmp(r->params[i].name, S((byte*)name))) {
+            *value = r->params[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void http_parser_init(http_parser_t* p);
+http_parse_status_t http_parser_execute(http_parser_t* p, str_t buf,
+                                        http_request_t* request);
+
+// Streaming decoder for Transfer-Encoding: chunked bodies. Each call eats
+// framing from `in` until it reaches chunk data, which it returns in `data`
+// (a slice of `in`), or runs out of input. *consumed counts everything
+// used, data included. Returns HTTP_PARSE_DONE once the last chunk and
+// trailers are through, with *consumed ending right after them.
+typedef struct {
+    int state;
+    size_t remaining; // data bytes left in the current chunk
+    int digits;
+    size_t framing; // extension bytes of this size line, or trailer bytes
+} http_chunked_t;
+
+void http_chunked_init(http_chunked_t* c);
+http_parse_status_t http_chunked_decode(http_chunked_t* c, str_t in,
+                                        size_t* consumed, str_t* data);
+
+// Pull-based response body for when the length is not known up front. read
+// fills buf with up to cap bytes and returns how many, 0 at the end or -1 on
+// failure. close, if set, runs once the connection is done with the source.
+typedef struct {
+    ssize_t (*read)(void* ctx, byte* buf, size_t cap);
+    void (*close)(void* ctx);
+    void* ctx;
+} http_body_source_t;
+
 typedef struct {
     HTTP_STATUS_CODE status_code;
     http_header_vec_t headers;
+    // Written as the Content-Length header; -1 for none (streamed bodies).
+    int64_t content_length;
     str_t body;
+    // When body_fd is not -1 the body is streamed from that file with
+    // sendfile() after the headers, and `body` is ignored.
+    int body_fd;
+    size_t body_fd_len;
+    // Called once the body has been sent (or the connection dropped), for
+    // bodies that borrow memory owned by someone else, e.g. the file cache.
+    void (*body_release)(void* ctx);
+    void* body_release_ctx;
+    // When body_source.read is set the body is pulled from it as the
+    // connection drains and sent chunked (read to close for HTTP/1.0).
+    http_body_source_t body_source;
 } http_response_t;
 
+// Scatter-gather list for one or more serialized responses. Segments point
+// at memory that already exists (header strings, bodies) instead of being
+// copied into one buffer; `index` and `remaining` track partial writes.
+typedef struct {
+    struct iovec iov[HTTP_MAX_IOV];
+    int count;
+    int index;
+    size_t remaining;
+} http_iovec_t;
+
+typedef struct {
+    void (*fn)(void* ctx);
+    void* ctx;
+} http_body_release_t;
+
+typedef enum {
+    HTTP_CONN_READING,
+    HTTP_CONN_HANDLING,
+    HTTP_CONN_WRITING,
+    HTTP_CONN_CLOSED,
+} http_conn_state_t;
+
+// What the connection is waiting for when http_conn_drive returns.
+typedef enum {
+    HTTP_CONN_WANT_READ,
+    HTTP_CONN_WANT_WRITE,
+    HTTP_CONN_DONE,
+} http_conn_status_t;
+
+// Resumable per-connection state. http_conn_drive runs the
+// read -> parse -> handle -> write cycle until the socket would block
+// (non-blocking fds) or the connection is finished. Every complete request
+// in the read buffer is answered before writing, so pipelined responses go
+// out together in one writev.
+typedef struct {
+    int fd;
+    http_conn_state_t state;
+    Arena arena;
+
+    // The request being parsed starts at the head of recv; the positions
+    // below are relative to it.
+    recv_buf_t recv;
+    http_parser_t parser;
+    bool header_parsed;
+    size_t header_end_pos;
+    size_t request_end_pos;
+    http_request_t request;
+    // Non-zero when the request is answered without reading its body.
+    HTTP_STATUS_CODE early_status;
+
+    // Body framing of the current request. Buffered bodies end up at
+    // header_end_pos, body_len bytes long; chunked ones are decoded in place
+    // from chunk_pos on. Uploads are streamed to `upload` instead.
+    size_t body_len;
+    http_chunked_t chunks;
+    bool decoding_chunks;
+    size_t chunk_pos;
+
+    file_upload_t upload;
+    bool uploading;
+    size_t upload_remaining;
+    bool upload_chunked;
+
+    http_iovec_t out;
+    bool should_close;
+
+    // File body still to be sent after `out`, -1 when there is none.
+    int file_fd;
+    off_t file_offset;
+    size_t file_remaining;
+
+    // Body of the last response in `out` still to be pulled and framed.
+    http_body_source_t stream;
+    bool stream_chunked;
+    byte* stream_buf;
+
+    // Borrowed bodies of the responses in `out`.
+    http_body_release_t releases[HTTP_MAX_PIPELINE];
+    int release_count;
+} http_conn_t;
+
 str_t http_status_message(HTTP_STATUS_CODE code);
 
-bool parse_HTTP_headers(Arena* a, str_t request_str, http_request_t* request);
+int find_header(const http_request_t* request, str_t key);
+// Registers the server's routes; call once before serving. False if a
+// route could not be added, which leaves the server missing an endpoint.
+bool http_routes_init(void);
+// Fills the file cache with compressed variants of the files directory in
+// the background, so first requests do not pay for compressing.
+void http_precompress_files(void);
 bool handle_http_request(Arena* a, http_request_t* request, http_response_t* response);
 str_t response_to_str(Arena* a, http_response_t* response);
+void response_to_iovec(Arena* a, http_response_t* response, http_iovec_t* out);
+
+void http_iovec_reset(http_iovec_t* out);
+bool http_iovec_push(http_iovec_t* out, str_t s);
+// Drops the first n bytes, e.g. after a partial writev.
+void http_iovec_advance(http_iovec_t* out, size_t n);
+
+
+// Largest request body accepted; bigger ones get 413 Payload Too Large.
+void http_set_max_body_size(size_t max_body);
+// Bodies known to be smaller than this are not worth compressing.
+void http_set_compress_min_size(size_t min_size);
+
+// False when out of memory; the connection is unusable then, but must
+// still be destroyed, which closes fd.
+bool http_conn_init(http_conn_t* conn, int fd);
+http_conn_status_t http_conn_drive(http_conn_t* conn);
 
+// I/O-free building blocks of http_conn_drive, for loops that do their own
+// reads and writes (io_uring). Feed received bytes; once a request is ready,
+// http_conn_handle answers it and any pipelined requests behind it. Send
+// conn->out followed by file_remaining bytes of file_fd from file_offset,
+// then call http_conn_response_done; it returns false when the connection
+// should be closed. http_conn_feed fails only when out of memory.
+bool http_conn_feed(http_conn_t* conn, const char* data, size_t len);
+bool http_conn_request_ready(http_conn_t* conn);
+void http_conn_handle(http_conn_t* conn);
+// For a streamed body: refills conn->out with its next chunk once `out`
+// and any file body have been sent. Returns false when there is nothing
+// more to send.
+bool http_conn_stream_next(http_conn_t* conn);
+bool http_conn_response_done(http_conn_t* conn);
+void http_conn_destroy(http_conn_t* conn);
 
 void* handle_http_connection(void* arg);
+void http_reject_unavailable(int fd);
 
 
 
@@ -0,0 +1,466 @@
+// Single-pass HTTP/1.x request head parser
+#include "http.h"
+#include "str.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+enum {
+    S_REQUEST_START,
+    S_METHOD,
+    S_TARGET,
+    S_VERSION,
+    S_REQUEST_LINE_CR,
+    S_LINE_LF,
+    S_HEADER_START,
+    S_NAME,
+    S_VALUE_START,
+    S_VALUE,
+    S_END_LF,
+    S_DONE,
+};
+
+// RFC 9110 token characters, for methods and header names. Bytes from
+// 0x80 up are not tokens and are left zero.
+static const unsigned char tchar_table[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+};
+
+static inline bool is_tchar(unsigned char c)
+{
+    return tchar_table[c];
+}
+
+// Perfect hash over the known header names: (first + 4 * last + length) mod
+// 32, on lowercase letters. The multipliers were searched offline so that
+// every name below lands in its own slot; adding a name means checking
+// that it still does.
+#define HEADER_HASH_SIZE 32
+
+static inline unsigned header_hash(str_t name)
+{
+    unsigned first = (unsigned char)name.data[0] | 0x20;
+    unsigned last = (unsigned char)name.data[name.len - 1] | 0x20;
+    return (first + 4 * last + (unsigned)name.len) & (HEADER_HASH_SIZE - 1);
+}
+
+#define KNOWN(name, id) { name, sizeof(name) - 1, id }
+
+static const struct {
+    const char* name; // lowercase
+    size_t len;
+    http_header_id_t id;
+} known_headers[HEADER_HASH_SIZE] = {
+    [0] = KNOWN("cache-control", HTTP_HEADER_CACHE_CONTROL),
+    [1] = KNOWN("transfer-encoding", HTTP_HEADER_TRANSFER_ENCODING),
+    [3] = KNOWN("content-type", HTTP_HEADER_CONTENT_TYPE),
+    [4] = KNOWN("accept-language", HTTP_HEADER_ACCEPT_LANGUAGE),
+    [5] = KNOWN("connection", HTTP_HEADER_CONNECTION),
+    [6] = KNOWN("authorization", HTTP_HEADER_AUTHORIZATION),
+    [11] = KNOWN("range", HTTP_HEADER_RANGE),
+    [12] = KNOWN("accept-encoding", HTTP_HEADER_ACCEPT_ENCODING),
+    [14] = KNOWN("if-modified-since", HTTP_HEADER_IF_MODIFIED_SINCE),
+    [15] = KNOWN("user-agent", HTTP_HEADER_USER_AGENT),
+    [16] = KNOWN("upgrade", HTTP_HEADER_UPGRADE),
+    [17] = KNOWN("content-length", HTTP_HEADER_CONTENT_LENGTH),
+    [22] = KNOWN("if-none-match", HTTP_HEADER_IF_NONE_MATCH),
+    [23] = KNOWN("accept", HTTP_HEADER_ACCEPT),
+    [27] = KNOWN("expect", HTTP_HEADER_EXPECT),
+    [28] = KNOWN("host", HTTP_HEADER_HOST),
+    [29] = KNOWN("cookie", HTTP_HEADER_COOKIE),
+};
+
+// Names are tokens, and among token bytes only letters change under
+// | 0x20 into something in the table (lowercase letters and '-').
+http_header_id_t http_header_classify(str_t name)
+{
+    if (name.len == 0)
+        return HTTP_HEADER_UNKNOWN;
+    unsigned slot = header_hash(name);
+    if (known_headers[slot].len != name.len)
+        return HTTP_HEADER_UNKNOWN;
+    for (size_t i = 0; i < name.len; i++)
+        if (((unsigned char)name.data[i] | 0x20) !=
+            (unsigned char)known_headers[slot].name[i])
+            return HTTP_HEADER_UNKNOWN;
+    return known_headers[slot].id;
+}
+
+static inline str_t slice(str_t buf, size_t l, size_t r)
+{
+    return (str_t){ .data = buf.data + l, .len = r - l };
+}
+
+void http_parser_init(http_parser_t* p)
+{
+    p->state = S_REQUEST_START;
+    p->pos = 0;
+    p->mark = 0;
+}
+
+http_parse_status_t http_parser_execute(http_parser_t* p, str_t buf,
+                                        http_request_t* r)
+{
+    const unsigned char* d = (const unsigned char*)buf.data;
+    size_t pos = p->pos;
+    size_t n = buf.len;
+    http_parse_status_t status = HTTP_PARSE_AGAIN;
+
+    if (p->state == S_DONE)
+        return HTTP_PARSE_DONE;
+    while (pos < n && status == HTTP_PARSE_AGAIN) {
+        switch (p->state) {
+        case S_REQUEST_START:
+            // Stray CRLFs before a request line are ignored (RFC 9112 2.2).
+            if (d[pos] == '\r' || d[pos] == '\n') {
+                pos++;
+                break;
+            }
+            p->mark = pos;
+            p->state = S_METHOD;
+            break;
+
+        case S_METHOD:
+            while (pos < n && is_tchar(d[pos]))
+                pos++;
+            if (pos == n)
+                break;
+            if (d[pos] != ' ' || pos == p->mark) {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            r->method = slice(buf, p->mark, pos);
+            p->mark = ++pos;
+            p->state = S_TARGET;
+            break;
+
+        case S_TARGET:
+            while (pos < n && d[pos] > ' ' && d[pos] != 0x7f)
+                pos++;
+            if (pos == n)
+                break;
+            if (d[pos] != ' ' || pos == p->mark) {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            r->url = slice(buf, p->mark, pos);
+            p->mark = ++pos;
+            p->state = S_VERSION;
+            break;
+
+        case S_VERSION: {
+            // "HTTP/" DIGIT "." DIGIT
+            size_t len = sizeof("HTTP/1.1") - 1;
+            size_t have = n - p->mark < len ? n - p->mark : len;
+            if (memcmp(d + p->mark, "HTTP/", have < 5 ? have : 5) != 0) {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            if (have < len) {
+                pos = n;
+                break;
+            }
+            const unsigned char* v = d + p->mark;
+            if (v[5] < '0' || v[5] > '9' || v[6] != '.' || v[7] < '0' ||
+                v[7] > '9') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            r->version = slice(buf, p->mark, p->mark + len);
+            pos = p->mark + len;
+            p->state = S_REQUEST_LINE_CR;
+            break;
+        }
+
+        case S_REQUEST_LINE_CR:
+            if (d[pos++] != '\r') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            p->state = S_LINE_LF;
+            break;
+
+        case S_LINE_LF:
+            if (d[pos++] != '\n') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            p->state = S_HEADER_START;
+            break;
+
+        case S_HEADER_START:
+            if (d[pos] == '\r') {
+                pos++;
+                p->state = S_END_LF;
+                break;
+            }
+            // Also rejects obsolete line folding.
+            if (!is_tchar(d[pos])) {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            p->mark = pos;
+            p->state = S_NAME;
+            break;
+
+        case S_NAME:
+            while (pos < n && is_tchar(d[pos]))
+                pos++;
+            if (pos == n)
+                break;
+            if (d[pos] != ':') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            if (r->header_count == MAX_HEADERS) {
+                status = HTTP_PARSE_TOO_MANY_HEADERS;
+                break;
+            }
+            str_t key = slice(buf, p->mark, pos);
+            http_header_id_t id = http_header_classify(key);
+            if (id != HTTP_HEADER_UNKNOWN) {
+                // Two lengths, codings or hosts leave the request
+                // ambiguous; only the first of each would be looked at.
+                if (r->known[id] != 0 &&
+                    (id == HTTP_HEADER_CONTENT_LENGTH ||
+                     id == HTTP_HEADER_TRANSFER_ENCODING ||
+                     id == HTTP_HEADER_HOST)) {
+                    status = HTTP_PARSE_ERROR;
+                    break;
+                }
+                if (r->known[id] == 0)
+                    r->known[id] = (unsigned char)(r->header_count + 1);
+            }
+            r->headers[r->header_count].key = key;
+            pos++;
+            p->state = S_VALUE_START;
+            break;
+
+        case S_VALUE_START:
+            while (pos < n && (d[pos] == ' ' || d[pos] == '\t'))
+                pos++;
+            if (pos == n)
+                break;
+            p->mark = pos;
+            p->state = S_VALUE;
+            break;
+
+        case S_VALUE: {
+            // Values run to the CR; tabs are the only control byte allowed
+            // on the way there.
+            int at = str_find_ctl(slice(buf, pos, n));
+            if (at == -1) {
+                pos = n;
+                break;
+            }
+            pos += (size_t)at;
+            if (d[pos] == '\t') {
+                pos++;
+                break;
+            }
+            if (d[pos] != '\r') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            size_t end = pos;
+            while (end > p->mark && (d[end - 1] == ' ' || d[end - 1] == '\t'))
+                end--;
+            r->headers[r->header_count++].value = slice(buf, p->mark, end);
+            pos++;
+            p->state = S_LINE_LF;
+            break;
+        }
+
+        case S_END_LF:
+            if (d[pos++] != '\n') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            p->state = S_DONE;
+            status = HTTP_PARSE_DONE;
+            break;
+        }
+    }
+
+    p->pos = pos;
+    return status;
+}
+
+enum {
+    C_SIZE_START,
+    C_SIZE,
+    C_EXTENSION,
+    C_SIZE_LF,
+    C_DATA,
+    C_DATA_CR,
+    C_DATA_LF,
+    C_TRAILER_START,
+    C_TRAILER,
+    C_TRAILER_LF,
+    C_END_LF,
+    C_DONE,
+};
+
+// Chunk sizes above this many hex digits cannot be a real body.
+#define CHUNK_SIZE_MAX_DIGITS 15
+// Longest chunk-size line, extensions included, and largest trailer
+// section. Both are skipped rather than kept, but they sit in the receive
+// buffer until the request is done.
+#define CHUNK_LINE_MAX 4096
+#define CHUNK_TRAILERS_MAX HTTP_MAX_HEADER_SIZE
+
+void http_chunked_init(http_chunked_t* c)
+{
+    c->state = C_SIZE_START;
+    c->remaining = 0;
+    c->digits = 0;
+    c->framing = 0;
+}
+
+static inline int hex_value(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+http_parse_status_t http_chunked_decode(http_chunked_t* c, str_t in,
+                                        size_t* consumed, str_t* data)
+{
+    const unsigned char* d = (const unsigned char*)in.data;
+    size_t pos = 0;
+    size_t n = in.len;
+    http_parse_status_t status = HTTP_PARSE_AGAIN;
+    *data = (str_t){ .data = NULL, .len = 0 };
+
+    if (c->state == C_DONE) {
+        *consumed = 0;
+        return HTTP_PARSE_DONE;
+    }
+    while (pos < n && status == HTTP_PARSE_AGAIN && data->len == 0) {
+        switch (c->state) {
+        case C_SIZE_START:
+        case C_SIZE: {
+            int v = hex_value(d[pos]);
+            if (v >= 0) {
+                if (++c->digits > CHUNK_SIZE_MAX_DIGITS) {
+                    status = HTTP_PARSE_ERROR;
+                    break;
+                }
+                c->remaining = c->remaining * 16 + (size_t)v;
+                c->state = C_SIZE;
+                pos++;
+                break;
+            }
+            if (c->state == C_SIZE_START) {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            if (d[pos] == '\r') {
+                c->state = C_SIZE_LF;
+            } else if (d[pos] == ';' || d[pos] == ' ' || d[pos] == '\t') {
+                c->state = C_EXTENSION;
+            } else {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            pos++;
+            break;
+        }
+
+        case C_EXTENSION:
+            // Chunk extensions carry nothing we use; skip to the CR.
+            if (d[pos] == '\r')
+                c->state = C_SIZE_LF;
+            else if (d[pos] == '\n' || ++c->framing > CHUNK_LINE_MAX)
+                status = HTTP_PARSE_ERROR;
+            pos++;
+            break;
+
+        case C_SIZE_LF:
+            if (d[pos++] != '\n') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            c->digits = 0;
+            c->framing = 0;
+            c->state = c->remaining == 0 ? C_TRAILER_START : C_DATA;
+            break;
+
+        case C_DATA: {
+            size_t len = n - pos < c->remaining ? n - pos : c->remaining;
+            *data = slice(in, pos, pos + len);
+            pos += len;
+            c->remaining -= len;
+            if (c->remaining == 0)
+                c->state = C_DATA_CR;
+            break;
+        }
+
+        case C_DATA_CR:
+            if (d[pos++] != '\r') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            c->state = C_DATA_LF;
+            break;
+
+        case C_DATA_LF:
+            if (d[pos++] != '\n') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            c->state = C_SIZE_START;
+            break;
+
+        case C_TRAILER_START:
+            // Trailer fields are accepted and dropped. Like every other
+            // line, the empty one that ends them needs its CR.
+            if (d[pos] == '\n' || ++c->framing > CHUNK_TRAILERS_MAX) {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            c->state = d[pos] == '\r' ? C_END_LF : C_TRAILER;
+            pos++;
+            break;
+
+        case C_TRAILER:
+            if (d[pos] == '\n' || ++c->framing > CHUNK_TRAILERS_MAX)
+                status = HTTP_PARSE_ERROR;
+            else if (d[pos] == '\r')
+                c->state = C_TRAILER_LF;
+            pos++;
+            break;
+
+        case C_TRAILER_LF:
+            if (d[pos++] != '\n') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            c->state = C_TRAILER_START;
+            break;
+
+        case C_END_LF:
+            if (d[pos++] != '\n') {
+                status = HTTP_PARSE_ERROR;
+                break;
+            }
+            c->state = C_DONE;
+            status = HTTP_PARSE_DONE;
+            break;
+        }
+    }
+
+    *consumed = pos;
+    return status;
+}
@@ -27,7 +27,7 @@
 #ifdef DEBUG
 #define LOG_DEBUG(...) LOG("DEBUG", LOG_COLOR_GRAY, __VA_ARGS__)
 #else
-#define LOG_DEBUG(...)
+#define LOG_DEBUG(...) do { } while (0)
 #endif
 
 #define LOG_INFO(...)  LOG("INFO ", LOG_COLOR_CYAN, __VA_ARGS__)
@@ -0,0 +1,114 @@
+#include "negotiate.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+
+#define Q_UNSET (-1)
+#define Q_MAX 1000 // q-values are kept in thousandths
+
+// Server preference, best first.
+static const codec_id_t preference[] = {CODEC_ZSTD, CODEC_GZIP,
+                                        CODEC_DEFLATE};
+
+// "1", "1.000", "0", "0.5", ... at most three decimals; -1 if malformed.
+static int parse_qvalue(str_t s) {
+    if (s.len == 0 || (s.data[0] != '0' && s.data[0] != '1'))
+        return -1;
+    int q = (s.data[0] - '0') * Q_MAX;
+    if (s.len == 1)
+        return q;
+    if (s.data[1] != '.' || s.len > 5)
+        return -1;
+    int scale = Q_MAX / 10;
+    for (size_t i = 2; i < s.len; i++, scale /= 10) {
+        if (!isdigit((unsigned char)s.data[i]))
+            return -1;
+        q += (s.data[i] - '0') * scale;
+    }
+    return q <= Q_MAX ? q : -1;
+}
+
+static str_t trim(str_t s) {
+    while (s.len > 0 && (s.data[0] == ' ' || s.data[0] == '\t')) {
+        s.data++;
+        s.len--;
+    }
+    while (s.len > 0 &&
+           (s.data[s.len - 1] == ' ' || s.data[s.len - 1] == '\t'))
+        s.len--;
+    return s;
+}
+
+// Cuts s at the first sep: returns what comes before, leaves the rest.
+static str_t next_field(str_t *s, char sep) {
+    size_t i = 0;
+    while (i < s->len && s->data[i] != sep)
+        i++;
+    str_t field = {.data = s->data, .len = i};
+    s->data += i < s->len ? i + 1 : i;
+    s->len -= i < s->len ? i + 1 : i;
+    return field;
+}
+
+// q of the coding named by token, or Q_UNSET when the element is malformed.
+static int element_q(str_t element, str_t *token) {
+    *token = trim(next_field(&element, ';'));
+    int q = Q_MAX;
+    while (element.len > 0) {
+        str_t param = trim(next_field(&element, ';'));
+        str_t name = trim(next_field(&param, '='));
+        if (name.len == 1 && (name.data[0] == 'q' || name.data[0] == 'Q')) {
+            q = parse_qvalue(trim(param));
+            if (q < 0)
+                return Q_UNSET;
+        }
+    }
+    return q;
+}
+
+codec_id_t negotiate_encoding(str_t accept_encoding) {
+    int q[CODEC_COUNT];
+    for (int i = 0; i < CODEC_COUNT; i++)
+        q[i] = Q_UNSET;
+    int star = Q_UNSET;
+
+    while (accept_encoding.len > 0) {
+        str_t token;
+        int element = element_q(next_field(&accept_encoding, ','), &token);
+        if (token.len == 0 || element == Q_UNSET)
+            continue;
+        if (str_cmp(token, SL("*"))) {
+            star = element;
+            continue;
+        }
+        codec_id_t id = CODEC_COUNT;
+        if (str_casecmp(token, SL("identity")))
+            id = CODEC_IDENTITY;
+        else if (str_casecmp(token, SL("gzip")) ||
+                 str_casecmp(token, SL("x-gzip")))
+            id = CODEC_GZIP;
+        else if (str_casecmp(token, SL("deflate")))
+            id = CODEC_DEFLATE;
+        else if (str_casecmp(token, SL("zstd")))
+            id = CODEC_ZSTD;
+        // Repeats keep the highest q.
+        if (id != CODEC_COUNT && element > q[id])
+            q[id] = element;
+    }
+
+    codec_id_t best = CODEC_IDENTITY;
+    int best_q = 0;
+    for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        codec_id_t id = preference[i];
+        int coding_q = q[id] != Q_UNSET ? q[id] : star;
+        if (codec_get(id) != NULL && coding_q > best_q) {
+            best = id;
+            best_q = coding_q;
+        }
+    }
+    // identity is acceptable unless ruled out, by name or by "*;q=0".
+    int identity_q = q[CODEC_IDENTITY] != Q_UNSET ? q[CODEC_IDENTITY]
+                     : star != Q_UNSET            ? star
+                                                  : 1;
+    return identity_q > best_q ? CODEC_IDENTITY : best;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "codec.h"
+#include "str.h"
+
+// Picks the content coding for a response from the request's
+// Accept-Encoding value (RFC 9110, 12.5.3): the supported coding with the
+// highest q-value, where "*" stands for every coding not listed by name.
+// Ties go to the better ratio, zstd, then gzip, then deflate, and identity
+// loses ties to any of them. Without an acceptable coding the answer is
+// identity, even when the client ruled that out too.
+codec_id_t negotiate_encoding(str_t accept_encoding);
@@ -0,0 +1,57 @@
+#include "recv_buf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool recv_buf_init(recv_buf_t *b, size_t cap) {
+    b->data = malloc(cap);
+    b->start = 0;
+    b->end = 0;
+    b->cap = b->data ? cap : 0;
+    return b->data != NULL;
+}
+
+void recv_buf_free(recv_buf_t *b) {
+    free(b->data);
+    b->data = NULL;
+    b->start = b->end = b->cap = 0;
+}
+
+bool recv_buf_reserve(recv_buf_t *b, size_t n) {
+    if (recv_buf_free_space(b) >= n)
+        return true;
+
+    size_t len = recv_buf_len(b);
+    if (b->cap - len >= n) {
+        memmove(b->data, b->data + b->start, len);
+        b->start = 0;
+        b->end = len;
+        return true;
+    }
+
+    size_t new_cap = b->cap ? b->cap * 2 : 1;
+    while (new_cap - len < n)
+        new_cap *= 2;
+    byte *data = malloc(new_cap);
+    if (data == NULL)
+        return false;
+    memcpy(data, b->data + b->start, len);
+    free(b->data);
+    b->data = data;
+    b->start = 0;
+    b->end = len;
+    b->cap = new_cap;
+    return true;
+}
+
+void recv_buf_shrink(recv_buf_t *b, size_t cap) {
+    if (b->cap <= cap || recv_buf_len(b) != 0)
+        return;
+    byte *data = malloc(cap);
+    if (data == NULL)
+        return;
+    free(b->data);
+    b->data = data;
+    b->start = b->end = 0;
+    b->cap = cap;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+
+// Connection receive buffer. read() writes straight into the free tail;
+// [start, end) holds received bytes not yet consumed by a finished request.
+// It lives outside the connection arena so request-scoped arena resets
+// never touch it, and it only moves (compaction or growth) inside
+// recv_buf_reserve.
+typedef struct {
+    byte *data;
+    size_t start;
+    size_t end;
+    size_t cap;
+} recv_buf_t;
+
+bool recv_buf_init(recv_buf_t *b, size_t cap);
+void recv_buf_free(recv_buf_t *b);
+
+static inline size_t recv_buf_len(const recv_buf_t *b) {
+    return b->end - b->start;
+}
+
+static inline byte *recv_buf_head(const recv_buf_t *b) {
+    return b->data + b->start;
+}
+
+static inline byte *recv_buf_tail(const recv_buf_t *b) {
+    return b->data + b->end;
+}
+
+static inline size_t recv_buf_free_space(const recv_buf_t *b) {
+    return b->cap - b->end;
+}
+
+// Makes room for at least n more bytes at the tail, first by sliding the
+// unconsumed bytes to the front and otherwise by growing. Anything pointing
+// into the old unconsumed region must be rebased when recv_buf_head
+// changes.
+bool recv_buf_reserve(recv_buf_t *b, size_t n);
+
+static inline void recv_buf_commit(recv_buf_t *b, size_t n) { b->end += n; }
+
+static inline void recv_buf_consume(recv_buf_t *b, size_t n) {
+    b->start += n;
+    if (b->start == b->end)
+        b->start = b->end = 0;
+}
+
+// Gives memory back after an unusually large request once it is drained.
+void recv_buf_shrink(recv_buf_t *b, size_t cap);
@@ -0,0 +1,242 @@
+// Radix-tree request router
+#include "router.h"
+#include "log.h"
+
+#include <string.h>
+
+struct http_route_node {
+    str_t prefix; // literal bytes this node matches
+    http_route_node_t* children; // literal children, distinct first bytes
+    http_route_node_t* next;     // sibling in the parent's children list
+    http_route_node_t* param;    // `:name` child
+    str_t param_name;
+    http_route_node_t* wildcard; // `*name` child, always a leaf
+    str_t wildcard_name;
+    bool has_routes;
+    http_route_t routes[HTTP_METHOD_COUNT];
+};
+
+static const char* method_names[HTTP_METHOD_COUNT] = {
+    [HTTP_METHOD_GET] = "GET",
+    [HTTP_METHOD_HEAD] = "HEAD",
+    [HTTP_METHOD_POST] = "POST",
+    [HTTP_METHOD_PUT] = "PUT",
+    [HTTP_METHOD_DELETE] = "DELETE",
+    [HTTP_METHOD_PATCH] = "PATCH",
+    [HTTP_METHOD_OPTIONS] = "OPTIONS",
+};
+
+http_method_t http_method_from_str(str_t method)
+{
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++)
+        if (method.len == strlen(method_names[m]) &&
+            memcmp(method.data, method_names[m], method.len) == 0)
+            return (http_method_t)m;
+    return HTTP_METHOD_UNKNOWN;
+}
+
+str_t http_method_name(http_method_t method)
+{
+    return S((byte*)method_names[method]);
+}
+
+static http_route_node_t* node_new(Arena* a, str_t prefix)
+{
+    http_route_node_t* n =
+        arena_alloc_align(a, sizeof(*n), _Alignof(http_route_node_t));
+    if (n == NULL)
+        return NULL;
+    memset(n, 0, sizeof(*n));
+    n->prefix = prefix;
+    return n;
+}
+
+void router_init(http_router_t* r)
+{
+    r->arena = arena_new(1 << 16); // 64KB
+    r->root = node_new(&r->arena, (str_t){ 0 });
+}
+
+void router_destroy(http_router_t* r)
+{
+    arena_destroy(&r->arena);
+    r->root = NULL;
+}
+
+static size_t common_prefix(str_t a, str_t b)
+{
+    size_t i = 0;
+    while (i < a.len && i < b.len && a.data[i] == b.data[i])
+        i++;
+    return i;
+}
+
+// Walks (and extends) the literal branches below n for s, splitting a node
+// where s leaves its prefix part way.
+static http_route_node_t* insert_literal(Arena* a, http_route_node_t* n,
+                                         str_t s)
+{
+    while (s.len > 0) {
+        http_route_node_t** link = &n->children;
+        while (*link != NULL && (*link)->prefix.data[0] != s.data[0])
+            link = &(*link)->next;
+
+        http_route_node_t* child = *link;
+        if (child == NULL) {
+            child = node_new(a, s);
+            if (child == NULL)
+                return NULL;
+            *link = child;
+            return child;
+        }
+
+        size_t common = common_prefix(child->prefix, s);
+        if (common < child->prefix.len) {
+            http_route_node_t* mid =
+                node_new(a, str_span(child->prefix, 0, common));
+            if (mid == NULL)
+                return NULL;
+            mid->next = child->next;
+            child->next = NULL;
+            child->prefix = str_span(child->prefix, common, child->prefix.len);
+            mid->children = child;
+            *link = mid;
+            child = mid;
+        }
+        n = child;
+        s = str_span(s, common, s.len);
+    }
+    return n;
+}
+
+bool router_add(http_router_t* r, http_method_t method, const char* pattern,
+                http_handler_fn handler, unsigned flags)
+{
+    if (r->root == NULL || method >= HTTP_METHOD_COUNT || pattern[0] != '/')
+        return false;
+    // The tree keeps slices of the pattern.
+    str_t p = str_copy(&r->arena, S((byte*)pattern));
+    http_route_node_t* n = r->root;
+
+    size_t i = 0;
+    while (i < p.len && n != NULL) {
+        byte c = p.data[i];
+        if (c == ':' || c == '*') {
+            // Parameters take whole segments.
+            if (p.data[i - 1] != '/')
+                return false;
+            size_t end = i + 1;
+            while (end < p.len && p.data[end] != '/')
+                end++;
+            str_t name = str_span(p, i + 1, end);
+            if (name.len == 0 || (c == '*' && end != p.len))
+                return false;
+
+            http_route_node_t** child = c == ':' ? &n->param : &n->wildcard;
+            str_t* child_name = c == ':' ? &n->param_name : &n->wildcard_name;
+            if (*child == NULL) {
+                *child = node_new(&r->arena, (str_t){ 0 });
+                *child_name = name;
+            } else if (!str_cmp(*child_name, name)) {
+                LOG_ERROR("route %s: parameter :" STR_FMT " was registered as :" STR_FMT,
+                          pattern, STR_ARG(name), STR_ARG(*child_name));
+                return false;
+            }
+            n = *child;
+            i = end;
+        } else {
+            size_t end = i;
+            while (end < p.len && p.data[end] != ':' && p.data[end] != '*')
+                end++;
+            n = insert_literal(&r->arena, n, str_span(p, i, end));
+            i = end;
+        }
+    }
+    if (n == NULL || n->routes[method].handler != NULL)
+        return false;
+
+    n->routes[method] = (http_route_t){ .handler = handler, .flags = flags };
+    n->has_routes = true;
+    return true;
+}
+
+static bool push_param(http_request_t* request, str_t name, str_t value)
+{
+    if (request->param_count == HTTP_MAX_PARAMS)
+        return false;
+    request->params[request->param_count++] =
+        (http_param_t){ .name = name, .value = value };
+    return true;
+}
+
+// `path` is what is left after n's prefix. Literal children are tried
+// first; each first byte leads to at most one, so backtracking only
+// happens at parameters.
+static const http_route_node_t* match_node(const http_route_node_t* n,
+                                           const byte* path, size_t len,
+                                           http_request_t* request)
+{
+    if (len == 0)
+        return n->has_routes ? n : NULL;
+
+    for (const http_route_node_t* c = n->children; c != NULL; c = c->next) {
+        if (c->prefix.data[0] != path[0])
+            continue;
+        if (c->prefix.len <= len &&
+            memcmp(c->prefix.data, path, c->prefix.len) == 0) {
+            const http_route_node_t* found = match_node(
+                c, path + c->prefix.len, len - c->prefix.len, request);
+            if (found != NULL)
+                return found;
+        }
+        break;
+    }
+
+    if (n->param != NULL) {
+        size_t end = 0;
+        while (end < len && path[end] != '/')
+            end++;
+        size_t saved = request->param_count;
+        if (end > 0 && push_param(request, n->param_name,
+                                  (str_t){ .data = (byte*)path, .len = end })) {
+            const http_route_node_t* found =
+                match_node(n->param, path + end, len - end, request);
+            if (found != NULL)
+                return found;
+        }
+        request->param_count = saved;
+    }
+
+    if (n->wildcard != NULL && n->wildcard->has_routes &&
+        push_param(request, n->wildcard_name,
+                   (str_t){ .data = (byte*)path, .len = len }))
+        return n->wildcard;
+    return NULL;
+}
+
+http_route_result_t router_match(const http_router_t* r,
+                                 http_request_t* request,
+                                 http_route_match_t* match)
+{
+    str_t url = request->url;
+    size_t len = 0;
+    while (len < url.len && url.data[len] != '?')
+        len++;
+
+    request->param_count = 0;
+    const http_route_node_t* n =
+        r->root ? match_node(r->root, url.data, len, request) : NULL;
+    if (n == NULL)
+        return HTTP_ROUTE_NOT_FOUND;
+
+    http_method_t method = http_method_from_str(request->method);
+    if (method == HTTP_METHOD_UNKNOWN || n->routes[method].handler == NULL) {
+        match->allowed = 0;
+        for (int m = 0; m < HTTP_METHOD_COUNT; m++)
+            if (n->routes[m].handler != NULL)
+                match->allowed |= 1u << m;
+        return HTTP_ROUTE_METHOD_NOT_ALLOWED;
+    }
+    match->route = &n->routes[method];
+    return HTTP_ROUTE_FOUND;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "http.h"
+#include "str.h"
+
+typedef enum {
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_OPTIONS,
+    HTTP_METHOD_COUNT,
+    HTTP_METHOD_UNKNOWN = HTTP_METHOD_COUNT,
+} http_method_t;
+
+http_method_t http_method_from_str(str_t method);
+str_t http_method_name(http_method_t method);
+
+// Returns true when the connection should be closed after the response.
+typedef bool (*http_handler_fn)(Arena* a, http_request_t* request,
+                                http_response_t* response);
+
+// The request body is streamed to FILES_DIR/<:name> before the handler
+// runs; the handler commits or drops request->upload.
+#define HTTP_ROUTE_UPLOAD 1u
+
+typedef struct {
+    http_handler_fn handler;
+    unsigned flags;
+} http_route_t;
+
+typedef struct http_route_node http_route_node_t;
+
+// Radix tree of path patterns. Patterns are literal bytes plus `:name`
+// (one non-empty path segment) and a trailing `*name` (the non-empty rest
+// of the path); matched values land in request->params. Literal branches
+// win over `:` which wins over `*`. Build it before serving; matching only
+// reads the tree, so threads can share it.
+typedef struct {
+    Arena arena;
+    http_route_node_t* root;
+} http_router_t;
+
+typedef enum {
+    HTTP_ROUTE_FOUND,
+    HTTP_ROUTE_NOT_FOUND,
+    HTTP_ROUTE_METHOD_NOT_ALLOWED,
+} http_route_result_t;
+
+typedef struct {
+    const http_route_t* route; // when found
+    unsigned allowed;          // methods the path does have, 1 << method
+} http_route_match_t;
+
+void router_init(http_router_t* r);
+void router_destroy(http_router_t* r);
+// False when the pattern is malformed or clashes with an existing one.
+bool router_add(http_router_t* r, http_method_t method, const char* pattern,
+                http_handler_fn handler, unsigned flags);
+// Matches the path part of request->url (the query is ignored) without
+// allocating.
+http_route_result_t router_match(const http_router_t* r,
+                                 http_request_t* request,
+                                 http_route_match_t* match);
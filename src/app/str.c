@@ -83,25 +83,344 @@ str_t str_concat(Arena* a, str_t s1, str_t s2)
     return res;
 }
 
-bool str_cmp(str_t s1, str_t s2)
+// ASCII case-insensitive equality, as HTTP wants for names and tokens.
+bool str_casecmp(str_t s1, str_t s2)
 {
     if (s1.len != s2.len)
         return false;
 
     for (size_t i = 0; i < s1.len; i++)
-        if (s1.data[i] != s2.data[i])
+        if (tolower((unsigned char)s1.data[i]) != tolower((unsigned char)s2.data[i]))
             return false;
 
     return true;
 }
 
-int str_find(str_t s, str_t sub_s)
+// isspace() in the C locale, which is the only one the server runs in.
+static inline bool is_space(byte c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Comparison, byte search and trimming. On x86 the SSE2 paths are always
+// available and the AVX2 ones are picked at runtime; elsewhere plain loops
+// and memchr/memcmp do the work. SSE4.2's string instructions are left
+// out: compare + movemask beats PCMPxSTRx on the short inputs seen here.
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define STR_SIMD_X86 1
+#include <immintrin.h>
+
+static inline bool cpu_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+// For n >= 16. The last block overlaps the previous one instead of falling
+// back to a byte loop.
+static bool equal_sse2(const byte* a, const byte* b, size_t n)
 {
-    for (size_t i = 0;i < s.len;i++) {
-        str_t tmp = str_span(s, i, i + sub_s.len);
-        if (str_cmp(tmp, sub_s))return i;
+    size_t i = 0;
+    for (; i + 16 < n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+            return false;
+    }
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + n - 16));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b + n - 16));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xffff;
+}
+
+// For n >= 32.
+__attribute__((target("avx2")))
+static bool equal_avx2(const byte* a, const byte* b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 < n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xffffffffu)
+            return false;
     }
-    return -1;
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + n - 32));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + n - 32));
+    return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) == 0xffffffffu;
+}
+
+// Bitmask of the isspace() bytes in a block: ' ' and '\t'..'\r'.
+static inline unsigned space_mask_sse2(__m128i block)
+{
+    __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    __m128i sp = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+static size_t skip_space_sse2(const byte* p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned rest = ~space_mask_sse2(_mm_loadu_si128((const __m128i*)(p + i))) & 0xffff;
+        if (rest)
+            return i + (size_t)__builtin_ctz(rest);
+    }
+    while (i < n && is_space(p[i]))
+        i++;
+    return i;
+}
+
+// Length of p[0, n) once trailing whitespace is dropped.
+static size_t skip_space_back_sse2(const byte* p, size_t n)
+{
+    while (n >= 16) {
+        unsigned rest = ~space_mask_sse2(_mm_loadu_si128((const __m128i*)(p + n - 16))) & 0xffff;
+        if (rest)
+            return n - 16 + (size_t)(32 - __builtin_clz(rest));
+        n -= 16;
+    }
+    while (n > 0 && is_space(p[n - 1]))
+        n--;
+    return n;
+}
+
+static size_t find_char_sse2(const byte* p, size_t n, byte c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(p + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    for (; i < n; i++)
+        if (p[i] == c)
+            return i;
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t find_char_avx2(const byte* p, size_t n, byte c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(p + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + find_char_sse2(p + i, n - i, c);
+}
+
+// ASCII control bytes are those below 0x20 plus DEL. An unsigned
+// min(x, 0x1f) == x picks out the first group.
+static size_t find_ctl_sse2(const byte* p, size_t n)
+{
+    __m128i low = _mm_set1_epi8(0x1f);
+    __m128i del = _mm_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i ctl = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(block, low), block),
+            _mm_cmpeq_epi8(block, del));
+        unsigned mask = (unsigned)_mm_movemask_epi8(ctl);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    for (; i < n; i++)
+        if ((unsigned char)p[i] < 0x20 || p[i] == 0x7f)
+            return i;
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t find_ctl_avx2(const byte* p, size_t n)
+{
+    __m256i low = _mm256_set1_epi8(0x1f);
+    __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i ctl = _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(block, low), block),
+            _mm256_cmpeq_epi8(block, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(ctl);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + find_ctl_sse2(p + i, n - i);
+}
+
+// Candidate positions are those where both the first and the last byte of
+// the needle match; only those are compared in full. Needs m >= 2.
+static size_t find_sse2(const byte* p, size_t n, const byte* sub, size_t m)
+{
+    __m128i first = _mm_set1_epi8(sub[0]);
+    __m128i last = _mm_set1_epi8(sub[m - 1]);
+    size_t end = n - m + 1; // candidate starts are [0, end)
+    size_t i = 0;
+    for (; i + 16 <= end; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i bl = _mm_loadu_si128((const __m128i*)(p + i + m - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+        while (mask) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (memcmp(p + at + 1, sub + 1, m - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    for (; i < end; i++)
+        if (p[i] == sub[0] && memcmp(p + i, sub, m) == 0)
+            return i;
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const byte* p, size_t n, const byte* sub, size_t m)
+{
+    __m256i first = _mm256_set1_epi8(sub[0]);
+    __m256i last = _mm256_set1_epi8(sub[m - 1]);
+    size_t end = n - m + 1;
+    size_t i = 0;
+    for (; i + 32 <= end; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i*)(p + i + m - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+        while (mask) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (memcmp(p + at + 1, sub + 1, m - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = find_sse2(p + i, n - i, sub, m);
+    return rest == n - i ? n : i + rest;
+}
+#else
+
+static bool equal_scalar(const byte* a, const byte* b, size_t n)
+{
+    return memcmp(a, b, n) == 0;
+}
+
+static size_t skip_space_scalar(const byte* p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && is_space(p[i]))
+        i++;
+    return i;
+}
+
+static size_t skip_space_back_scalar(const byte* p, size_t n)
+{
+    while (n > 0 && is_space(p[n - 1]))
+        n--;
+    return n;
+}
+
+static size_t find_ctl_scalar(const byte* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if ((unsigned char)p[i] < 0x20 || p[i] == 0x7f)
+            return i;
+    return n;
+}
+
+static size_t find_char_scalar(const byte* p, size_t n, byte c)
+{
+    if (n == 0)
+        return 0;
+    const byte* hit = memchr(p, c, n);
+    return hit ? (size_t)(hit - p) : n;
+}
+
+static size_t find_scalar(const byte* p, size_t n, const byte* sub, size_t m)
+{
+    for (size_t i = 0; i + m <= n; i++) {
+        size_t at = find_char_scalar(p + i, n - m + 1 - i, sub[0]);
+        i += at;
+        if (i + m > n)
+            break;
+        if (memcmp(p + i, sub, m) == 0)
+            return i;
+    }
+    return n;
+}
+#endif
+
+bool str_cmp(str_t s1, str_t s2)
+{
+    if (s1.len != s2.len)
+        return false;
+    if (s1.len == 0 || s1.data == s2.data)
+        return true;
+#ifdef STR_SIMD_X86
+    if (s1.len < 16) {
+        for (size_t i = 0; i < s1.len; i++)
+            if (s1.data[i] != s2.data[i])
+                return false;
+        return true;
+    }
+    if (s1.len >= 32 && cpu_has_avx2())
+        return equal_avx2(s1.data, s2.data, s1.len);
+    return equal_sse2(s1.data, s2.data, s1.len);
+#else
+    return equal_scalar(s1.data, s2.data, s1.len);
+#endif
+}
+
+int str_find_char(str_t s, byte c)
+{
+    size_t at;
+#ifdef STR_SIMD_X86
+    if (cpu_has_avx2())
+        at = find_char_avx2(s.data, s.len, c);
+    else
+        at = find_char_sse2(s.data, s.len, c);
+#else
+    at = find_char_scalar(s.data, s.len, c);
+#endif
+    return at == s.len ? -1 : (int)at;
+}
+
+int str_find_ctl(str_t s)
+{
+    size_t at;
+#ifdef STR_SIMD_X86
+    if (cpu_has_avx2())
+        at = find_ctl_avx2(s.data, s.len);
+    else
+        at = find_ctl_sse2(s.data, s.len);
+#else
+    at = find_ctl_scalar(s.data, s.len);
+#endif
+    return at == s.len ? -1 : (int)at;
+}
+
+int str_find(str_t s, str_t sub_s)
+{
+    if (sub_s.len == 0)
+        return 0;
+    if (sub_s.len > s.len)
+        return -1;
+    if (sub_s.len == 1)
+        return str_find_char(s, sub_s.data[0]);
+
+    size_t at;
+#ifdef STR_SIMD_X86
+    if (cpu_has_avx2())
+        at = find_avx2(s.data, s.len, sub_s.data, sub_s.len);
+    else
+        at = find_sse2(s.data, s.len, sub_s.data, sub_s.len);
+#else
+    at = find_scalar(s.data, s.len, sub_s.data, sub_s.len);
+#endif
+    return at == s.len ? -1 : (int)at;
 }
 
 bool str_contain(str_t s, str_t sub_s) {
@@ -110,12 +429,68 @@ bool str_contain(str_t s, str_t sub_s) {
 
 
 
+static const char dec_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static size_t dec_digits(uint64_t v) {
+    size_t n = 1;
+    for (;;) {
+        if (v < 10)
+            return n;
+        if (v < 100)
+            return n + 1;
+        if (v < 1000)
+            return n + 2;
+        if (v < 10000)
+            return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+// Fills from the last digit backwards, two digits per division.
+size_t u64_to_dec(byte* out, uint64_t v) {
+    size_t n = dec_digits(v);
+    byte* p = out + n;
+    while (v >= 100) {
+        unsigned pair = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = dec_pairs[pair + 1];
+        *--p = dec_pairs[pair];
+    }
+    if (v >= 10) {
+        *--p = dec_pairs[v * 2 + 1];
+        *--p = dec_pairs[v * 2];
+    } else {
+        *--p = (byte)('0' + v);
+    }
+    return n;
+}
+
 str_t int_to_str(Arena* a, int number) {
-    char buffer[12];
-    snprintf(buffer, sizeof(buffer), "%d", number);
+    byte* data = arena_alloc_align(a, U64_DEC_MAX + 1, _Alignof(byte));
+    size_t len = 0;
+    uint64_t v = (uint64_t)number;
+    if (number < 0) {
+        data[len++] = '-';
+        v = -(uint64_t)(int64_t)number;
+    }
+    len += u64_to_dec(data + len, v);
+    return (str_t){ .data = data, .len = len };
+}
 
-    str_t result = str_new(a, buffer);
-    return result;
+str_t size_to_str(Arena* a, size_t number) {
+    byte* data = arena_alloc_align(a, U64_DEC_MAX, _Alignof(byte));
+    return (str_t){ .data = data, .len = u64_to_dec(data, number) };
 }
 
 
@@ -136,7 +511,8 @@ void str_buffer_append_char(Arena* a, str_buffer_t* b, char c) {
     if (b->len + 1 > b->cap) {
         size_t new_cap = b->cap > 0 ? b->cap * 2 : 1;
         while (new_cap < b->len + 1) new_cap *= 2;
-        byte* new_data = arena_realloc_align(a, b->data, new_cap, _Alignof(char));
+        byte* new_data = arena_realloc_align(a, b->data, b->cap, new_cap,
+                                             _Alignof(char));
         assert(new_data != NULL);
         b->data = new_data;
         b->cap = new_cap;
@@ -150,7 +526,8 @@ void str_buffer_append_str(Arena* a, str_buffer_t* b, str_t s) {
     if (b->len > b->cap - s.len) {
         size_t new_cap = b->cap > 0 ? b->cap * 2 : 1;
         while (b->len > new_cap - s.len) new_cap *= 2;
-        byte* new_data = arena_realloc_align(a, b->data, new_cap, _Alignof(char));
+        byte* new_data = arena_realloc_align(a, b->data, b->cap, new_cap,
+                                             _Alignof(char));
         assert(new_data != NULL);
         b->data = new_data;
         b->cap = new_cap;
@@ -167,6 +544,24 @@ int str_atoi(str_t s) {
     }
     return result;
 }
+// Strict unsigned decimal parse; false on empty input, stray characters or
+// overflow.
+bool str_to_size(str_t s, size_t* out) {
+    if (s.len == 0)
+        return false;
+    size_t result = 0;
+    for (size_t i = 0; i < s.len; i++) {
+        if (s.data[i] < '0' || s.data[i] > '9')
+            return false;
+        size_t digit = (size_t)(s.data[i] - '0');
+        if (result > (SIZE_MAX - digit) / 10)
+            return false;
+        result = result * 10 + digit;
+    }
+    *out = result;
+    return true;
+}
+
 str_t str_buffer_to_str(str_buffer_t buffer) {
     str_t res = { .data = buffer.data, .len = buffer.len };
     return res;
@@ -196,14 +591,13 @@ byte* str_to_char_ptr(Arena* a, str_t s) {
 
 str_t str_trim(str_t s)
 {
-    size_t l = 0;
-    size_t r = s.len;
-
-    while (l < s.len && isspace(s.data[l]))
-        l++;
-    while (r > 0 && l < r && isspace(s.data[r - 1]))
-        r--;
-
+#ifdef STR_SIMD_X86
+    size_t l = skip_space_sse2(s.data, s.len);
+    size_t r = l + skip_space_back_sse2(s.data + l, s.len - l);
+#else
+    size_t l = skip_space_scalar(s.data, s.len);
+    size_t r = l + skip_space_back_scalar(s.data + l, s.len - l);
+#endif
     return str_span(s, l, r);
 }
 
@@ -226,32 +620,25 @@ str_t str_join(Arena* a_ptr, str_vec_t vec, str_t d) {
     return str_buffer_to_str(buf);
 }
 
+// Both splits drop empty pieces, so runs of delimiters count as one.
 str_vec_t str_split_s(Arena* a, str_t s, str_t de)
 {
     str_vec_t res = strvec_new(a, 1);
-    size_t start = 0;
-    size_t i = 0;
-    while (i < s.len)
-    {
-        str_t tmp = str_span(s, i, i + de.len);
-        if (str_cmp(tmp, de))
-        {
-            if (start != i)
-            {
-                str_t v = str_span(s, start, i);
-                strvec_push(a, &res, v);
-            }
-            start = i + de.len;
-            i += de.len;
-        }
-        else {
-            i++;
-        }
+    if (de.len == 0) {
+        if (s.len > 0)
+            strvec_push(a, &res, s);
+        return res;
     }
-    if (start < s.len)
-    {
-        str_t v = str_span(s, start, s.len);
-        strvec_push(a, &res, v);
+
+    size_t start = 0;
+    while (start < s.len) {
+        int at = str_find(str_span(s, start, s.len), de);
+        size_t end = at == -1 ? s.len : start + (size_t)at;
+        if (end != start)
+            strvec_push(a, &res, str_span(s, start, end));
+        if (at == -1)
+            break;
+        start = end + de.len;
     }
 
     return res;
@@ -261,29 +648,15 @@ str_vec_t str_split(Arena* a, str_t s, char de)
 {
     str_vec_t res = strvec_new(a, 1);
 
-    size_t l = 0;
-    size_t r = 0;
-
-    for (size_t i = 0; i < s.len; i++)
-    {
-        if (s.data[i] != de)
-            r = i;
-
-        if (s.data[i] == de)
-        {
-            if (l <= r)
-            {
-                str_t v = str_span(s, l, r);
-                strvec_push(a, &res, v);
-            }
-            l = r = i + 1;
-        }
-    }
-
-    if (l <= r && r <= s.len)
-    {
-        str_t v = str_span(s, l, r);
-        strvec_push(a, &res, v);
+    size_t start = 0;
+    while (start < s.len) {
+        int at = str_find_char(str_span(s, start, s.len), de);
+        size_t end = at == -1 ? s.len : start + (size_t)at;
+        if (end != start)
+            strvec_push(a, &res, str_span(s, start, end));
+        if (at == -1)
+            break;
+        start = end + 1;
     }
     return res;
 }
@@ -8,6 +8,9 @@
 
 #define S(s)                                                                   \
     (str_t) { .data = (s), .len = strlen(s) }
+// S() for string literals only; the length is known at compile time.
+#define SL(lit)                                                                \
+    (str_t) { .data = (byte*)("" lit), .len = sizeof(lit) - 1 }
 #define STR_FMT "%.*s"
 #define STR_ARG(s) (int)(s).len, (s).data
 
@@ -57,13 +60,23 @@ void str_print(str_t s);
 str_t str_copy(Arena* a, str_t src);
 bool str_contain(str_t s, str_t sub_s);
 int str_find(str_t s, str_t sub_s);
+int str_find_char(str_t s, byte c);
+// First ASCII control character (below 0x20, or DEL), -1 if none.
+int str_find_ctl(str_t s);
 str_t str_span(str_t s, size_t l, size_t r);
 bool str_cmp(str_t, str_t);
+bool str_casecmp(str_t, str_t);
 str_t int_to_str(Arena* a, int number);
+str_t size_to_str(Arena* a, size_t number);
+// Writes v in decimal to out, which needs room for U64_DEC_MAX bytes, and
+// returns the number of digits.
+#define U64_DEC_MAX 20
+size_t u64_to_dec(byte* out, uint64_t v);
 str_buffer_t str_buffer_new(Arena* a, size_t cap);
 void str_buffer_append_str(Arena* a, str_buffer_t* buffer, str_t s);
 void str_buffer_append_char(Arena* a, str_buffer_t* buffer, char c);
 str_t str_buffer_to_str(str_buffer_t buffer);
 int str_atoi(str_t s);
+bool str_to_size(str_t s, size_t* out);
 byte* str_to_char_ptr(Arena* a, str_t s);
 str_t str_join(Arena* a_ptr, str_vec_t vec, str_t d);
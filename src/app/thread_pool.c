@@ -0,0 +1,139 @@
+#include "thread_pool.h"
+#include "http.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// A worker is tied up for as long as its client keeps the connection open,
+// so a read that waits this long ends the connection: idle keep-alive
+// clients are dropped, and a request that stalls partway gets a 408.
+#define POOL_IDLE_TIMEOUT_SEC 5
+
+static void *worker_main(void *arg) {
+    thread_pool_t *pool = arg;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queue_len == 0 && !pool->shutdown)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        int fd = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % pool->queue_cap;
+        pool->queue_len--;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        struct timeval timeout = {.tv_sec = POOL_IDLE_TIMEOUT_SEC};
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       sizeof(timeout)) == -1)
+            perror("setsockopt SO_RCVTIMEO failed");
+
+        pool->handle_client((void *)(intptr_t)fd);
+    }
+    return NULL;
+}
+
+bool thread_pool_init(thread_pool_t *pool, size_t worker_count,
+                      size_t queue_cap, pool_full_policy_t policy,
+                      void *(*handle_client)(void *arg)) {
+    if (worker_count == 0 || queue_cap == 0)
+        return false;
+
+    pool->worker_count = worker_count;
+    pool->queue_cap = queue_cap;
+    pool->queue_head = 0;
+    pool->queue_len = 0;
+    pool->policy = policy;
+    pool->handle_client = handle_client;
+    pool->shutdown = false;
+
+    pool->queue = malloc(queue_cap * sizeof(*pool->queue));
+    pool->workers = malloc(worker_count * sizeof(*pool->workers));
+    if (pool->queue == NULL || pool->workers == NULL) {
+        free(pool->queue);
+        free(pool->workers);
+        return false;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    for (size_t i = 0; i < worker_count; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            perror("pthread_create failed");
+            // The workers already running point at pool, which the caller
+            // gives up on: stop them before it goes away.
+            pthread_mutex_lock(&pool->lock);
+            pool->shutdown = true;
+            pthread_cond_broadcast(&pool->not_empty);
+            pthread_mutex_unlock(&pool->lock);
+            for (size_t j = 0; j < i; j++)
+                pthread_join(pool->workers[j], NULL);
+            pthread_mutex_destroy(&pool->lock);
+            pthread_cond_destroy(&pool->not_empty);
+            pthread_cond_destroy(&pool->not_full);
+            free(pool->queue);
+            free(pool->workers);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool thread_pool_submit(thread_pool_t *pool, int fd) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->queue_len == pool->queue_cap) {
+        if (pool->policy == POOL_FULL_REJECT) {
+            pthread_mutex_unlock(&pool->lock);
+            return false;
+        }
+        while (pool->queue_len == pool->queue_cap)
+            pthread_cond_wait(&pool->not_full, &pool->lock);
+    }
+
+    size_t tail = (pool->queue_head + pool->queue_len) % pool->queue_cap;
+    pool->queue[tail] = fd;
+    pool->queue_len++;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+bool run_loop_pool(int server_fd, size_t worker_count, size_t queue_cap,
+                   pool_full_policy_t policy) {
+    thread_pool_t pool;
+    if (!thread_pool_init(&pool, worker_count, queue_cap, policy,
+                          handle_http_connection)) {
+        LOG_ERROR("failed to start thread pool");
+        return false;
+    }
+    LOG_INFO("Thread pool: %zu workers, queue of %zu, %s when full",
+             worker_count, queue_cap,
+             policy == POOL_FULL_REJECT ? "reject" : "block");
+
+    while (true) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd == -1) {
+            if (errno != EINTR)
+                perror("accept failed");
+            continue;
+        }
+
+        if (!thread_pool_submit(&pool, client_fd)) {
+            LOG_WARN("queue full, rejecting client %d", client_fd);
+            http_reject_unavailable(client_fd);
+            close(client_fd);
+        }
+    }
+}
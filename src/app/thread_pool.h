@@ -0,0 +1,43 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// What to do with a freshly accepted socket when the queue is full.
+typedef enum {
+    POOL_FULL_BLOCK,  // stop accepting until a worker frees a slot
+    POOL_FULL_REJECT, // answer 503 Service Unavailable and close
+} pool_full_policy_t;
+
+// Fixed set of pre-spawned workers pulling accepted fds from a bounded
+// ring buffer.
+typedef struct {
+    pthread_t *workers;
+    size_t worker_count;
+
+    int *queue;
+    size_t queue_cap;
+    size_t queue_head;
+    size_t queue_len;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    pool_full_policy_t policy;
+    void *(*handle_client)(void *arg);
+    bool shutdown; // workers exit instead of waiting for work
+} thread_pool_t;
+
+bool thread_pool_init(thread_pool_t *pool, size_t worker_count,
+                      size_t queue_cap, pool_full_policy_t policy,
+                      void *(*handle_client)(void *arg));
+
+// Hands an accepted fd to the pool. Returns false if the fd was rejected
+// because the queue is full and the policy is POOL_FULL_REJECT; the caller
+// still owns the fd in that case.
+bool thread_pool_submit(thread_pool_t *pool, int fd);
+
+bool run_loop_pool(int server_fd, size_t worker_count, size_t queue_cap,
+                   pool_full_policy_t policy);
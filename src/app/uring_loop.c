@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#include "uring_loop.h"
+#include "http.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define URING_ENTRIES 1024
+#define URING_FIXED_BUFS 1024
+#define URING_BUF_SIZE 4096
+// File bodies go file -> pipe -> socket with linked splices, one pipe's
+// worth at a time.
+#define URING_SPLICE_CHUNK (1 << 16)
+
+// user_data is the connection pointer with the operation in the low bits;
+// the accept SQE uses a plain 0.
+#define URING_OP_ACCEPT 0
+#define URING_OP_RECV 1
+#define URING_OP_SEND 2
+#define URING_OP_SPLICE_IN 3
+#define URING_OP_SPLICE_OUT 4
+#define URING_OP_MASK 7
+
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail; // next free SQE, ahead of *sq_tail until submitted
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} uring_t;
+
+typedef struct {
+    http_conn_t http;
+    int buf_index;   // registered buffer slot, -1 when reading into heap_buf
+    char *heap_buf;  // fallback when all registered slots are taken
+    unsigned inflight;
+    bool recv_pending;
+    bool sending;
+    size_t pending_len; // bytes received while a response was in flight
+    bool closing;
+
+    struct msghdr msg;  // sendmsg header for the response in http.out
+
+    int pipe_fds[2];    // created on the first file body, -1 until then
+    size_t pipe_bytes;  // spliced in from the file, not yet out to the socket
+    unsigned splices;   // splice SQEs still in flight
+} uring_conn_t;
+
+typedef struct {
+    uring_t ring;
+    int server_fd;
+    bool multishot_accept;
+
+    char *buf_region;
+    bool fixed_bufs;
+    int free_bufs[URING_FIXED_BUFS];
+    size_t free_buf_count;
+} uring_loop_t;
+
+static int uring_setup(uring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        perror("io_uring_setup failed");
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        LOG_ERROR("io_uring: kernel lacks IORING_FEAT_SINGLE_MMAP");
+        close(r->fd);
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+    byte *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        perror("mmap(io_uring ring) failed");
+        close(r->fd);
+        return -1;
+    }
+
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                   IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        perror("mmap(io_uring sqes) failed");
+        close(r->fd);
+        return -1;
+    }
+
+    r->sq_head = (unsigned *)(ring + p.sq_off.head);
+    r->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(ring + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+
+    r->cq_head = (unsigned *)(ring + p.cq_off.head);
+    r->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+    return 0;
+}
+
+// Publishes queued SQEs and optionally waits for wait_nr completions.
+static int uring_enter(uring_t *r, unsigned wait_nr) {
+    unsigned to_submit = r->sqe_tail - *r->sq_tail;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+    int ret = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr,
+                           flags, NULL, 0);
+    if (ret < 0 && errno != EINTR && errno != EBUSY) {
+        perror("io_uring_enter failed");
+        return -1;
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring_t *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) {
+        // Ring is full: push what we have to the kernel to make room.
+        if (uring_enter(r, 0) != 0)
+            return NULL;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sqe_tail - head >= r->sq_entries)
+            return NULL;
+    }
+
+    unsigned index = r->sqe_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    r->sqe_tail++;
+    return sqe;
+}
+
+static bool register_buffers(uring_loop_t *loop) {
+    loop->fixed_bufs = false;
+    loop->free_buf_count = 0;
+    loop->buf_region = malloc((size_t)URING_FIXED_BUFS * URING_BUF_SIZE);
+    if (loop->buf_region == NULL)
+        return false;
+
+    struct iovec iovs[URING_FIXED_BUFS];
+    for (int i = 0; i < URING_FIXED_BUFS; i++) {
+        iovs[i].iov_base = loop->buf_region + (size_t)i * URING_BUF_SIZE;
+        iovs[i].iov_len = URING_BUF_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, loop->ring.fd,
+                IORING_REGISTER_BUFFERS, iovs, URING_FIXED_BUFS) != 0) {
+        perror("io_uring_register(BUFFERS) failed, using plain recv");
+        free(loop->buf_region);
+        loop->buf_region = NULL;
+        return false;
+    }
+
+    for (int i = URING_FIXED_BUFS - 1; i >= 0; i--)
+        loop->free_bufs[loop->free_buf_count++] = i;
+    loop->fixed_bufs = true;
+    return true;
+}
+
+static char *conn_buf(uring_loop_t *loop, uring_conn_t *c) {
+    if (c->buf_index >= 0)
+        return loop->buf_region + (size_t)c->buf_index * URING_BUF_SIZE;
+    return c->heap_buf;
+}
+
+static void arm_accept(uring_loop_t *loop) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        LOG_ERROR("io_uring: no SQE for accept");
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->server_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = loop->multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = URING_OP_ACCEPT;
+}
+
+static bool queue_recv(uring_loop_t *loop, uring_conn_t *c) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL)
+        return false;
+
+    sqe->fd = c->http.fd;
+    sqe->addr = (uint64_t)(uintptr_t)conn_buf(loop, c);
+    sqe->len = URING_BUF_SIZE;
+    if (c->buf_index >= 0) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = (uint16_t)c->buf_index;
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)c | URING_OP_RECV;
+    c->inflight++;
+    c->recv_pending = true;
+    return true;
+}
+
+// Sends the whole response iovec; MSG_WAITALL makes the kernel retry short sends,
+// so a short result breaks the link and only happens on error. The next
+// read is linked behind it unless one is already outstanding, or the buffer
+// still holds bytes that arrived during the response.
+static bool queue_send(uring_loop_t *loop, uring_conn_t *c) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL)
+        return false;
+
+    http_iovec_t *out = &c->http.out;
+    c->msg = (struct msghdr){.msg_iov = out->iov + out->index,
+                             .msg_iovlen = (size_t)(out->count - out->index)};
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->http.fd;
+    sqe->addr = (uint64_t)(uintptr_t)&c->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = (uint64_t)(uintptr_t)c | URING_OP_SEND;
+    c->inflight++;
+    c->sending = true;
+
+    if (c->recv_pending || c->pending_len > 0 || c->http.should_close)
+        return true;
+    sqe->flags |= IOSQE_IO_LINK;
+    return queue_recv(loop, c);
+}
+
+static bool queue_splice(uring_loop_t *loop, uring_conn_t *c, int fd_in,
+                         int64_t off_in, int fd_out, unsigned len,
+                         unsigned op, bool link) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL)
+        return false;
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = (uint64_t)off_in;
+    sqe->fd = fd_out;
+    sqe->off = (uint64_t)-1;
+    sqe->len = len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    if (link)
+        sqe->flags |= IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t)(uintptr_t)c | op;
+    c->inflight++;
+    c->splices++;
+    return true;
+}
+
+// Moves the next piece of the file body towards the socket. Returns 1 when
+// splices were queued, 0 once the whole body has been sent and -1 on error.
+static int queue_file_chunk(uring_loop_t *loop, uring_conn_t *c) {
+    http_conn_t *h = &c->http;
+    if (c->pipe_bytes > 0)
+        return queue_splice(loop, c, c->pipe_fds[0], -1, h->fd,
+                            (unsigned)c->pipe_bytes, URING_OP_SPLICE_OUT,
+                            false)
+                   ? 1
+                   : -1;
+    if (h->file_remaining == 0)
+        return 0;
+
+    if (c->pipe_fds[0] == -1 && pipe2(c->pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe2 failed");
+        c->pipe_fds[0] = c->pipe_fds[1] = -1;
+        return -1;
+    }
+
+    unsigned len = h->file_remaining < URING_SPLICE_CHUNK
+                       ? (unsigned)h->file_remaining
+                       : URING_SPLICE_CHUNK;
+    // A short splice into the pipe breaks the link and cancels the second
+    // half; the completions pick up from whatever actually moved.
+    if (!queue_splice(loop, c, h->file_fd, h->file_offset, c->pipe_fds[1], len,
+                      URING_OP_SPLICE_IN, true))
+        return -1;
+    if (!queue_splice(loop, c, c->pipe_fds[0], -1, h->fd, len,
+                      URING_OP_SPLICE_OUT, false))
+        return -1;
+    return 1;
+}
+
+static void free_conn(uring_loop_t *loop, uring_conn_t *c) {
+    if (c->buf_index >= 0)
+        loop->free_bufs[loop->free_buf_count++] = c->buf_index;
+    free(c->heap_buf);
+    if (c->pipe_fds[0] != -1) {
+        close(c->pipe_fds[0]);
+        close(c->pipe_fds[1]);
+    }
+    http_conn_destroy(&c->http);
+    free(c);
+}
+
+// Outstanding operations still reference the connection, so it is only
+// freed once the last of them has completed. Shutting the socket down makes
+// a pending read finish right away.
+static void close_conn(uring_loop_t *loop, uring_conn_t *c) {
+    if (!c->closing) {
+        c->closing = true;
+        shutdown(c->http.fd, SHUT_RDWR);
+    }
+    if (c->inflight == 0)
+        free_conn(loop, c);
+}
+
+// Answers every complete request that is buffered, one at a time, then
+// makes sure a read is outstanding.
+static void process_conn(uring_loop_t *loop, uring_conn_t *c) {
+    if (c->sending)
+        return;
+    if (http_conn_request_ready(&c->http)) {
+        http_conn_handle(&c->http);
+        if (!queue_send(loop, c))
+            close_conn(loop, c);
+        return;
+    }
+    if (!c->recv_pending && !queue_recv(loop, c))
+        close_conn(loop, c);
+}
+
+static void on_accept(uring_loop_t *loop, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        if (cqe->res == -EINVAL && loop->multishot_accept) {
+            LOG_WARN("io_uring: multishot accept unsupported, "
+                     "falling back to single-shot");
+            loop->multishot_accept = false;
+        }
+        arm_accept(loop);
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -EINVAL)
+            LOG_ERROR("accept failed: %s", strerror(-cqe->res));
+        return;
+    }
+
+    uring_conn_t *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        LOG_ERROR("out of memory for connection %d", cqe->res);
+        close(cqe->res);
+        return;
+    }
+    c->pipe_fds[0] = c->pipe_fds[1] = -1;
+    c->buf_index = -1;
+    if (!http_conn_init(&c->http, cqe->res)) {
+        free_conn(loop, c);
+        return;
+    }
+
+    if (loop->free_buf_count > 0) {
+        c->buf_index = loop->free_bufs[--loop->free_buf_count];
+    } else {
+        c->heap_buf = malloc(URING_BUF_SIZE);
+        if (c->heap_buf == NULL) {
+            free_conn(loop, c);
+            return;
+        }
+    }
+
+    if (!queue_recv(loop, c))
+        free_conn(loop, c);
+}
+
+static void on_recv(uring_loop_t *loop, uring_conn_t *c, int res) {
+    c->recv_pending = false;
+    if (c->closing) {
+        close_conn(loop, c);
+        return;
+    }
+    if (res == -ECANCELED)
+        return; // linked send failed, its completion closes the connection
+    if (res <= 0) {
+        if (res < 0)
+            LOG_ERROR("read failed: %s", strerror(-res));
+        close_conn(loop, c);
+        return;
+    }
+
+    // The buffer is not re-armed until it has been consumed, so data that
+    // arrives while a response is still going out can wait in place.
+    if (c->sending) {
+        c->pending_len = (size_t)res;
+        return;
+    }
+    if (!http_conn_feed(&c->http, conn_buf(loop, c), (size_t)res)) {
+        close_conn(loop, c);
+        return;
+    }
+    process_conn(loop, c);
+}
+
+static void finish_response(uring_loop_t *loop, uring_conn_t *c);
+
+static void on_send(uring_loop_t *loop, uring_conn_t *c, int res) {
+    c->sending = false;
+    if (c->closing) {
+        close_conn(loop, c);
+        return;
+    }
+    if (res < 0 || (size_t)res != c->http.out.remaining) {
+        if (res < 0)
+            LOG_ERROR("write failed: %s", strerror(-res));
+        close_conn(loop, c);
+        return;
+    }
+
+    int queued = queue_file_chunk(loop, c);
+    if (queued < 0) {
+        close_conn(loop, c);
+        return;
+    }
+    if (queued > 0) {
+        c->sending = true;
+        return;
+    }
+    if (http_conn_stream_next(&c->http)) {
+        if (!queue_send(loop, c))
+            close_conn(loop, c);
+        return;
+    }
+    finish_response(loop, c);
+}
+
+static void on_splice(uring_loop_t *loop, uring_conn_t *c, unsigned op,
+                      int res) {
+    c->splices--;
+    if (c->closing) {
+        close_conn(loop, c);
+        return;
+    }
+    if (res == -ECANCELED && op == URING_OP_SPLICE_OUT) {
+        // cut off by a short splice in; resume below
+    } else if (res <= 0) {
+        if (res < 0)
+            LOG_ERROR("splice failed: %s", strerror(-res));
+        close_conn(loop, c);
+        return;
+    } else if (op == URING_OP_SPLICE_IN) {
+        c->http.file_offset += res;
+        c->http.file_remaining -= (size_t)res;
+        c->pipe_bytes += (size_t)res;
+    } else {
+        c->pipe_bytes -= (size_t)res;
+    }
+
+    if (c->splices > 0)
+        return;
+    int queued = queue_file_chunk(loop, c);
+    if (queued < 0)
+        close_conn(loop, c);
+    else if (queued == 0)
+        finish_response(loop, c);
+}
+
+static void finish_response(uring_loop_t *loop, uring_conn_t *c) {
+    c->sending = false;
+    if (!http_conn_response_done(&c->http)) {
+        close_conn(loop, c);
+        return;
+    }
+    if (c->pending_len > 0) {
+        size_t len = c->pending_len;
+        c->pending_len = 0;
+        if (!http_conn_feed(&c->http, conn_buf(loop, c), len)) {
+            close_conn(loop, c);
+            return;
+        }
+    }
+    process_conn(loop, c);
+}
+
+static void reap_completions(uring_loop_t *loop) {
+    uring_t *r = &loop->ring;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe cqe = r->cqes[head & *r->cq_mask];
+        head++;
+        // Release the slot before handling so handlers queueing new work
+        // never see a full completion ring.
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+        unsigned op = cqe.user_data & URING_OP_MASK;
+        uring_conn_t *c = (uring_conn_t *)(uintptr_t)(cqe.user_data &
+                                                      ~(uint64_t)URING_OP_MASK);
+        if (op == URING_OP_ACCEPT) {
+            on_accept(loop, &cqe);
+            continue;
+        }
+
+        c->inflight--;
+        if (op == URING_OP_RECV)
+            on_recv(loop, c, cqe.res);
+        else if (op == URING_OP_SEND)
+            on_send(loop, c, cqe.res);
+        else
+            on_splice(loop, c, op, cqe.res);
+    }
+}
+
+bool run_loop_uring(int server_fd) {
+    static uring_loop_t loop;
+    loop.server_fd = server_fd;
+    loop.multishot_accept = true;
+
+    if (uring_setup(&loop.ring, URING_ENTRIES) != 0)
+        return false;
+    register_buffers(&loop);
+
+    arm_accept(&loop);
+    while (true) {
+        if (uring_enter(&loop.ring, 1) != 0)
+            return false;
+        reap_completions(&loop);
+    }
+}
+
+#else
+
+bool run_loop_uring(int server_fd) {
+    (void)server_fd;
+    LOG_ERROR("io_uring event loop is only available on Linux");
+    return false;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Single-threaded io_uring loop: multishot accept, reads into registered
+// buffers, and response sends linked to the follow-up read so one
+// io_uring_enter covers both. Talks to the kernel through the raw syscalls,
+// so it needs no liburing. Only available on Linux; returns false elsewhere.
+bool run_loop_uring(int server_fd);
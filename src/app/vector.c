@@ -21,7 +21,8 @@ Vector vector_new(Arena *a, size_t cap, size_t elem_size) {
 static int vector_grow(Arena *a, Vector *v) {
     size_t new_cap = v->cap ? v->cap * 2 : 1;
 
-    byte *new_data = arena_realloc(a, v->data_ptr, new_cap * v->elem_size);
+    byte *new_data = arena_realloc(a, v->data_ptr, v->cap * v->elem_size,
+                                   new_cap * v->elem_size);
     assert(new_data != NULL);
 
     v->data_ptr = new_data;
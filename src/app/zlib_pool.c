@@ -0,0 +1,202 @@
+#include "zlib_pool.h"
+#include "arena.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// windowBits: 15 alone is the zlib wrapper, 15 + 16 gzip, and 15 + 32
+// reads either one.
+#define INFLATE_WINDOW_BITS (15 + 32)
+
+static const int deflate_window_bits[ZLIB_FORMATS] = {
+    [ZLIB_FORMAT_GZIP] = 15 + 16,
+    [ZLIB_FORMAT_ZLIB] = 15,
+};
+
+typedef struct zlib_stream {
+    z_stream strm; // first, so a z_stream * is also a zlib_stream_t *
+    Arena arena;
+    zlib_format_t format; // deflaters only
+    int level;
+    struct zlib_stream *next;
+} zlib_stream_t;
+
+typedef struct {
+    zlib_stream_t *idle; // singly linked
+    size_t count;
+} stream_list_t;
+
+typedef struct {
+    stream_list_t deflaters[ZLIB_FORMATS];
+    stream_list_t inflaters;
+    bool registered;
+} local_streams_t;
+
+static struct {
+    pthread_once_t once;
+    pthread_key_t key;
+    int level;
+    int mem_level;
+    int strategy;
+} pool = {.once = PTHREAD_ONCE_INIT,
+          .level = Z_DEFAULT_COMPRESSION,
+          .mem_level = 8,
+          .strategy = Z_DEFAULT_STRATEGY};
+
+static _Thread_local local_streams_t local;
+
+// zlib allocates all of a stream's state while it is set up, and frees it
+// only when it is ended, so a bump allocator is all it needs.
+static voidpf stream_alloc(voidpf opaque, uInt items, uInt size) {
+    zlib_stream_t *s = opaque;
+    if (size != 0 && items > SIZE_MAX / size)
+        return Z_NULL;
+    return arena_alloc(&s->arena, (size_t)items * size);
+}
+
+static void stream_free(voidpf opaque, voidpf address) {
+    (void)opaque;
+    (void)address;
+}
+
+static void stream_destroy(zlib_stream_t *s, bool deflater) {
+    if (deflater)
+        deflateEnd(&s->strm);
+    else
+        inflateEnd(&s->strm);
+    arena_destroy(&s->arena);
+    free(s);
+}
+
+static void local_flush(void *arg) {
+    local_streams_t *l = arg;
+    for (int f = 0; f < ZLIB_FORMATS; f++) {
+        while (l->deflaters[f].idle) {
+            zlib_stream_t *s = l->deflaters[f].idle;
+            l->deflaters[f].idle = s->next;
+            stream_destroy(s, true);
+        }
+        l->deflaters[f].count = 0;
+    }
+    while (l->inflaters.idle) {
+        zlib_stream_t *s = l->inflaters.idle;
+        l->inflaters.idle = s->next;
+        stream_destroy(s, false);
+    }
+    l->inflaters.count = 0;
+}
+
+static void make_key(void) {
+    if (pthread_key_create(&pool.key, local_flush) != 0)
+        LOG_ERROR("zlib pool: pthread_key_create failed");
+}
+
+static void local_register(void) {
+    if (!local.registered) {
+        pthread_once(&pool.once, make_key);
+        pthread_setspecific(pool.key, &local);
+        local.registered = true;
+    }
+}
+
+void zlib_pool_init(int level, int mem_level, int strategy) {
+    pool.level = level;
+    pool.mem_level = mem_level;
+    pool.strategy = strategy;
+}
+
+static zlib_stream_t *stream_new(size_t arena_size) {
+    zlib_stream_t *s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+    s->arena = arena_new(arena_size);
+    s->strm.zalloc = stream_alloc;
+    s->strm.zfree = stream_free;
+    s->strm.opaque = s;
+    return s;
+}
+
+static zlib_stream_t *list_pop(stream_list_t *list) {
+    zlib_stream_t *s = list->idle;
+    if (s) {
+        list->idle = s->next;
+        list->count--;
+    }
+    return s;
+}
+
+// Keeps the stream for reuse, or reports that the list is full.
+static bool list_push(stream_list_t *list, zlib_stream_t *s) {
+    if (list->count == ZLIB_POOL_LOCAL)
+        return false;
+    local_register();
+    s->next = list->idle;
+    list->idle = s;
+    list->count++;
+    return true;
+}
+
+z_stream *zlib_deflater_get(zlib_format_t format, int level) {
+    if (level == ZLIB_POOL_LEVEL)
+        level = pool.level;
+    zlib_stream_t *s = list_pop(&local.deflaters[format]);
+    // Returned streams were reset; changing the level before any input
+    // is free. A stream that cannot change would quietly keep its old
+    // level, so it makes way for a new one.
+    if (s != NULL && s->level != level) {
+        if (deflateParams(&s->strm, level, pool.strategy) == Z_OK) {
+            s->level = level;
+        } else {
+            stream_destroy(s, true);
+            s = NULL;
+        }
+    }
+    if (s == NULL) {
+        // Window and hash chains, hash heads and pending buffer, state.
+        s = stream_new(((size_t)1 << 17) + ((size_t)1 << (pool.mem_level + 9)) +
+                       (8 << 10));
+        if (s == NULL)
+            return NULL;
+        if (deflateInit2(&s->strm, level, Z_DEFLATED,
+                         deflate_window_bits[format], pool.mem_level,
+                         pool.strategy) != Z_OK) {
+            LOG_ERROR("zlib pool: deflateInit2 failed");
+            arena_destroy(&s->arena);
+            free(s);
+            return NULL;
+        }
+        s->format = format;
+        s->level = level;
+    }
+    return &s->strm;
+}
+
+void zlib_deflater_put(z_stream *strm) {
+    zlib_stream_t *s = (zlib_stream_t *)strm;
+    if (deflateReset(strm) != Z_OK ||
+        !list_push(&local.deflaters[s->format], s))
+        stream_destroy(s, true);
+}
+
+z_stream *zlib_inflater_get(void) {
+    zlib_stream_t *s = list_pop(&local.inflaters);
+    if (s != NULL)
+        return &s->strm;
+    s = stream_new(48 << 10); // window and state
+    if (s == NULL)
+        return NULL;
+    if (inflateInit2(&s->strm, INFLATE_WINDOW_BITS) != Z_OK) {
+        LOG_ERROR("zlib pool: inflateInit2 failed");
+        arena_destroy(&s->arena);
+        free(s);
+        return NULL;
+    }
+    return &s->strm;
+}
+
+void zlib_inflater_put(z_stream *strm) {
+    zlib_stream_t *s = (zlib_stream_t *)strm;
+    if (inflateReset(strm) != Z_OK || !list_push(&local.inflaters, s))
+        stream_destroy(s, false);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <zlib.h>
+
+// Reusable zlib streams. Setting up a deflate stream allocates about 256KB
+// of state, more than compressing a small body costs, so streams are kept
+// per thread and reset between uses instead of ended. A stream's state
+// lives in an arena of its own, allocated once when the stream is made.
+
+#define ZLIB_POOL_LOCAL 4 // idle streams of each kind kept per thread
+
+// Asks zlib_deflater_get() for the configured level.
+#define ZLIB_POOL_LEVEL (-2)
+
+// Wrapper around the deflate data: gzip, or zlib's own (HTTP's "deflate").
+typedef enum {
+    ZLIB_FORMAT_GZIP,
+    ZLIB_FORMAT_ZLIB,
+    ZLIB_FORMATS,
+} zlib_format_t;
+
+// Compression settings of the deflaters; level as for deflateInit2 (or
+// Z_DEFAULT_COMPRESSION), mem_level 1..9, strategy Z_DEFAULT_STRATEGY,
+// Z_FILTERED, ... Call before any thread uses the pool; without it zlib's
+// defaults apply.
+void zlib_pool_init(int level, int mem_level, int strategy);
+
+// A deflate stream writing format, reset and set to level. NULL when out
+// of memory.
+z_stream *zlib_deflater_get(zlib_format_t format, int level);
+void zlib_deflater_put(z_stream *strm);
+
+// A reset inflate stream that takes gzip or zlib input.
+z_stream *zlib_inflater_get(void);
+void zlib_inflater_put(z_stream *strm);
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,17 +11,245 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "app/arena_pool.h"
+#include "app/codec.h"
+#include "app/event_loop.h"
+#include "app/file_cache.h"
 #include "app/http.h"
 #include "app/log.h"
+#include "app/thread_pool.h"
+#include "app/uring_loop.h"
 #include "app/types.h"
+#include "app/zlib_pool.h"
 
 #define BUF_SIZE 1024
 
-bool serve(int port);
+typedef enum {
+    LOOP_THREADED,
+    LOOP_EPOLL,
+    LOOP_POOL,
+    LOOP_REUSEPORT,
+    LOOP_URING,
+} loop_kind_t;
+
+typedef struct {
+    int port;
+    loop_kind_t loop;
+    size_t workers;
+    size_t queue_cap;
+    pool_full_policy_t on_full;
+    size_t shards;
+    size_t file_cache_mb;
+    size_t max_body_mb;
+    size_t arena_pool;
+    bool arena_trim;
+    bool precompress;
+    int gzip_level;
+    int gzip_mem_level;
+    int gzip_strategy;
+    int zstd_level;
+    size_t compress_min_size;
+} server_config_t;
+
+bool serve(const server_config_t *config);
+
+static bool parse_loop_kind(const char *name, loop_kind_t *out) {
+    if (strcmp(name, "threaded") == 0) {
+        *out = LOOP_THREADED;
+        return true;
+    }
+    if (strcmp(name, "epoll") == 0) {
+        *out = LOOP_EPOLL;
+        return true;
+    }
+    if (strcmp(name, "pool") == 0) {
+        *out = LOOP_POOL;
+        return true;
+    }
+    if (strcmp(name, "reuseport") == 0) {
+        *out = LOOP_REUSEPORT;
+        return true;
+    }
+    if (strcmp(name, "uring") == 0) {
+        *out = LOOP_URING;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_int_range(const char *s, int min, int max, int *out) {
+    char *end = NULL;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v < min || v > max)
+        return false;
+    *out = (int)v;
+    return true;
+}
+
+static bool parse_gzip_strategy(const char *name, int *out) {
+    if (strcmp(name, "default") == 0) {
+        *out = Z_DEFAULT_STRATEGY;
+    } else if (strcmp(name, "filtered") == 0) {
+        *out = Z_FILTERED;
+    } else if (strcmp(name, "huffman") == 0) {
+        *out = Z_HUFFMAN_ONLY;
+    } else if (strcmp(name, "rle") == 0) {
+        *out = Z_RLE;
+    } else if (strcmp(name, "fixed") == 0) {
+        *out = Z_FIXED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// A plain decimal count, 0 included.
+static bool parse_count(const char *s, size_t *out) {
+    char *end = NULL;
+    if (*s < '0' || *s > '9') // strtoul would take " 1" and "-1"
+        return false;
+    unsigned long v = strtoul(s, &end, 10);
+    if (*end != '\0')
+        return false;
+    *out = (size_t)v;
+    return true;
+}
 
-int main(void) {
+static bool parse_size(const char *s, size_t *out) {
+    size_t v;
+    if (!parse_count(s, &v) || v == 0)
+        return false;
+    *out = v;
+    return true;
+}
 
-    if (!serve(4221)) {
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    server_config_t config = {.port = 4221,
+                              .loop = LOOP_THREADED,
+                              .workers = cpus > 0 ? (size_t)cpus * 4 : 4,
+                              .queue_cap = 1024,
+                              .on_full = POOL_FULL_BLOCK,
+                              .shards = cpus > 0 ? (size_t)cpus : 1,
+                              .file_cache_mb = 64,
+                              .max_body_mb = 1024,
+                              .arena_pool = 64,
+                              .arena_trim = true,
+                              .precompress = false,
+                              .gzip_level = Z_DEFAULT_COMPRESSION,
+                              .gzip_mem_level = 8,
+                              .gzip_strategy = Z_DEFAULT_STRATEGY,
+                              .zstd_level = 3,
+                              .compress_min_size = 0};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+            if (!parse_loop_kind(argv[++i], &config.loop)) {
+                LOG_ERROR("unknown loop '%s' (expected "
+                          "threaded|epoll|pool|reuseport|uring)",
+                          argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[++i], &config.workers)) {
+                LOG_ERROR("invalid --workers '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[++i], &config.queue_cap)) {
+                LOG_ERROR("invalid --queue '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[++i], &config.shards)) {
+                LOG_ERROR("invalid --shards '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--file-cache-mb") == 0 && i + 1 < argc) {
+            // 0 turns the cache off
+            if (!parse_count(argv[++i], &config.file_cache_mb)) {
+                LOG_ERROR("invalid --file-cache-mb '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--max-body-mb") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[++i], &config.max_body_mb)) {
+                LOG_ERROR("invalid --max-body-mb '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--arena-pool") == 0 && i + 1 < argc) {
+            // 0 turns the pool off
+            if (!parse_count(argv[++i], &config.arena_pool)) {
+                LOG_ERROR("invalid --arena-pool '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--no-arena-trim") == 0) {
+            config.arena_trim = false;
+        } else if (strcmp(argv[i], "--precompress") == 0) {
+            config.precompress = true;
+        } else if (strcmp(argv[i], "--gzip-level") == 0 && i + 1 < argc) {
+            if (!parse_int_range(argv[++i], 0, 9, &config.gzip_level)) {
+                LOG_ERROR("invalid --gzip-level '%s' (expected 0..9)", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--gzip-mem-level") == 0 && i + 1 < argc) {
+            if (!parse_int_range(argv[++i], 1, 9, &config.gzip_mem_level)) {
+                LOG_ERROR("invalid --gzip-mem-level '%s' (expected 1..9)",
+                          argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--gzip-strategy") == 0 && i + 1 < argc) {
+            if (!parse_gzip_strategy(argv[++i], &config.gzip_strategy)) {
+                LOG_ERROR("unknown --gzip-strategy '%s' (expected "
+                          "default|filtered|huffman|rle|fixed)",
+                          argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--zstd-level") == 0 && i + 1 < argc) {
+            if (!parse_int_range(argv[++i], 1, 19, &config.zstd_level)) {
+                LOG_ERROR("invalid --zstd-level '%s' (expected 1..19)",
+                          argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--compress-min-size") == 0 &&
+                   i + 1 < argc) {
+            // Smaller bodies are sent uncompressed; 0 compresses everything
+            if (!parse_count(argv[++i], &config.compress_min_size)) {
+                LOG_ERROR("invalid --compress-min-size '%s'", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--on-full") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            if (strcmp(policy, "block") == 0) {
+                config.on_full = POOL_FULL_BLOCK;
+            } else if (strcmp(policy, "reject") == 0) {
+                config.on_full = POOL_FULL_REJECT;
+            } else {
+                LOG_ERROR("unknown --on-full '%s' (expected block|reject)",
+                          policy);
+                return -1;
+            }
+        }
+    }
+
+    // Clients that hang up halfway through a large body must not take the
+    // whole server down with SIGPIPE; the write just fails with EPIPE.
+    signal(SIGPIPE, SIG_IGN);
+
+    file_cache_init(config.file_cache_mb << 20);
+    http_set_max_body_size(config.max_body_mb << 20);
+    arena_pool_init(HTTP_CONN_ARENA_SIZE, config.arena_pool, config.arena_trim);
+    zlib_pool_init(config.gzip_level, config.gzip_mem_level,
+                   config.gzip_strategy);
+    codec_set_zstd_level(config.zstd_level);
+    http_set_compress_min_size(config.compress_min_size);
+    if (!http_routes_init()) {
+        LOG_ERROR("registering routes failed");
+        return -1;
+    }
+    if (config.precompress)
+        http_precompress_files();
+
+    if (!serve(&config)) {
         perror("serve failed");
         return -1;
     }
@@ -29,6 +258,7 @@ int main(void) {
 }
 
 bool set_socketREUSEADDR(int fd);
+bool set_socketREUSEPORT(int fd);
 bool set_nonblocking(int fd);
 bool run_loop_with_select(int server_fd, void *(*handle_client)(void *arg));
 bool run_loop_threaded(int server_fd, void *(*handle_client)(void *arg));
@@ -64,13 +294,14 @@ void *echo_connection(void *arg) {
     return NULL;
 }
 
-bool serve(int port) {
-    int server_fd;
-
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+// Creates a bound, listening TCP socket on port. With reuseport set, several
+// sockets can bind the same port and the kernel spreads new connections
+// across them. Returns -1 on failure.
+int open_listener(int port, bool reuseport) {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd == -1) {
         perror("socket failed");
-        exit(EXIT_FAILURE);
+        return -1;
     }
     // if (set_nonblocking(server_fd) != true) {
     //     perror("set_nonblocking failed");
@@ -79,7 +310,13 @@ bool serve(int port) {
 
     if (set_socketREUSEADDR(server_fd) != true) {
         perror("set_socketREUSEADDR failed");
-        return false;
+        close(server_fd);
+        return -1;
+    }
+
+    if (reuseport && set_socketREUSEPORT(server_fd) != true) {
+        close(server_fd);
+        return -1;
     }
 
     struct sockaddr_in server_addr = {.sin_family = AF_INET,
@@ -89,19 +326,119 @@ bool serve(int port) {
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) !=
         0) {
         perror("bind failed");
-        return false;
+        close(server_fd);
+        return -1;
     }
 
-    if (listen(server_fd, 10) == -1) {
+    if (listen(server_fd, SOMAXCONN) == -1) {
         perror("listen failed");
+        close(server_fd);
+        return -1;
+    }
+
+    return server_fd;
+}
+
+static void *shard_main(void *arg) {
+    int server_fd = (int)(intptr_t)arg;
+    if (run_loop_epoll(server_fd) != true)
+        LOG_ERROR("shard on listener %d stopped", server_fd);
+    close(server_fd);
+    return NULL;
+}
+
+// One SO_REUSEPORT listener and one epoll loop per shard. The kernel
+// balances new connections across the listeners and every connection stays
+// on the thread that accepted it.
+bool run_reuseport_shards(int port, size_t shards) {
+    int *listeners = malloc(shards * sizeof(*listeners));
+    pthread_t *threads = malloc(shards * sizeof(*threads));
+    if (listeners == NULL || threads == NULL) {
+        free(listeners);
+        free(threads);
         return false;
     }
 
-    LOG_INFO("Listening for connections on port %d :)", port);
+    // Bind every listener up front so a bind failure is reported before any
+    // shard starts serving.
+    for (size_t i = 0; i < shards; i++) {
+        listeners[i] = open_listener(port, true);
+        if (listeners[i] == -1) {
+            for (size_t j = 0; j < i; j++)
+                close(listeners[j]);
+            free(listeners);
+            free(threads);
+            return false;
+        }
+    }
+
+    LOG_INFO("Listening for connections on port %d with %zu shards :)", port,
+             shards);
+
+    // threads[] is kept dense: a shard that fails to start leaves no slot
+    // behind for the join below.
+    size_t started = 0;
+    for (size_t i = 0; i < shards; i++) {
+        if (pthread_create(&threads[started], NULL, shard_main,
+                           (void *)(intptr_t)listeners[i]) != 0) {
+            perror("pthread_create failed");
+            close(listeners[i]);
+            continue;
+        }
+        started++;
+    }
+
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(listeners);
+    free(threads);
+    return started == shards;
+}
+
+bool serve(const server_config_t *config) {
+    int port = config->port;
+
+    if (config->loop == LOOP_REUSEPORT)
+        return run_reuseport_shards(port, config->shards);
 
-    if (run_loop_threaded(server_fd, handle_http_connection) != true) {
-        perror("run_loop_threaded failed");
+    int server_fd = open_listener(port, false);
+    if (server_fd == -1)
         return false;
+
+    LOG_INFO("Listening for connections on port %d :)", port);
+
+    switch (config->loop) {
+    case LOOP_EPOLL:
+        LOG_INFO("Using epoll event loop");
+        if (run_loop_epoll(server_fd) != true) {
+            perror("run_loop_epoll failed");
+            return false;
+        }
+        break;
+    case LOOP_URING:
+        LOG_INFO("Using io_uring event loop");
+        if (run_loop_uring(server_fd) != true) {
+            perror("run_loop_uring failed");
+            return false;
+        }
+        break;
+    case LOOP_POOL:
+        if (run_loop_pool(server_fd, config->workers, config->queue_cap,
+                          config->on_full) != true) {
+            perror("run_loop_pool failed");
+            return false;
+        }
+        break;
+    case LOOP_REUSEPORT:
+        // handled before the shared listener is opened
+        break;
+    case LOOP_THREADED:
+        if (run_loop_threaded(server_fd, handle_http_connection) != true) {
+            perror("run_loop_threaded failed");
+            return false;
+        }
+        break;
     }
 
     return true;
@@ -206,6 +543,21 @@ bool set_socketREUSEADDR(int fd) {
     return true;
 }
 
+bool set_socketREUSEPORT(int fd) {
+#ifdef SO_REUSEPORT
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT failed");
+        return false;
+    }
+    return true;
+#else
+    (void)fd;
+    LOG_ERROR("SO_REUSEPORT is not supported on this platform");
+    return false;
+#endif
+}
+
 bool set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags == -1) {
@@ -0,0 +1,207 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app/arena.h"
+#include "app/arena_pool.h"
+#include "app/str.h"
+
+void test_arena_grows(void) {
+  Arena a = arena_new(64);
+  Arena_Chunk *first = a.chunk;
+
+  // Far more than the first chunk holds, including one allocation larger
+  // than a whole chunk.
+  byte *small[100];
+  for (int i = 0; i < 100; i++) {
+    small[i] = arena_alloc_align(&a, 10, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(small[i]);
+    memset(small[i], i, 10);
+  }
+  byte *big = arena_alloc(&a, 1000);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(big);
+  memset(big, 0xee, 1000);
+  for (int i = 0; i < 100; i++)
+    CU_ASSERT_EQUAL(small[i][9], i);
+
+  arena_rest(&a);
+  CU_ASSERT_PTR_EQUAL(a.chunk, first);
+  CU_ASSERT_PTR_NULL(a.chunk->prev);
+  CU_ASSERT_EQUAL(a.offset, 0);
+  arena_destroy(&a);
+}
+
+void test_arena_align(void) {
+  Arena a = arena_new(256);
+  for (size_t align = 1; align <= 64; align *= 2) {
+    arena_alloc_align(&a, 3, 1);
+    void *p = arena_alloc_align(&a, 5, align);
+    CU_ASSERT_EQUAL((uintptr_t)p % align, 0);
+  }
+  CU_ASSERT_EQUAL((uintptr_t)arena_alloc(&a, 1) % _Alignof(max_align_t), 0);
+  arena_destroy(&a);
+}
+
+void test_arena_realloc(void) {
+  Arena a = arena_new(128);
+
+  // The last allocation grows in place while the chunk has room.
+  byte *p = arena_alloc_align(&a, 16, 1);
+  memset(p, 'a', 16);
+  CU_ASSERT_PTR_EQUAL(arena_realloc_align(&a, p, 16, 64, 1), p);
+  CU_ASSERT_EQUAL(a.offset, 64);
+  CU_ASSERT_PTR_EQUAL(arena_realloc_align(&a, p, 64, 32, 1), p);
+  CU_ASSERT_EQUAL(a.offset, 32);
+
+  // Once it is not the last one, it is copied.
+  byte *q = arena_alloc_align(&a, 8, 1);
+  byte *moved = arena_realloc_align(&a, p, 32, 48, 1);
+  CU_ASSERT_PTR_NOT_EQUAL(moved, p);
+  CU_ASSERT_EQUAL(memcmp(moved, p, 32), 0);
+  CU_ASSERT_PTR_EQUAL(arena_realloc_align(&a, q, 8, 4, 1), q);
+
+  // Growing past the end of the chunk moves it into a new one.
+  byte *r = arena_realloc_align(&a, moved, 48, 4096, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  CU_ASSERT_EQUAL(memcmp(r, p, 16), 0);
+
+  CU_ASSERT_PTR_NOT_NULL(arena_realloc_align(&a, NULL, 0, 10, 1));
+  arena_destroy(&a);
+}
+
+void test_arena_str_buffer(void) {
+  Arena a = arena_new(32);
+  str_buffer_t b = str_buffer_new(&a, 4);
+  byte *other = arena_alloc_align(&a, 4, 1);
+  memcpy(other, "xyzw", 4);
+  for (int i = 0; i < 1000; i++)
+    str_buffer_append_char(&a, &b, (char)('a' + i % 26));
+  str_t s = str_buffer_to_str(b);
+  CU_ASSERT_EQUAL_FATAL(s.len, 1000);
+  for (int i = 0; i < 1000; i++)
+    CU_ASSERT_EQUAL(s.data[i], 'a' + i % 26);
+  CU_ASSERT_EQUAL(memcmp(other, "xyzw", 4), 0);
+  arena_destroy(&a);
+}
+
+void test_arena_save_restore(void) {
+  Arena a = arena_new(256);
+  byte *keep = arena_alloc_align(&a, 16, 1);
+  memset(keep, 'k', 16);
+
+  Arena_Mark mark = arena_save(&a);
+  size_t offset = a.offset;
+  for (int i = 0; i < 10; i++)
+    arena_alloc(&a, 200); // chains several chunks
+  CU_ASSERT_PTR_NOT_EQUAL(a.chunk, mark.chunk);
+  arena_restore(&a, mark);
+  CU_ASSERT_PTR_EQUAL(a.chunk, mark.chunk);
+  CU_ASSERT_EQUAL(a.offset, offset);
+  CU_ASSERT_EQUAL(a.peak, SIZE_MAX);
+
+  // The allocation before the mark no longer grows in place.
+  byte *grown = arena_realloc_align(&a, keep, 16, 32, 1);
+  CU_ASSERT_PTR_NOT_EQUAL(grown, keep);
+  CU_ASSERT_EQUAL(grown[15], 'k');
+  arena_destroy(&a);
+}
+
+void test_arena_restore_keeps_older(void) {
+  Arena a = arena_new(256);
+  byte *keep = arena_alloc_align(&a, 16, 1);
+  memset(keep, 'k', 16);
+
+  // Growing it past the mark copies instead, so restoring cannot cut it
+  // short and the next allocation lands after it.
+  Arena_Mark mark = arena_save(&a);
+  byte *grown = arena_realloc_align(&a, keep, 16, 64, 1);
+  CU_ASSERT_PTR_NOT_EQUAL(grown, keep);
+  arena_restore(&a, mark);
+  byte *next = arena_alloc_align(&a, 16, 1);
+  memset(next, 'n', 16);
+  CU_ASSERT_TRUE(next >= keep + 16);
+  CU_ASSERT_EQUAL(keep[15], 'k');
+  arena_destroy(&a);
+}
+
+void test_arena_scratch(void) {
+  Arena a = arena_new(256);
+  Arena *s1 = arena_scratch(&a);
+  Arena *s2 = arena_scratch(s1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s1->chunk);
+  CU_ASSERT_PTR_NOT_EQUAL(s1, s2);
+  CU_ASSERT_PTR_EQUAL(arena_scratch(s2), s1);
+
+  Arena_Chunk *first = s1->chunk;
+  Arena_Mark mark = arena_save(s1);
+  arena_alloc(s1, 2 * ARENA_SCRATCH_SIZE);
+  arena_restore(s1, mark);
+  CU_ASSERT_PTR_EQUAL(s1->chunk, first);
+  CU_ASSERT_EQUAL(s1->offset, mark.offset);
+  arena_destroy(&a);
+}
+
+void test_arena_pool(void) {
+  arena_pool_init(1 << 20, 2, true);
+
+  Arena a = arena_pool_get(1 << 20);
+  Arena_Chunk *chunk = a.chunk;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(chunk);
+  // Use past the warm prefix, and overflow into a second chunk.
+  memset(arena_alloc(&a, 900 << 10), 1, 900 << 10);
+  arena_alloc(&a, 900 << 10);
+  arena_pool_put(&a);
+  CU_ASSERT_PTR_NULL(a.chunk);
+
+  // The same first chunk comes back, reset and with the rest freed.
+  Arena b = arena_pool_get(1 << 20);
+  CU_ASSERT_PTR_EQUAL(b.chunk, chunk);
+  CU_ASSERT_PTR_NULL(b.chunk->prev);
+  CU_ASSERT_EQUAL(b.offset, 0);
+  CU_ASSERT_TRUE(b.peak <= ARENA_POOL_WARM);
+  memset(arena_alloc(&b, 1 << 19), 2, 1 << 19);
+
+  // Other sizes are not pooled.
+  Arena c = arena_pool_get(4096);
+  CU_ASSERT_PTR_NOT_EQUAL(c.chunk, chunk);
+  arena_pool_put(&c);
+  CU_ASSERT_PTR_NULL(c.chunk);
+  arena_pool_put(&b);
+}
+
+int main() {
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("Arena", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "arena_grows", test_arena_grows) ||
+      NULL == CU_add_test(suite, "arena_align", test_arena_align) ||
+      NULL == CU_add_test(suite, "arena_realloc", test_arena_realloc) ||
+      NULL == CU_add_test(suite, "arena_str_buffer", test_arena_str_buffer) ||
+      NULL == CU_add_test(suite, "arena_save_restore", test_arena_save_restore) ||
+      NULL == CU_add_test(suite, "arena_restore_keeps_older",
+                          test_arena_restore_keeps_older) ||
+      NULL == CU_add_test(suite, "arena_scratch", test_arena_scratch) ||
+      NULL == CU_add_test(suite, "arena_pool", test_arena_pool)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
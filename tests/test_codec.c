@@ -0,0 +1,205 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "app/arena.h"
+#include "app/codec.h"
+#include "app/encode_stream.h"
+#include "app/str.h"
+
+#define BODY_LEN (100 << 10)
+#define STEP_OUT 100 // output room per step() call
+#define STEP_IN 777  // input per step() call
+
+static byte body[BODY_LEN];
+static byte decoded[BODY_LEN + 1];
+
+static const codec_t *codecs[CODEC_COUNT];
+static size_t codec_count;
+
+static void fill_body(void) {
+  unsigned seed = 3;
+  for (size_t i = 0; i < BODY_LEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    body[i] = "codec round trip\n"[(seed >> 16) % 17];
+  }
+  for (codec_id_t id = 0; id < CODEC_COUNT; id++)
+    if (codec_get(id) != NULL)
+      codecs[codec_count++] = codec_get(id);
+}
+
+// Decodes data in codec's format whole into decoded. -1 unless it is
+// exactly one complete stream.
+static ssize_t decode(const codec_t *codec, const byte *data, size_t len) {
+#ifdef HAVE_ZSTD
+  if (codec->id == CODEC_ZSTD) {
+    size_t n = ZSTD_decompress(decoded, sizeof(decoded), data, len);
+    return ZSTD_isError(n) ? -1 : (ssize_t)n;
+  }
+#endif
+  z_stream strm = {0};
+  // 15 + 16 takes gzip only, 15 zlib only.
+  if (inflateInit2(&strm, codec->id == CODEC_GZIP ? 15 + 16 : 15) != Z_OK)
+    return -1;
+  strm.next_in = (Bytef *)data;
+  strm.avail_in = len;
+  strm.next_out = (Bytef *)decoded;
+  strm.avail_out = sizeof(decoded);
+  int ret = inflate(&strm, Z_FINISH);
+  ssize_t n = ret == Z_STREAM_END && strm.avail_in == 0
+                  ? (ssize_t)strm.total_out
+                  : -1;
+  inflateEnd(&strm);
+  return n;
+}
+
+static bool decodes_to_body(const codec_t *codec, const byte *data,
+                            size_t len, size_t body_len) {
+  return decode(codec, data, len) == (ssize_t)body_len &&
+         memcmp(decoded, body, body_len) == 0;
+}
+
+void test_codec_get(void) {
+  CU_ASSERT_PTR_NULL(codec_get(CODEC_IDENTITY));
+  CU_ASSERT_PTR_NULL(codec_get(CODEC_COUNT));
+  CU_ASSERT_STRING_EQUAL(codec_get(CODEC_GZIP)->name.data, "gzip");
+  CU_ASSERT_STRING_EQUAL(codec_get(CODEC_DEFLATE)->name.data, "deflate");
+#ifdef HAVE_ZSTD
+  CU_ASSERT_PTR_NOT_NULL_FATAL(codec_get(CODEC_ZSTD));
+  CU_ASSERT_STRING_EQUAL(codec_get(CODEC_ZSTD)->name.data, "zstd");
+#else
+  CU_ASSERT_PTR_NULL(codec_get(CODEC_ZSTD));
+#endif
+  for (size_t i = 0; i < codec_count; i++)
+    CU_ASSERT_EQUAL(codecs[i]->name.len, strlen(codecs[i]->name.data));
+}
+
+void test_codec_compress(void) {
+  size_t lens[] = {0, 1, 100, BODY_LEN};
+  for (size_t i = 0; i < codec_count; i++) {
+    for (size_t j = 0; j < sizeof(lens) / sizeof(lens[0]); j++) {
+      Arena a = arena_new(1 << 12);
+      str_t out =
+          codec_compress(&a, codecs[i], (str_t){.data = body, .len = lens[j]});
+      CU_ASSERT_FATAL(out.len > 0);
+      CU_ASSERT(out.len <= codecs[i]->bound(lens[j]));
+      CU_ASSERT_TRUE(decodes_to_body(codecs[i], out.data, out.len, lens[j]));
+      arena_destroy(&a);
+    }
+  }
+}
+
+// Drives begin/step/end by hand with little input and output room at a
+// time, and an unknown size, as a streamed body of unknown length would.
+void test_codec_small_steps(void) {
+  size_t cap = BODY_LEN + 1024;
+  byte *out = malloc(cap);
+  for (size_t i = 0; i < codec_count; i++) {
+    codec_stream_t *s =
+        codecs[i]->begin(CODEC_LEVEL_CONFIGURED, CODEC_SIZE_UNKNOWN);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+    size_t in_pos = 0, out_len = 0;
+    codec_status_t status = CODEC_MORE;
+    codec_io_t io = {0};
+    while (status == CODEC_MORE && out_len + STEP_OUT <= cap) {
+      if (io.in_len == 0 && in_pos < BODY_LEN) {
+        io.in = body + in_pos;
+        io.in_len = BODY_LEN - in_pos < STEP_IN ? BODY_LEN - in_pos : STEP_IN;
+        in_pos += io.in_len;
+      }
+      io.out = out + out_len;
+      io.out_len = STEP_OUT;
+      status = codecs[i]->step(s, &io, in_pos == BODY_LEN);
+      out_len += STEP_OUT - io.out_len;
+    }
+    codecs[i]->end(s);
+    CU_ASSERT_EQUAL(status, CODEC_DONE);
+    CU_ASSERT_TRUE(decodes_to_body(codecs[i], out, out_len, BODY_LEN));
+  }
+  free(out);
+}
+
+// A stream given back unfinished must not leak into the next one.
+void test_codec_end_unfinished(void) {
+  byte out[STEP_OUT];
+  for (size_t i = 0; i < codec_count; i++) {
+    codec_stream_t *s = codecs[i]->begin(CODEC_LEVEL_BEST, BODY_LEN);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+    codec_io_t io = {.in = body, .in_len = BODY_LEN / 2, .out = out,
+                     .out_len = sizeof(out)};
+    CU_ASSERT_EQUAL(codecs[i]->step(s, &io, false), CODEC_MORE);
+    codecs[i]->end(s);
+
+    Arena a = arena_new(1 << 12);
+    str_t again =
+        codec_compress(&a, codecs[i], (str_t){.data = body, .len = 100});
+    CU_ASSERT_TRUE(decodes_to_body(codecs[i], again.data, again.len, 100));
+    arena_destroy(&a);
+  }
+}
+
+void test_encode_file(void) {
+  char path[] = "/tmp/test_codec.XXXXXX";
+  int fd = mkstemp(path);
+  CU_ASSERT_FATAL(fd != -1);
+  unlink(path);
+  CU_ASSERT_FATAL(write(fd, body, BODY_LEN) == BODY_LEN);
+
+  // The whole file, and only the first part of it.
+  size_t sizes[] = {BODY_LEN, BODY_LEN / 3, 0};
+  for (size_t i = 0; i < codec_count; i++) {
+    for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+      size_t len = 0;
+      byte *data = encode_file(codecs[i], fd, sizes[j], &len);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+      CU_ASSERT_TRUE(decodes_to_body(codecs[i], data, len, sizes[j]));
+      free(data);
+    }
+  }
+  // A file shorter than claimed is an error, not a short variant.
+  size_t len = 0;
+  CU_ASSERT_PTR_NULL(
+      encode_file(codec_get(CODEC_GZIP), fd, BODY_LEN + 1, &len));
+  close(fd);
+}
+
+int main() {
+  fill_body();
+
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("Codec", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "codec_get", test_codec_get) ||
+      NULL == CU_add_test(suite, "codec_compress", test_codec_compress) ||
+      NULL == CU_add_test(suite, "codec_small_steps",
+                          test_codec_small_steps) ||
+      NULL == CU_add_test(suite, "codec_end_unfinished",
+                          test_codec_end_unfinished) ||
+      NULL == CU_add_test(suite, "encode_file", test_encode_file)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
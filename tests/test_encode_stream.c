@@ -0,0 +1,258 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "app/arena.h"
+#include "app/codec.h"
+#include "app/encode_stream.h"
+#include "app/http.h"
+#include "app/str.h"
+
+#define BODY_LEN (5 * ENCODE_STREAM_IN + 123) // several input windows
+#define DRAIN_CAP 4096 // smaller than a window, as a socket write would be
+#define INNER_PIECE 1000
+
+static byte body[BODY_LEN];
+
+// Compressible but not trivially so: words drawn from a small set.
+static void fill_body(void) {
+  static const char *words[] = {"GET ", "/files/", "index", ".html ", "200 ",
+                                "OK\r\n", "gzip", ", ", "zstd", "\n"};
+  unsigned seed = 1;
+  size_t i = 0;
+  while (i < BODY_LEN) {
+    seed = seed * 1103515245 + 12345;
+    const char *w = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+    for (size_t j = 0; w[j] != '\0' && i < BODY_LEN; j++)
+      body[i++] = w[j];
+  }
+}
+
+// Decodes data in codec's format whole. -1 unless it is exactly one
+// complete stream.
+static ssize_t decode(const codec_t *codec, str_t in, byte *out, size_t cap) {
+#ifdef HAVE_ZSTD
+  if (codec->id == CODEC_ZSTD) {
+    size_t n = ZSTD_decompress(out, cap, in.data, in.len);
+    return ZSTD_isError(n) ? -1 : (ssize_t)n;
+  }
+#endif
+  z_stream strm = {0};
+  // 15 + 16 takes gzip only, 15 zlib only.
+  if (inflateInit2(&strm, codec->id == CODEC_GZIP ? 15 + 16 : 15) != Z_OK)
+    return -1;
+  strm.next_in = (Bytef *)in.data;
+  strm.avail_in = in.len;
+  strm.next_out = (Bytef *)out;
+  strm.avail_out = cap;
+  int ret = inflate(&strm, Z_FINISH);
+  ssize_t len = ret == Z_STREAM_END && strm.avail_in == 0
+                    ? (ssize_t)strm.total_out
+                    : -1;
+  inflateEnd(&strm);
+  return len;
+}
+
+static http_response_t response_with_body(str_t b) {
+  return (http_response_t){.content_length = b.len, .body = b, .body_fd = -1};
+}
+
+// Pulls the encoded body out of the response the way a connection would,
+// then closes the source. False if a read failed.
+static bool drain(Arena *a, http_response_t *response, str_t *out) {
+  size_t cap = DRAIN_CAP;
+  byte *buf = arena_alloc_align(a, cap, 1);
+  size_t len = 0;
+  bool ok = true;
+  while (true) {
+    if (cap - len < DRAIN_CAP) {
+      buf = arena_realloc_align(a, buf, cap, cap * 2, 1);
+      cap *= 2;
+    }
+    ssize_t n = response->body_source.read(response->body_source.ctx,
+                                           buf + len, DRAIN_CAP);
+    if (n <= 0) {
+      ok = n == 0;
+      break;
+    }
+    len += (size_t)n;
+  }
+  response->body_source.close(response->body_source.ctx);
+  *out = (str_t){.data = buf, .len = len};
+  return ok;
+}
+
+// Checks that encoded is body[0..len) in codec's format.
+static void assert_encoded(const codec_t *codec, str_t encoded, size_t len) {
+  byte *out = malloc(BODY_LEN + 1);
+  ssize_t n = decode(codec, encoded, out, BODY_LEN + 1);
+  CU_ASSERT_EQUAL(n, (ssize_t)len);
+  CU_ASSERT(n == (ssize_t)len && memcmp(out, body, len) == 0);
+  free(out);
+}
+
+// A temp file holding body, opened for reading; it is unlinked at once.
+static int body_file(void) {
+  char path[] = "/tmp/test_encode_stream.XXXXXX";
+  int fd = mkstemp(path);
+  CU_ASSERT_FATAL(fd != -1);
+  unlink(path);
+  CU_ASSERT_FATAL(write(fd, body, BODY_LEN) == BODY_LEN);
+  return fd;
+}
+
+typedef struct {
+  size_t pos;
+  int closes;
+} inner_source_t;
+
+static ssize_t inner_read(void *ctx, byte *buf, size_t cap) {
+  inner_source_t *src = ctx;
+  size_t n = BODY_LEN - src->pos;
+  if (n > INNER_PIECE)
+    n = INNER_PIECE;
+  if (n > cap)
+    n = cap;
+  memcpy(buf, body + src->pos, n);
+  src->pos += n;
+  return (ssize_t)n;
+}
+
+static void inner_close(void *ctx) { ((inner_source_t *)ctx)->closes++; }
+
+// Every coding this build has; zstd only with HAVE_ZSTD.
+static const codec_t *codecs[CODEC_COUNT];
+static size_t codec_count;
+
+static void find_codecs(void) {
+  for (codec_id_t id = 0; id < CODEC_COUNT; id++)
+    if (codec_get(id) != NULL)
+      codecs[codec_count++] = codec_get(id);
+}
+
+void test_encode_stream_memory(void) {
+  for (size_t i = 0; i < codec_count; i++) {
+    Arena a = arena_new(1 << 12);
+    http_response_t response =
+        response_with_body((str_t){.data = body, .len = BODY_LEN});
+    CU_ASSERT_TRUE_FATAL(encode_stream_response(&a, &response, codecs[i]));
+    CU_ASSERT_EQUAL(response.content_length, -1);
+    CU_ASSERT_EQUAL(response.body.len, 0);
+
+    str_t encoded;
+    CU_ASSERT_TRUE(drain(&a, &response, &encoded));
+    CU_ASSERT(encoded.len < BODY_LEN);
+    assert_encoded(codecs[i], encoded, BODY_LEN);
+    arena_destroy(&a);
+  }
+}
+
+void test_encode_stream_empty(void) {
+  for (size_t i = 0; i < codec_count; i++) {
+    Arena a = arena_new(1 << 12);
+    http_response_t response = response_with_body((str_t){0});
+    CU_ASSERT_TRUE_FATAL(encode_stream_response(&a, &response, codecs[i]));
+    str_t encoded;
+    CU_ASSERT_TRUE(drain(&a, &response, &encoded));
+    assert_encoded(codecs[i], encoded, 0);
+    arena_destroy(&a);
+  }
+}
+
+void test_encode_stream_fd(void) {
+  for (size_t i = 0; i < codec_count; i++) {
+    Arena a = arena_new(1 << 12);
+    int fd = body_file();
+    http_response_t response = response_with_body((str_t){0});
+    response.body_fd = fd;
+    response.body_fd_len = BODY_LEN;
+    CU_ASSERT_TRUE_FATAL(encode_stream_response(&a, &response, codecs[i]));
+    CU_ASSERT_EQUAL(response.body_fd, -1);
+
+    str_t encoded;
+    CU_ASSERT_TRUE(drain(&a, &response, &encoded));
+    assert_encoded(codecs[i], encoded, BODY_LEN);
+    // The stream took the fd over and closed it.
+    CU_ASSERT_EQUAL(fcntl(fd, F_GETFD), -1);
+    arena_destroy(&a);
+  }
+}
+
+void test_encode_stream_fd_shrunk(void) {
+  for (size_t i = 0; i < codec_count; i++) {
+    Arena a = arena_new(1 << 12);
+    int fd = body_file();
+    http_response_t response = response_with_body((str_t){0});
+    response.body_fd = fd;
+    response.body_fd_len = BODY_LEN + ENCODE_STREAM_IN; // more than is there
+    CU_ASSERT_TRUE_FATAL(encode_stream_response(&a, &response, codecs[i]));
+    str_t encoded;
+    CU_ASSERT_FALSE(drain(&a, &response, &encoded));
+    arena_destroy(&a);
+  }
+}
+
+void test_encode_stream_inner(void) {
+  for (size_t i = 0; i < codec_count; i++) {
+    Arena a = arena_new(1 << 12);
+    inner_source_t src = {0};
+    http_response_t response = response_with_body((str_t){0});
+    response.content_length = -1;
+    response.body_source = (http_body_source_t){
+        .read = inner_read, .close = inner_close, .ctx = &src};
+    CU_ASSERT_TRUE_FATAL(encode_stream_response(&a, &response, codecs[i]));
+    CU_ASSERT_PTR_NOT_EQUAL(response.body_source.ctx, &src);
+
+    str_t encoded;
+    CU_ASSERT_TRUE(drain(&a, &response, &encoded));
+    assert_encoded(codecs[i], encoded, BODY_LEN);
+    CU_ASSERT_EQUAL(src.pos, BODY_LEN);
+    CU_ASSERT_EQUAL(src.closes, 1);
+    arena_destroy(&a);
+  }
+}
+
+int main() {
+  fill_body();
+  find_codecs();
+
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("EncodeStream", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "encode_stream_memory",
+                          test_encode_stream_memory) ||
+      NULL == CU_add_test(suite, "encode_stream_empty",
+                          test_encode_stream_empty) ||
+      NULL == CU_add_test(suite, "encode_stream_fd", test_encode_stream_fd) ||
+      NULL == CU_add_test(suite, "encode_stream_fd_shrunk",
+                          test_encode_stream_fd_shrunk) ||
+      NULL == CU_add_test(suite, "encode_stream_inner",
+                          test_encode_stream_inner)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
@@ -0,0 +1,143 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "app/arena.h"
+#include "app/files.h"
+#include "app/str.h"
+
+#define UPLOAD_CHUNK 4096
+#define UPLOAD_CHUNKS 512 // 2MB per upload
+
+static char dir[] = "/tmp/test_files.XXXXXX";
+
+typedef struct {
+  str_t path;
+  byte fill;
+  bool committed;
+} upload_job_t;
+
+// Writes UPLOAD_CHUNKS chunks of fill, yielding between them so that
+// concurrent uploads interleave.
+static void *upload(void *arg) {
+  upload_job_t *job = arg;
+  Arena a = arena_new(1 << 12);
+  byte chunk[UPLOAD_CHUNK];
+  memset(chunk, job->fill, sizeof(chunk));
+
+  file_upload_t up;
+  if (file_upload_begin(&a, &up, job->path)) {
+    for (int i = 0; i < UPLOAD_CHUNKS; i++) {
+      file_upload_write(&up, (str_t){.data = chunk, .len = sizeof(chunk)});
+      sched_yield();
+    }
+    job->committed = file_upload_commit(&up);
+  }
+  arena_destroy(&a);
+  return NULL;
+}
+
+static size_t count_dir_entries(void) {
+  char cmd[64];
+  snprintf(cmd, sizeof(cmd), "ls -A %s | wc -l", dir);
+  FILE *p = popen(cmd, "r");
+  size_t n = 0;
+  if (p != NULL) {
+    if (fscanf(p, "%zu", &n) != 1)
+      n = 0;
+    pclose(p);
+  }
+  return n;
+}
+
+void test_upload_concurrent(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/race.bin", dir);
+  upload_job_t jobs[2] = {
+      {.path = S((byte *)path), .fill = 'A'},
+      {.path = S((byte *)path), .fill = 'B'},
+  };
+  pthread_t threads[2];
+  for (int i = 0; i < 2; i++)
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], NULL, upload, &jobs[i]),
+                          0);
+  for (int i = 0; i < 2; i++)
+    pthread_join(threads[i], NULL);
+
+  // Both succeed and the file is one of them, whole.
+  CU_ASSERT_TRUE(jobs[0].committed);
+  CU_ASSERT_TRUE(jobs[1].committed);
+  Arena a = arena_new(1 << 12);
+  read_result_t r = read_file(&a, S((byte *)path));
+  CU_ASSERT_FALSE_FATAL(r.error);
+  CU_ASSERT_EQUAL_FATAL(r.content.len, (size_t)UPLOAD_CHUNK * UPLOAD_CHUNKS);
+  size_t same = 0;
+  while (same < r.content.len && r.content.data[same] == r.content.data[0])
+    same++;
+  CU_ASSERT_EQUAL(same, r.content.len);
+  CU_ASSERT_TRUE(r.content.data[0] == 'A' || r.content.data[0] == 'B');
+  arena_destroy(&a);
+
+  // No temp files left behind.
+  CU_ASSERT_EQUAL(count_dir_entries(), 1);
+  unlink(path);
+}
+
+void test_upload_abort(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/aborted.bin", dir);
+  Arena a = arena_new(1 << 12);
+  file_upload_t up;
+  CU_ASSERT_TRUE_FATAL(file_upload_begin(&a, &up, S((byte *)path)));
+  file_upload_write(&up, SL("partial"));
+  file_upload_abort(&up);
+  CU_ASSERT_EQUAL(access(path, F_OK), -1);
+  CU_ASSERT_EQUAL(count_dir_entries(), 0);
+  arena_destroy(&a);
+}
+
+void test_upload_is_temp(void) {
+  CU_ASSERT_TRUE(file_upload_is_temp(SL("race.bin.part.a1B2c3")));
+  CU_ASSERT_FALSE(file_upload_is_temp(SL("race.bin")));
+  CU_ASSERT_FALSE(file_upload_is_temp(SL("race.part")));
+  CU_ASSERT_FALSE(file_upload_is_temp(SL(".part.abcdef")));
+}
+
+int main() {
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("Files", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "upload_concurrent",
+                          test_upload_concurrent) ||
+      NULL == CU_add_test(suite, "upload_abort", test_upload_abort) ||
+      NULL == CU_add_test(suite, "upload_is_temp", test_upload_is_temp)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+  rmdir(dir);
+
+  return CU_get_error();
+}
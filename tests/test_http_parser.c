@@ -0,0 +1,549 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app/http.h"
+#include "app/str.h"
+
+#define READ_SIZE 4096 // what a connection reads at a time
+
+static const char simple_request[] = "GET /echo/abc HTTP/1.1\r\n"
+                                     "Host: a:4221\r\n"
+                                     "User-Agent: curl/8.0\r\n"
+                                     "X-Empty:\r\n"
+                                     "Accept:  */* \t\r\n"
+                                     "\r\n";
+
+static bool str_eq(str_t s, const char *expected) {
+  return str_cmp(s, S((byte *)expected));
+}
+
+static void expect_simple(const http_request_t *r) {
+  CU_ASSERT_TRUE(str_eq(r->method, "GET"));
+  CU_ASSERT_TRUE(str_eq(r->url, "/echo/abc"));
+  CU_ASSERT_TRUE(str_eq(r->version, "HTTP/1.1"));
+  CU_ASSERT_EQUAL_FATAL(r->header_count, 4);
+  CU_ASSERT_TRUE(str_eq(r->headers[0].key, "Host"));
+  CU_ASSERT_TRUE(str_eq(r->headers[0].value, "a:4221"));
+  CU_ASSERT_TRUE(str_eq(r->headers[1].value, "curl/8.0"));
+  CU_ASSERT_TRUE(str_eq(r->headers[2].key, "X-Empty"));
+  CU_ASSERT_EQUAL(r->headers[2].value.len, 0);
+  // Whitespace around values is not part of them.
+  CU_ASSERT_TRUE(str_eq(r->headers[3].value, "*/*"));
+}
+
+// Parses all of raw in one call.
+static http_parse_status_t parse(const char *raw, http_request_t *r,
+                                 http_parser_t *p) {
+  *r = (http_request_t){0};
+  http_parser_init(p);
+  return http_parser_execute(p, S((byte *)raw), r);
+}
+
+// Early status the connection settles on for raw fed in READ_SIZE reads,
+// or 0 if the request is accepted.
+static HTTP_STATUS_CODE conn_status(const char *raw, size_t len) {
+  http_conn_t conn;
+  CU_ASSERT_TRUE_FATAL(http_conn_init(&conn, -1));
+  HTTP_STATUS_CODE status = 0;
+  bool ready = false;
+  for (size_t off = 0; off < len && !ready; off += READ_SIZE) {
+    size_t n = len - off < READ_SIZE ? len - off : READ_SIZE;
+    CU_ASSERT_TRUE(http_conn_feed(&conn, raw + off, n));
+    ready = http_conn_request_ready(&conn);
+  }
+  status = ready ? conn.early_status : (HTTP_STATUS_CODE)-1;
+  http_conn_destroy(&conn);
+  return status;
+}
+
+void test_parse_whole(void) {
+  http_request_t r;
+  http_parser_t p;
+  CU_ASSERT_EQUAL_FATAL(parse(simple_request, &r, &p), HTTP_PARSE_DONE);
+  CU_ASSERT_EQUAL(p.pos, sizeof(simple_request) - 1);
+  expect_simple(&r);
+
+  // Host is a known header and keeps its port.
+  str_t host;
+  CU_ASSERT_TRUE_FATAL(http_request_header(&r, HTTP_HEADER_HOST, &host));
+  CU_ASSERT_TRUE(str_eq(host, "a:4221"));
+}
+
+void test_parse_byte_by_byte(void) {
+  size_t len = sizeof(simple_request) - 1;
+  http_request_t r = {0};
+  http_parser_t p;
+  http_parser_init(&p);
+  for (size_t n = 1; n < len; n++) {
+    str_t buf = {.data = (byte *)simple_request, .len = n};
+    CU_ASSERT_EQUAL_FATAL(http_parser_execute(&p, buf, &r), HTTP_PARSE_AGAIN);
+  }
+  str_t buf = {.data = (byte *)simple_request, .len = len};
+  CU_ASSERT_EQUAL_FATAL(http_parser_execute(&p, buf, &r), HTTP_PARSE_DONE);
+  CU_ASSERT_EQUAL(p.pos, len);
+  expect_simple(&r);
+}
+
+void test_parse_split_reads(void) {
+  // Two reads, split at every point, into a buffer that moves in between
+  // the way the receive buffer does when it grows.
+  size_t len = sizeof(simple_request) - 1;
+  for (size_t split = 1; split < len; split++) {
+    byte *first = malloc(split);
+    memcpy(first, simple_request, split);
+    http_request_t r = {0};
+    http_parser_t p;
+    http_parser_init(&p);
+    str_t buf = {.data = first, .len = split};
+    CU_ASSERT_EQUAL_FATAL(http_parser_execute(&p, buf, &r), HTTP_PARSE_AGAIN);
+
+    byte *second = malloc(len);
+    memcpy(second, simple_request, len);
+    // Nothing handed out so far may point into the old buffer.
+    str_t *slices[] = {&r.method, &r.url, &r.version};
+    for (size_t i = 0; i < 3; i++)
+      if (slices[i]->data != NULL)
+        slices[i]->data = second + (slices[i]->data - first);
+    for (size_t i = 0; i <= r.header_count && i < MAX_HEADERS; i++) {
+      if (r.headers[i].key.data != NULL)
+        r.headers[i].key.data = second + (r.headers[i].key.data - first);
+      if (r.headers[i].value.data != NULL)
+        r.headers[i].value.data = second + (r.headers[i].value.data - first);
+    }
+    free(first);
+
+    buf = (str_t){.data = second, .len = len};
+    CU_ASSERT_EQUAL_FATAL(http_parser_execute(&p, buf, &r), HTTP_PARSE_DONE);
+    expect_simple(&r);
+    free(second);
+  }
+}
+
+void test_parse_leading_crlf(void) {
+  http_request_t r;
+  http_parser_t p;
+  CU_ASSERT_EQUAL(parse("\r\n\r\nGET / HTTP/1.1\r\n\r\n", &r, &p),
+                  HTTP_PARSE_DONE);
+  CU_ASSERT_TRUE(str_eq(r.url, "/"));
+  CU_ASSERT_EQUAL(r.header_count, 0);
+}
+
+void test_parse_pipelined(void) {
+  // The parser stops right after the blank line.
+  const char raw[] = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+  http_request_t r;
+  http_parser_t p;
+  CU_ASSERT_EQUAL(parse(raw, &r, &p), HTTP_PARSE_DONE);
+  CU_ASSERT_EQUAL(p.pos, sizeof("GET /a HTTP/1.1\r\n\r\n") - 1);
+  CU_ASSERT_TRUE(str_eq(r.url, "/a"));
+}
+
+void test_parse_malformed(void) {
+  static const char *bad[] = {
+      " GET / HTTP/1.1\r\n\r\n",          // no method
+      "GET  / HTTP/1.1\r\n\r\n",          // empty target
+      "G(T / HTTP/1.1\r\n\r\n",           // not a token
+      "GET /a b HTTP/1.1\r\n\r\n",        // space in target
+      "GET / HTTPS/1.1\r\n\r\n",          // wrong protocol
+      "GET / HTTP/x.1\r\n\r\n",           // bad version
+      "GET / HTTP/1.1\n\r\n",             // bare LF
+      "GET / HTTP/1.1 \r\n\r\n",          // junk after version
+      "GET / HTTP/1.1\r\nHost a\r\n\r\n", // no colon
+      "GET / HTTP/1.1\r\nHo st: a\r\n\r\n",
+      "GET / HTTP/1.1\r\n: a\r\n\r\n",             // empty name
+      "GET / HTTP/1.1\r\nHost : a\r\n\r\n",        // space before colon
+      "GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n",      // obsolete folding
+      "GET / HTTP/1.1\r\nA: b\x01\r\n\r\n",        // control byte
+      "GET / HTTP/1.1\r\nA: b\r\r\n\r\n",          // stray CR
+      "GET / HTTP/1.1\r\nA: b\r\n\rx",             // bad end
+  };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    http_request_t r;
+    http_parser_t p;
+    CU_ASSERT_EQUAL(parse(bad[i], &r, &p), HTTP_PARSE_ERROR);
+    CU_ASSERT_EQUAL(conn_status(bad[i], strlen(bad[i])),
+                    HTTP_STATUS_BAD_REQUEST);
+  }
+}
+
+void test_parse_too_many_headers(void) {
+  char raw[MAX_HEADERS * 8 + 64];
+  size_t len = (size_t)sprintf(raw, "GET / HTTP/1.1\r\n");
+  for (int i = 0; i <= MAX_HEADERS; i++)
+    len += (size_t)sprintf(raw + len, "H%d: v\r\n", i);
+  sprintf(raw + len, "\r\n");
+  http_request_t r;
+  http_parser_t p;
+  CU_ASSERT_EQUAL(parse(raw, &r, &p), HTTP_PARSE_TOO_MANY_HEADERS);
+}
+
+// A request whose head is head_len bytes, padded out with one long header.
+static char *padded_request(size_t head_len, size_t *len) {
+  const char start[] = "GET / HTTP/1.1\r\nX-Pad: ";
+  const char end[] = "\r\n\r\n";
+  char *raw = malloc(head_len + 1);
+  size_t pad = head_len - (sizeof(start) - 1) - (sizeof(end) - 1);
+  memcpy(raw, start, sizeof(start) - 1);
+  memset(raw + sizeof(start) - 1, 'x', pad);
+  memcpy(raw + sizeof(start) - 1 + pad, end, sizeof(end));
+  *len = head_len;
+  return raw;
+}
+
+void test_header_size_limit(void) {
+  size_t len;
+  char *raw = padded_request(HTTP_MAX_HEADER_SIZE, &len);
+  CU_ASSERT_EQUAL(conn_status(raw, len), 0);
+  free(raw);
+
+  raw = padded_request(HTTP_MAX_HEADER_SIZE + READ_SIZE + 1, &len);
+  CU_ASSERT_EQUAL(conn_status(raw, len),
+                  HTTP_STATUS_HEADER_FIELDS_TOO_LARGE);
+  free(raw);
+}
+
+static const struct {
+  const char *name;
+  http_header_id_t id;
+} known_names[] = {
+    {"Accept", HTTP_HEADER_ACCEPT},
+    {"Accept-Encoding", HTTP_HEADER_ACCEPT_ENCODING},
+    {"Accept-Language", HTTP_HEADER_ACCEPT_LANGUAGE},
+    {"Authorization", HTTP_HEADER_AUTHORIZATION},
+    {"Cache-Control", HTTP_HEADER_CACHE_CONTROL},
+    {"Connection", HTTP_HEADER_CONNECTION},
+    {"Content-Length", HTTP_HEADER_CONTENT_LENGTH},
+    {"Content-Type", HTTP_HEADER_CONTENT_TYPE},
+    {"Cookie", HTTP_HEADER_COOKIE},
+    {"Expect", HTTP_HEADER_EXPECT},
+    {"Host", HTTP_HEADER_HOST},
+    {"If-Modified-Since", HTTP_HEADER_IF_MODIFIED_SINCE},
+    {"If-None-Match", HTTP_HEADER_IF_NONE_MATCH},
+    {"Range", HTTP_HEADER_RANGE},
+    {"Transfer-Encoding", HTTP_HEADER_TRANSFER_ENCODING},
+    {"Upgrade", HTTP_HEADER_UPGRADE},
+    {"User-Agent", HTTP_HEADER_USER_AGENT},
+};
+
+#define KNOWN_NAMES (sizeof(known_names) / sizeof(known_names[0]))
+
+void test_header_classify(void) {
+  CU_ASSERT_EQUAL_FATAL(KNOWN_NAMES, HTTP_HEADER_COUNT - 1);
+  bool seen[HTTP_HEADER_COUNT] = {false};
+  for (size_t i = 0; i < KNOWN_NAMES; i++) {
+    char name[32];
+    size_t len = strlen(known_names[i].name);
+    memcpy(name, known_names[i].name, len);
+    str_t s = {.data = (byte *)name, .len = len};
+    CU_ASSERT_EQUAL(http_header_classify(s), known_names[i].id);
+    // Each name has a slot of its own.
+    CU_ASSERT_FALSE(seen[known_names[i].id]);
+    seen[known_names[i].id] = true;
+
+    // Case does not matter.
+    for (size_t j = 0; j < len; j++)
+      name[j] = (char)toupper((unsigned char)name[j]);
+    CU_ASSERT_EQUAL(http_header_classify(s), known_names[i].id);
+    for (size_t j = 0; j < len; j++)
+      name[j] = (char)tolower((unsigned char)name[j]);
+    CU_ASSERT_EQUAL(http_header_classify(s), known_names[i].id);
+
+    // Same first byte, last byte and length, so the same hash, but
+    // another name.
+    for (size_t j = 1; j + 1 < len; j++) {
+      char saved = name[j];
+      name[j] = name[j] == 'x' ? 'y' : 'x';
+      CU_ASSERT_EQUAL(http_header_classify(s), HTTP_HEADER_UNKNOWN);
+      name[j] = saved;
+    }
+    // Neither a prefix nor a longer name matches.
+    CU_ASSERT_EQUAL(http_header_classify((str_t){.data = s.data,
+                                                 .len = len - 1}),
+                    HTTP_HEADER_UNKNOWN);
+    name[len] = name[len - 1];
+    CU_ASSERT_EQUAL(http_header_classify((str_t){.data = s.data,
+                                                 .len = len + 1}),
+                    HTTP_HEADER_UNKNOWN);
+  }
+
+  CU_ASSERT_EQUAL(http_header_classify(SL("")), HTTP_HEADER_UNKNOWN);
+  CU_ASSERT_EQUAL(http_header_classify(SL("X-Forwarded-For")),
+                  HTTP_HEADER_UNKNOWN);
+  // Collides with "Host": 'h', 't', four bytes.
+  CU_ASSERT_EQUAL(http_header_classify(SL("heat")), HTTP_HEADER_UNKNOWN);
+}
+
+void test_known_headers_recorded(void) {
+  const char raw[] = "POST / HTTP/1.1\r\n"
+                     "X-One: 1\r\n"
+                     "content-length: 3\r\n"
+                     "Accept: a\r\n"
+                     "ACCEPT: b\r\n"
+                     "\r\n";
+  http_request_t r;
+  http_parser_t p;
+  CU_ASSERT_EQUAL_FATAL(parse(raw, &r, &p), HTTP_PARSE_DONE);
+  str_t value;
+  CU_ASSERT_TRUE(http_request_header(&r, HTTP_HEADER_CONTENT_LENGTH, &value));
+  CU_ASSERT_TRUE(str_eq(value, "3"));
+  // Other repeats are kept in headers[]; the slot has the first.
+  CU_ASSERT_TRUE(http_request_header(&r, HTTP_HEADER_ACCEPT, &value));
+  CU_ASSERT_TRUE(str_eq(value, "a"));
+  CU_ASSERT_EQUAL(r.header_count, 4);
+  CU_ASSERT_FALSE(http_request_header(&r, HTTP_HEADER_HOST, &value));
+}
+
+void test_duplicate_framing(void) {
+  static const char *dup[] = {
+      "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\nx",
+      "POST / HTTP/1.1\r\nContent-Length: 1\r\ncontent-length: 2\r\n\r\nxy",
+      "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+      "Transfer-Encoding: gzip\r\n\r\n0\r\n\r\n",
+      "GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\n\r\n",
+  };
+  for (size_t i = 0; i < sizeof(dup) / sizeof(dup[0]); i++) {
+    http_request_t r;
+    http_parser_t p;
+    CU_ASSERT_EQUAL(parse(dup[i], &r, &p), HTTP_PARSE_ERROR);
+    CU_ASSERT_EQUAL(conn_status(dup[i], strlen(dup[i])),
+                    HTTP_STATUS_BAD_REQUEST);
+  }
+
+  // Both framings at once are rejected after parsing.
+  const char both[] = "POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+  CU_ASSERT_EQUAL(conn_status(both, sizeof(both) - 1),
+                  HTTP_STATUS_BAD_REQUEST);
+}
+
+// Runs the decoder over in, handed over step bytes at a time the way a
+// connection keeps appending to its buffer. The decoded body goes to out;
+// *used is where decoding stopped.
+static http_parse_status_t dechunk(const char *in, size_t len, size_t step,
+                                   char *out, size_t *out_len, size_t *used) {
+  http_chunked_t c;
+  http_chunked_init(&c);
+  http_parse_status_t status = HTTP_PARSE_AGAIN;
+  size_t pos = 0, avail = 0;
+  *out_len = 0;
+  while (status == HTTP_PARSE_AGAIN) {
+    if (pos == avail) {
+      if (avail == len)
+        break;
+      avail = avail + step < len ? avail + step : len;
+    }
+    size_t consumed;
+    str_t data;
+    status = http_chunked_decode(
+        &c, (str_t){.data = (byte *)in + pos, .len = avail - pos}, &consumed,
+        &data);
+    if (data.len > 0)
+      memcpy(out + *out_len, data.data, data.len);
+    *out_len += data.len;
+    pos += consumed;
+  }
+  *used = pos;
+  return status;
+}
+
+void test_chunked_split(void) {
+  const char in[] = "5\r\nhello\r\n"
+                    "1;name=value;x\r\n \r\n"
+                    "0A\r\n0123456789\r\n"
+                    "0\r\n"
+                    "Trailer: a\r\n"
+                    "Other: b\r\n"
+                    "\r\n"
+                    "GET /next";
+  const char body[] = "hello 0123456789";
+  size_t end = sizeof(in) - 1 - (sizeof("GET /next") - 1);
+  for (size_t step = 1; step <= sizeof(in); step++) {
+    char out[64];
+    size_t out_len, used;
+    CU_ASSERT_EQUAL_FATAL(
+        dechunk(in, sizeof(in) - 1, step, out, &out_len, &used),
+        HTTP_PARSE_DONE);
+    CU_ASSERT_EQUAL(out_len, sizeof(body) - 1);
+    CU_ASSERT_NSTRING_EQUAL(out, body, sizeof(body) - 1);
+    // Stops right after the trailers, at the next request.
+    CU_ASSERT_EQUAL(used, end);
+  }
+}
+
+void test_chunked_incomplete(void) {
+  static const char *partial[] = {"5\r\nhel", "5\r\nhello\r\n", "0\r\n",
+                                  "0\r\nTrailer: a\r\n", "5;ext"};
+  for (size_t i = 0; i < sizeof(partial) / sizeof(partial[0]); i++) {
+    char out[16];
+    size_t out_len, used;
+    CU_ASSERT_EQUAL(dechunk(partial[i], strlen(partial[i]), 64, out, &out_len,
+                            &used),
+                    HTTP_PARSE_AGAIN);
+  }
+}
+
+void test_chunked_malformed(void) {
+  static const char *bad[] = {
+      "\r\n",                      // no size
+      "g\r\n",                     // bad hex
+      "-1\r\n",                    // sign
+      "5 x\r\nhello\r\n0\r\n\r\n", // ok extension whitespace, then...
+      "5\nhello\r\n0\r\n\r\n",     // bare LF
+      "5\r\nhelloX\r\n0\r\n\r\n",  // data longer than its size
+      "5\r\nhello\rX0\r\n\r\n",    // no LF after data
+      "0\r\nTrailer\n\r\n",        // bare LF in trailers
+      "0\r\n\n",                  // bare LF ending the trailers
+      "0\r\nA: b\r\n\n",          // ...after a trailer field
+      "0\r\n\rX",                  // bad end
+      "1000000000000000\r\n",      // 16 hex digits
+  };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    char out[16];
+    size_t out_len, used;
+    http_parse_status_t status =
+        dechunk(bad[i], strlen(bad[i]), 64, out, &out_len, &used);
+    // "5 x" is a (bare) extension and fine.
+    CU_ASSERT_EQUAL(status, i == 3 ? HTTP_PARSE_DONE : HTTP_PARSE_ERROR);
+  }
+
+  // 15 hex digits is the most a size may have.
+  char out[16];
+  size_t out_len, used;
+  const char big[] = "00000000000000f\r\n";
+  CU_ASSERT_EQUAL(dechunk(big, sizeof(big) - 1, 64, out, &out_len, &used),
+                  HTTP_PARSE_AGAIN);
+}
+
+// "1;" and then ext_len extension bytes, as a whole chunked body.
+static char *long_extension(size_t ext_len, size_t *len) {
+  char *in = malloc(ext_len + 32);
+  size_t n = (size_t)sprintf(in, "1;");
+  memset(in + n, 'e', ext_len);
+  n += ext_len;
+  n += (size_t)sprintf(in + n, "\r\nx\r\n0\r\n\r\n");
+  *len = n;
+  return in;
+}
+
+void test_chunked_limits(void) {
+  char out[16];
+  size_t len, out_len, used;
+
+  // A size line's extensions and the trailer section are capped.
+  char *in = long_extension(4000, &len);
+  CU_ASSERT_EQUAL(dechunk(in, len, 512, out, &out_len, &used),
+                  HTTP_PARSE_DONE);
+  free(in);
+  in = long_extension(5000, &len);
+  CU_ASSERT_EQUAL(dechunk(in, len, 512, out, &out_len, &used),
+                  HTTP_PARSE_ERROR);
+  CU_ASSERT_TRUE(used < 4096 + 8);
+  free(in);
+
+  // Many short trailer lines count together.
+  size_t lines = HTTP_MAX_HEADER_SIZE / 2 + 1;
+  in = malloc(lines * 3 + 16);
+  len = (size_t)sprintf(in, "0\r\n");
+  for (size_t i = 0; i < lines; i++)
+    len += (size_t)sprintf(in + len, "a\r\n");
+  len += (size_t)sprintf(in + len, "\r\n");
+  CU_ASSERT_EQUAL(dechunk(in, len, 4096, out, &out_len, &used),
+                  HTTP_PARSE_ERROR);
+  free(in);
+}
+
+// A chunked POST to /echo with the given body framing.
+static char *chunked_request(const char *framing, size_t framing_len,
+                             size_t *len) {
+  const char head[] = "POST /echo/x HTTP/1.1\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n";
+  char *raw = malloc(sizeof(head) + framing_len);
+  memcpy(raw, head, sizeof(head) - 1);
+  memcpy(raw + sizeof(head) - 1, framing, framing_len);
+  *len = sizeof(head) - 1 + framing_len;
+  return raw;
+}
+
+void test_chunked_conn_limits(void) {
+  // A flood of extension bytes is refused before it is all buffered.
+  size_t ext_len = 1 << 20, len, framing_len;
+  char *framing = long_extension(ext_len, &framing_len);
+  char *raw = chunked_request(framing, framing_len, &len);
+  CU_ASSERT_EQUAL(conn_status(raw, len), HTTP_STATUS_BAD_REQUEST);
+  free(raw);
+  free(framing);
+
+  // So is framing that outweighs the body: one-byte chunks with extensions
+  // just under the line limit.
+  const char piece_fmt[] = "1;%04000d\r\nx\r\n";
+  size_t piece_len = 4000 + 7 + 2;
+  size_t pieces = HTTP_MAX_BUFFERED_BODY / piece_len + 2;
+  framing = malloc(pieces * piece_len + 8);
+  framing_len = 0;
+  for (size_t i = 0; i < pieces; i++)
+    framing_len += (size_t)sprintf(framing + framing_len, piece_fmt, 0);
+  framing_len += (size_t)sprintf(framing + framing_len, "0\r\n\r\n");
+  raw = chunked_request(framing, framing_len, &len);
+  CU_ASSERT_EQUAL(conn_status(raw, len), HTTP_STATUS_PAYLOAD_TOO_LARGE);
+  free(raw);
+  free(framing);
+
+  // Normal framing goes through.
+  const char ok[] = "3\r\nabc\r\n0\r\n\r\n";
+  raw = chunked_request(ok, sizeof(ok) - 1, &len);
+  CU_ASSERT_EQUAL(conn_status(raw, len), 0);
+  free(raw);
+}
+
+int main() {
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("HTTP parser", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "parse_whole", test_parse_whole) ||
+      NULL == CU_add_test(suite, "parse_byte_by_byte",
+                          test_parse_byte_by_byte) ||
+      NULL == CU_add_test(suite, "parse_split_reads", test_parse_split_reads) ||
+      NULL == CU_add_test(suite, "parse_leading_crlf",
+                          test_parse_leading_crlf) ||
+      NULL == CU_add_test(suite, "parse_pipelined", test_parse_pipelined) ||
+      NULL == CU_add_test(suite, "parse_malformed", test_parse_malformed) ||
+      NULL == CU_add_test(suite, "parse_too_many_headers",
+                          test_parse_too_many_headers) ||
+      NULL == CU_add_test(suite, "header_size_limit",
+                          test_header_size_limit) ||
+      NULL == CU_add_test(suite, "header_classify", test_header_classify) ||
+      NULL == CU_add_test(suite, "known_headers_recorded",
+                          test_known_headers_recorded) ||
+      NULL == CU_add_test(suite, "duplicate_framing",
+                          test_duplicate_framing) ||
+      NULL == CU_add_test(suite, "chunked_split", test_chunked_split) ||
+      NULL == CU_add_test(suite, "chunked_incomplete",
+                          test_chunked_incomplete) ||
+      NULL == CU_add_test(suite, "chunked_malformed", test_chunked_malformed) ||
+      NULL == CU_add_test(suite, "chunked_limits", test_chunked_limits) ||
+      NULL == CU_add_test(suite, "chunked_conn_limits",
+                          test_chunked_conn_limits)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
@@ -0,0 +1,107 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app/codec.h"
+#include "app/negotiate.h"
+#include "app/str.h"
+
+static codec_id_t negotiate(const char *accept_encoding) {
+  return negotiate_encoding(S((byte *)accept_encoding));
+}
+
+// zstd is only offered when built in; gzip stands in for it otherwise.
+static codec_id_t zstd_or_gzip(void) {
+  return codec_get(CODEC_ZSTD) != NULL ? CODEC_ZSTD : CODEC_GZIP;
+}
+
+void test_negotiate_single(void) {
+  CU_ASSERT_EQUAL(negotiate(""), CODEC_IDENTITY);
+  CU_ASSERT_EQUAL(negotiate("gzip"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("x-gzip"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("GZip"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("deflate"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("identity"), CODEC_IDENTITY);
+  CU_ASSERT_EQUAL(negotiate("br"), CODEC_IDENTITY);
+  CU_ASSERT_EQUAL(negotiate("zstd"), codec_get(CODEC_ZSTD) != NULL
+                                         ? CODEC_ZSTD
+                                         : CODEC_IDENTITY);
+}
+
+void test_negotiate_preference(void) {
+  // Equal q-values go to the server's preference.
+  CU_ASSERT_EQUAL(negotiate("deflate, gzip"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("gzip, deflate, br, zstd"), zstd_or_gzip());
+  CU_ASSERT_EQUAL(negotiate("*"), zstd_or_gzip());
+  CU_ASSERT_EQUAL(negotiate("identity, deflate"), CODEC_DEFLATE);
+}
+
+void test_negotiate_qvalues(void) {
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0.5, deflate"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0.5, deflate;q=0.4"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("gzip ; Q=0.001, deflate;q=0"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("deflate;q=1.000, gzip;q=0.999"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("zstd;q=0.1, gzip;q=0.2"), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0"), CODEC_IDENTITY);
+  // Repeats keep the highest q.
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0, deflate;q=0.5, gzip;q=0.8"),
+                  CODEC_GZIP);
+  // identity wins over a coding it beats.
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0.5, identity"), CODEC_IDENTITY);
+}
+
+void test_negotiate_star(void) {
+  // "*" covers what is not named.
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0, *"),
+                  codec_get(CODEC_ZSTD) != NULL ? CODEC_ZSTD : CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("*;q=0, deflate"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("*;q=0.5, gzip"), CODEC_GZIP);
+  // Nothing acceptable, identity included: still identity.
+  CU_ASSERT_EQUAL(negotiate("*;q=0"), CODEC_IDENTITY);
+  CU_ASSERT_EQUAL(negotiate("identity;q=0, br"), CODEC_IDENTITY);
+  CU_ASSERT_EQUAL(negotiate("identity;q=0, gzip;q=0.1"), CODEC_GZIP);
+}
+
+void test_negotiate_malformed(void) {
+  // Malformed elements are skipped, the rest still counts.
+  CU_ASSERT_EQUAL(negotiate("gzip;q=2, deflate"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("gzip;q=0.5555, deflate;q=0.1"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("gzip;q=, deflate;q=0.1"), CODEC_DEFLATE);
+  CU_ASSERT_EQUAL(negotiate("gzip;q=abc"), CODEC_IDENTITY);
+  CU_ASSERT_EQUAL(negotiate(" , ,gzip,, "), CODEC_GZIP);
+  CU_ASSERT_EQUAL(negotiate("gzip;level=9"), CODEC_GZIP);
+}
+
+int main() {
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("Negotiate", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "negotiate_single", test_negotiate_single) ||
+      NULL == CU_add_test(suite, "negotiate_preference",
+                          test_negotiate_preference) ||
+      NULL == CU_add_test(suite, "negotiate_qvalues", test_negotiate_qvalues) ||
+      NULL == CU_add_test(suite, "negotiate_star", test_negotiate_star) ||
+      NULL == CU_add_test(suite, "negotiate_malformed",
+                          test_negotiate_malformed)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
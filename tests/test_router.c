@@ -0,0 +1,170 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app/router.h"
+
+static http_router_t router;
+
+// Handlers are only compared by address.
+static bool h_root(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_file(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_upload(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_files_index(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_static(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_file_meta(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_echo(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+static bool h_ea(Arena *a, http_request_t *r, http_response_t *resp) {
+  (void)a, (void)r, (void)resp;
+  return false;
+}
+
+static http_route_result_t match(const char *method, const char *url,
+                                 http_request_t *req,
+                                 http_route_match_t *m) {
+  *req = (http_request_t){.method = S((byte *)method),
+                          .url = S((byte *)url)};
+  return router_match(&router, req, m);
+}
+
+static void expect(const char *method, const char *url, http_handler_fn fn) {
+  http_request_t req;
+  http_route_match_t m;
+  CU_ASSERT_EQUAL_FATAL(match(method, url, &req, &m), HTTP_ROUTE_FOUND);
+  CU_ASSERT_PTR_EQUAL(m.route->handler, fn);
+}
+
+static void expect_param(const char *url, const char *name,
+                         const char *value) {
+  http_request_t req;
+  http_route_match_t m;
+  str_t got;
+  CU_ASSERT_EQUAL_FATAL(match("GET", url, &req, &m), HTTP_ROUTE_FOUND);
+  CU_ASSERT_TRUE_FATAL(http_request_param(&req, name, &got));
+  CU_ASSERT_TRUE(str_cmp(got, S((byte *)value)));
+}
+
+void test_router_add(void) {
+  CU_ASSERT_FALSE(router_add(&router, HTTP_METHOD_GET, "/", h_root, 0));
+  CU_ASSERT_FALSE(router_add(&router, HTTP_METHOD_GET, "files", h_root, 0));
+  CU_ASSERT_FALSE(router_add(&router, HTTP_METHOD_GET, "/a:b", h_root, 0));
+  CU_ASSERT_FALSE(router_add(&router, HTTP_METHOD_GET, "/x/:", h_root, 0));
+  CU_ASSERT_FALSE(router_add(&router, HTTP_METHOD_GET, "/x/*a/b", h_root, 0));
+  CU_ASSERT_FALSE(
+      router_add(&router, HTTP_METHOD_GET, "/files/:id/x", h_root, 0));
+}
+
+void test_router_literal(void) {
+  expect("GET", "/", h_root);
+  expect("GET", "/files", h_files_index);
+  expect("GET", "/echo/a", h_echo);
+  expect("GET", "/ea", h_ea);
+  expect("GET", "/files/", h_files_index);
+
+  http_request_t req;
+  http_route_match_t m;
+  CU_ASSERT_EQUAL(match("GET", "/fil", &req, &m), HTTP_ROUTE_NOT_FOUND);
+  CU_ASSERT_EQUAL(match("GET", "/filesx", &req, &m), HTTP_ROUTE_NOT_FOUND);
+  CU_ASSERT_EQUAL(match("GET", "/e", &req, &m), HTTP_ROUTE_NOT_FOUND);
+  CU_ASSERT_EQUAL(match("GET", "", &req, &m), HTTP_ROUTE_NOT_FOUND);
+}
+
+void test_router_params(void) {
+  expect("GET", "/files/a.txt", h_file);
+  expect("POST", "/files/a.txt", h_upload);
+  expect("GET", "/files/a.txt/meta", h_file_meta);
+  expect_param("/files/a.txt", "name", "a.txt");
+  expect_param("/files/a.txt/meta", "name", "a.txt");
+  expect_param("/files/a.txt?x=/y", "name", "a.txt");
+  expect_param("/static/css/site.css", "path", "css/site.css");
+  expect_param("/echo/hello", "text", "hello");
+
+  http_request_t req;
+  http_route_match_t m;
+  str_t v;
+  // A literal branch that dead-ends falls back to the parameter.
+  expect_param("/files/meta", "name", "meta");
+  CU_ASSERT_EQUAL(match("GET", "/files/a/b", &req, &m), HTTP_ROUTE_NOT_FOUND);
+  CU_ASSERT_EQUAL(match("GET", "/static/", &req, &m), HTTP_ROUTE_NOT_FOUND);
+  CU_ASSERT_EQUAL(match("GET", "/", &req, &m), HTTP_ROUTE_FOUND);
+  CU_ASSERT_FALSE(http_request_param(&req, "name", &v));
+}
+
+void test_router_methods(void) {
+  http_request_t req;
+  http_route_match_t m;
+  CU_ASSERT_EQUAL(match("DELETE", "/files/a", &req, &m),
+                  HTTP_ROUTE_METHOD_NOT_ALLOWED);
+  CU_ASSERT_EQUAL(m.allowed,
+                  (1u << HTTP_METHOD_GET) | (1u << HTTP_METHOD_POST));
+  CU_ASSERT_EQUAL(match("BREW", "/", &req, &m),
+                  HTTP_ROUTE_METHOD_NOT_ALLOWED);
+  CU_ASSERT_EQUAL(match("POST", "/files/a", &req, &m), HTTP_ROUTE_FOUND);
+  CU_ASSERT_EQUAL(m.route->flags, HTTP_ROUTE_UPLOAD);
+}
+
+int main() {
+  router_init(&router);
+  router_add(&router, HTTP_METHOD_GET, "/", h_root, 0);
+  router_add(&router, HTTP_METHOD_GET, "/files", h_files_index, 0);
+  router_add(&router, HTTP_METHOD_GET, "/files/", h_files_index, 0);
+  router_add(&router, HTTP_METHOD_GET, "/files/:name", h_file, 0);
+  router_add(&router, HTTP_METHOD_POST, "/files/:name", h_upload,
+             HTTP_ROUTE_UPLOAD);
+  router_add(&router, HTTP_METHOD_GET, "/files/:name/meta", h_file_meta, 0);
+  router_add(&router, HTTP_METHOD_GET, "/files/metadata", h_file_meta, 0);
+  router_add(&router, HTTP_METHOD_GET, "/static/*path", h_static, 0);
+  router_add(&router, HTTP_METHOD_GET, "/echo/:text", h_echo, 0);
+  router_add(&router, HTTP_METHOD_GET, "/ea", h_ea, 0);
+
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("Router", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "router_add", test_router_add) ||
+      NULL == CU_add_test(suite, "router_literal", test_router_literal) ||
+      NULL == CU_add_test(suite, "router_params", test_router_params) ||
+      NULL == CU_add_test(suite, "router_methods", test_router_methods)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+  router_destroy(&router);
+
+  return CU_get_error();
+}
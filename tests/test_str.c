@@ -3,27 +3,220 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "../include/str.h"
+#include "app/str.h"
 
+// The SIMD paths work on 16 and 32 byte blocks, so every case below is run
+// at each starting alignment within a 32 byte window and for lengths that
+// cover empty input, short tails and several full blocks plus a tail.
+#define MAX_ALIGN 32
+#define MAX_LEN 100
 
-// Test case for String_split
-void test_string_split(void) {
+static Arena arena;
 
-  String *src = String_make("apple remerge germany berlin");
-  String *del = String_make(" ");
+static unsigned lcg_state = 12345;
 
-  Vector *res = String_split(src, del);
+static unsigned lcg(void) {
+  lcg_state = lcg_state * 1103515245u + 12345u;
+  return (lcg_state >> 16) & 0x7fff;
+}
+
+static void fill(byte *p, size_t n, const char *alphabet) {
+  size_t k = strlen(alphabet);
+  for (size_t i = 0; i < n; i++)
+    p[i] = alphabet[lcg() % k];
+}
+
+static int naive_find(str_t s, str_t sub) {
+  if (sub.len == 0)
+    return 0;
+  for (size_t i = 0; i + sub.len <= s.len; i++)
+    if (memcmp(s.data + i, sub.data, sub.len) == 0)
+      return (int)i;
+  return -1;
+}
+
+static int naive_find_ctl(str_t s) {
+  for (size_t i = 0; i < s.len; i++)
+    if ((unsigned char)s.data[i] < 0x20 || s.data[i] == 0x7f)
+      return (int)i;
+  return -1;
+}
+
+void test_str_cmp(void) {
+  byte a[MAX_ALIGN + MAX_LEN], b[MAX_ALIGN + MAX_LEN];
+
+  for (size_t oa = 0; oa < MAX_ALIGN; oa++) {
+    for (size_t ob = 0; ob < MAX_ALIGN; ob += 7) {
+      for (size_t len = 0; len <= MAX_LEN; len++) {
+        fill(a + oa, len, "abcdefgh");
+        memcpy(b + ob, a + oa, len);
+        str_t x = {.data = a + oa, .len = len};
+        str_t y = {.data = b + ob, .len = len};
+        CU_ASSERT_TRUE(str_cmp(x, y));
+
+        // A difference anywhere, the tail block included, is seen.
+        for (size_t i = 0; i < len; i++) {
+          b[ob + i] ^= 1;
+          CU_ASSERT_FALSE(str_cmp(x, y));
+          b[ob + i] ^= 1;
+        }
+        if (len > 0)
+          CU_ASSERT_FALSE(str_cmp(x, (str_t){.data = y.data, .len = len - 1}));
+      }
+    }
+  }
+  CU_ASSERT_TRUE(str_cmp(S(""), (str_t){.data = NULL, .len = 0}));
+}
+
+void test_str_casecmp(void) {
+  CU_ASSERT_TRUE(str_casecmp(S("Content-Length"), S("content-length")));
+  CU_ASSERT_TRUE(str_casecmp(S("HOST"), S("host")));
+  CU_ASSERT_FALSE(str_casecmp(S("Host"), S("Hosts")));
+  CU_ASSERT_FALSE(str_casecmp(S("a-b"), S("a_b")));
+}
+
+void test_str_find(void) {
+  byte buf[MAX_ALIGN + MAX_LEN];
+  const char *needles[] = {"\r", "\r\n", "\r\n\r\n", "abc", "aaaaaaaaaaaaaaaaa"};
+
+  for (size_t off = 0; off < MAX_ALIGN; off++) {
+    for (size_t len = 0; len <= MAX_LEN; len++) {
+      for (int round = 0; round < 4; round++) {
+        fill(buf + off, len, "abc\r\n");
+        str_t s = {.data = buf + off, .len = len};
+        for (size_t k = 0; k < sizeof(needles) / sizeof(needles[0]); k++) {
+          str_t sub = S((byte *)needles[k]);
+          CU_ASSERT_EQUAL(str_find(s, sub), naive_find(s, sub));
+        }
+        CU_ASSERT_EQUAL(str_find_char(s, 'c'), naive_find(s, S("c")));
+        CU_ASSERT_EQUAL(str_find_ctl(s), naive_find_ctl(s));
+      }
+
+      // Matches that sit right at the end of the input.
+      if (len >= 4) {
+        memset(buf + off, 'x', len);
+        memcpy(buf + off + len - 4, "\r\n\r\n", 4);
+        str_t s = {.data = buf + off, .len = len};
+        CU_ASSERT_EQUAL(str_find(s, S("\r\n\r\n")), (int)len - 4);
+        CU_ASSERT_EQUAL(str_find(str_span(s, 0, len - 1), S("\r\n\r\n")),
+                        -1);
+        CU_ASSERT_EQUAL(str_find_ctl(s), (int)len - 4);
+      }
+    }
+  }
+  CU_ASSERT_EQUAL(str_find(S("abc"), S("")), 0);
+  CU_ASSERT_EQUAL(str_find(S("ab"), S("abc")), -1);
+  CU_ASSERT_EQUAL(str_find_ctl(S("a\x7f")), 1);
+  CU_ASSERT_EQUAL(str_find_ctl(S("\xff\x80~")), -1);
+}
+
+void test_str_trim(void) {
+  byte buf[MAX_ALIGN + 3 * 40];
+  const char *spaces = " \t\r\n\v\f";
+
+  for (size_t off = 0; off < MAX_ALIGN; off++) {
+    for (size_t lead = 0; lead < 40; lead += 3) {
+      for (size_t body = 0; body < 40; body += 5) {
+        for (size_t trail = 0; trail < 40; trail += 3) {
+          byte *p = buf + off;
+          fill(p, lead, spaces);
+          fill(p + lead, body, "ab c\td");
+          if (body > 0) {
+            p[lead] = 'x';
+            p[lead + body - 1] = 'y';
+          }
+          fill(p + lead + body, trail, spaces);
+
+          str_t t = str_trim((str_t){.data = p, .len = lead + body + trail});
+          CU_ASSERT_EQUAL(t.len, body);
+          if (body > 0)
+            CU_ASSERT_PTR_EQUAL(t.data, p + lead);
+        }
+      }
+    }
+  }
+  CU_ASSERT_EQUAL(str_trim(S("   ")).len, 0);
+  CU_ASSERT_TRUE(str_cmp(str_trim(S("\xa0x\xa0")), S("\xa0x\xa0")));
+}
+
+// Reference split: pieces between delimiters, empty ones dropped.
+static void check_split(str_vec_t got, str_t s, str_t de) {
+  size_t n = 0, start = 0, i = 0;
+  while (i + de.len <= s.len) {
+    if (memcmp(s.data + i, de.data, de.len) == 0) {
+      if (i > start) {
+        CU_ASSERT_TRUE_FATAL(n < strvec_len(got));
+        CU_ASSERT_TRUE(str_cmp(strvec_get(got, n), str_span(s, start, i)));
+        n++;
+      }
+      i += de.len;
+      start = i;
+    } else {
+      i++;
+    }
+  }
+  if (start < s.len) {
+    CU_ASSERT_TRUE_FATAL(n < strvec_len(got));
+    CU_ASSERT_TRUE(str_cmp(strvec_get(got, n), str_span(s, start, s.len)));
+    n++;
+  }
+  CU_ASSERT_EQUAL(strvec_len(got), n);
+}
 
-  char *expected_res[] = {"apple", "redmerge", "germany", "berlin"};
+void test_str_split(void) {
+  byte buf[MAX_ALIGN + MAX_LEN];
 
-  for (int i = 0; i < res->len; i++) {
-    String *item = vec_get(res, String, i);
-    CU_ASSERT_STRING_EQUAL(item->data, expected_res[i]);
-    // printf("%s\n", item->data);
+  for (size_t off = 0; off < MAX_ALIGN; off++) {
+    for (size_t len = 0; len <= MAX_LEN; len++) {
+      fill(buf + off, len, "ab,\r\n");
+      str_t s = {.data = buf + off, .len = len};
+      check_split(str_split(&arena, s, ','), s, S(","));
+      check_split(str_split_s(&arena, s, S(",")), s, S(","));
+      check_split(str_split_s(&arena, s, S("\r\n")), s, S("\r\n"));
+      arena_rest(&arena);
+    }
   }
+
+  str_vec_t words =
+      str_split(&arena, S("apple remerge  germany berlin "), ' ');
+  char *expected[] = {"apple", "remerge", "germany", "berlin"};
+  CU_ASSERT_EQUAL_FATAL(strvec_len(words), 4);
+  for (size_t i = 0; i < 4; i++)
+    CU_ASSERT_TRUE(str_cmp(strvec_get(words, i), S(expected[i])));
+  CU_ASSERT_EQUAL(strvec_len(str_split_s(&arena, S("abc"), S(""))), 1);
+  arena_rest(&arena);
+}
+
+void test_int_to_str(void) {
+  char expected[32];
+  unsigned long long v = 1;
+  // Every digit count, and the values either side of each power of ten.
+  for (int digits = 1; digits <= 20; digits++) {
+    unsigned long long cases[] = {v - 1, v, v + 1, v * 9 + (v - 1)};
+    for (size_t i = 0; i < 4; i++) {
+      if (digits == 20 && i == 3)
+        break;
+      snprintf(expected, sizeof(expected), "%llu", cases[i]);
+      CU_ASSERT_TRUE(str_cmp(size_to_str(&arena, (size_t)cases[i]),
+                             S((byte *)expected)));
+    }
+    if (digits < 20)
+      v *= 10;
+  }
+  CU_ASSERT_TRUE(str_cmp(size_to_str(&arena, (size_t)-1),
+                         S("18446744073709551615")));
+
+  int ints[] = {0, 7, -7, 10, -10, 99, 100, 2147483647, -2147483647 - 1};
+  for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+    snprintf(expected, sizeof(expected), "%d", ints[i]);
+    CU_ASSERT_TRUE(str_cmp(int_to_str(&arena, ints[i]), S((byte *)expected)));
+  }
+  arena_rest(&arena);
 }
 
 int main() {
+  arena = arena_new(1 << 20);
+
   // Initialize CUnit test registry
   if (CUE_SUCCESS != CU_initialize_registry()) {
     return CU_get_error();
@@ -37,7 +230,12 @@ int main() {
   }
 
   // Add tests to suite
-  if (NULL == CU_add_test(suite, "String Split", test_string_split)) {
+  if (NULL == CU_add_test(suite, "str_cmp", test_str_cmp) ||
+      NULL == CU_add_test(suite, "str_casecmp", test_str_casecmp) ||
+      NULL == CU_add_test(suite, "str_find", test_str_find) ||
+      NULL == CU_add_test(suite, "str_trim", test_str_trim) ||
+      NULL == CU_add_test(suite, "str_split", test_str_split) ||
+      NULL == CU_add_test(suite, "int_to_str", test_int_to_str)) {
     CU_cleanup_registry();
     return CU_get_error();
   }
@@ -46,6 +244,7 @@ int main() {
   CU_basic_set_mode(CU_BRM_VERBOSE);
   CU_basic_run_tests();
   CU_cleanup_registry();
+  arena_destroy(&arena);
 
   return CU_get_error();
-}
\ No newline at end of file
+}
@@ -0,0 +1,230 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "app/http.h"
+#include "app/uring_loop.h"
+
+#define FILES_DIR "/tmp/data/codecrafters.io/http-server-tester/"
+#define BIG_LEN (4 << 20) // far more than the socket buffers hold
+#define REPLY_CAP (BIG_LEN + (1 << 20))
+
+static int port;
+static char big_name[64];
+static byte *big;
+
+static void *serve(void *arg) {
+  run_loop_uring((int)(intptr_t)arg);
+  return NULL;
+}
+
+// Starts the io_uring loop on an ephemeral port; it runs until exit.
+static bool start_server(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t len = sizeof(addr);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0 ||
+      getsockname(fd, (struct sockaddr *)&addr, &len) != 0)
+    return false;
+  port = ntohs(addr.sin_port);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) != 0)
+    return false;
+  pthread_detach(thread);
+  return true;
+}
+
+// Incompressible, so the gzip stream is as long as the file.
+static bool write_big_file(void) {
+  snprintf(big_name, sizeof(big_name), "test_uring_loop.%d", (int)getpid());
+  char path[128];
+  snprintf(path, sizeof(path), FILES_DIR "%s", big_name);
+  big = malloc(BIG_LEN);
+  FILE *f = fopen(path, "w");
+  if (big == NULL || f == NULL)
+    return false;
+  unsigned seed = 5;
+  for (size_t i = 0; i < BIG_LEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    big[i] = (byte)(seed >> 16);
+  }
+  bool ok = fwrite(big, 1, BIG_LEN, f) == BIG_LEN;
+  return fclose(f) == 0 && ok;
+}
+
+static void remove_big_file(void) {
+  char path[128];
+  snprintf(path, sizeof(path), FILES_DIR "%s", big_name);
+  unlink(path);
+  free(big);
+}
+
+// A client that drains slowly: with a small receive buffer the server's
+// sends stall, keeping a streamed response in flight.
+static int connect_slow_reader(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int rcvbuf = 4096;
+  struct timeval timeout = {.tv_sec = 10};
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons((uint16_t)port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool send_all(int fd, const char *s) {
+  size_t len = strlen(s);
+  return send(fd, s, len, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+// Reads until the server closes; the last request asks it to.
+static size_t read_all(int fd, byte *buf, size_t cap) {
+  size_t len = 0;
+  ssize_t n;
+  while (len < cap && (n = recv(fd, buf + len, cap - len, 0)) > 0)
+    len += (size_t)n;
+  return len;
+}
+
+// Removes chunked framing from the body starting at in; returns how much
+// of in it took, 0 if the body is malformed or cut short.
+static size_t dechunk(const byte *in, size_t len, byte *out, size_t *out_len) {
+  size_t pos = 0;
+  *out_len = 0;
+  while (true) {
+    char *end;
+    unsigned long size = strtoul((const char *)in + pos, &end, 16);
+    size_t line_end = (size_t)(end - (const char *)in);
+    if (line_end == pos || line_end + 2 > len || in[line_end] != '\r')
+      return 0;
+    pos = line_end + 2;
+    if (pos + size + 2 > len)
+      return 0;
+    memcpy(out + *out_len, in + pos, size);
+    *out_len += size;
+    pos += size + 2;
+    if (size == 0)
+      return pos;
+  }
+}
+
+static ssize_t gunzip(const byte *in, size_t len, byte *out, size_t cap) {
+  z_stream strm = {0};
+  if (inflateInit2(&strm, 15 + 16) != Z_OK)
+    return -1;
+  strm.next_in = (Bytef *)in;
+  strm.avail_in = len;
+  strm.next_out = (Bytef *)out;
+  strm.avail_out = cap;
+  int ret = inflate(&strm, Z_FINISH);
+  ssize_t n = ret == Z_STREAM_END ? (ssize_t)strm.total_out : -1;
+  inflateEnd(&strm);
+  return n;
+}
+
+// Requests that arrive while an encoded file is still streaming out must
+// all be answered, in order, once it is done.
+void test_pipelined_behind_stream(void) {
+  int fd = connect_slow_reader();
+  CU_ASSERT_FATAL(fd != -1);
+  char first[256];
+  snprintf(first, sizeof(first),
+           "GET /files/%s HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+           big_name);
+  CU_ASSERT_TRUE_FATAL(send_all(fd, first));
+  // One request lands while the stream is in flight, the next one after
+  // the server has taken that in.
+  usleep(100 * 1000);
+  CU_ASSERT_TRUE_FATAL(send_all(fd, "GET /echo/two HTTP/1.1\r\n\r\n"));
+  usleep(100 * 1000);
+  CU_ASSERT_TRUE_FATAL(send_all(
+      fd, "GET /echo/three HTTP/1.1\r\nConnection: close\r\n\r\n"));
+
+  byte *reply = malloc(REPLY_CAP);
+  byte *body = malloc(REPLY_CAP);
+  byte *plain = malloc(BIG_LEN + 1);
+  size_t len = read_all(fd, reply, REPLY_CAP);
+  close(fd);
+
+  str_t all = {.data = reply, .len = len};
+  int head_end = str_find(all, SL("\r\n\r\n"));
+  CU_ASSERT_FATAL(head_end > 0);
+  str_t head = str_span(all, 0, (size_t)head_end);
+  CU_ASSERT_TRUE(str_contain(head, SL("Transfer-Encoding: chunked")));
+  CU_ASSERT_TRUE(str_contain(head, SL("Content-Encoding: gzip")));
+
+  size_t body_start = (size_t)head_end + 4, body_len = 0;
+  size_t used = dechunk(reply + body_start, len - body_start, body, &body_len);
+  CU_ASSERT_FATAL(used > 0);
+  ssize_t plain_len = gunzip(body, body_len, plain, BIG_LEN + 1);
+  CU_ASSERT_EQUAL(plain_len, BIG_LEN);
+  CU_ASSERT(plain_len == BIG_LEN && memcmp(plain, big, BIG_LEN) == 0);
+
+  // Then both echoes, whole and in order.
+  str_t rest = str_span(all, body_start + used, len);
+  int two = str_find(rest, SL("\r\n\r\ntwo"));
+  int three = str_find(rest, SL("\r\n\r\nthree"));
+  CU_ASSERT(two > 0);
+  CU_ASSERT(three > two);
+  CU_ASSERT_TRUE(str_cmp(str_span(rest, rest.len - 5, rest.len), SL("three")));
+
+  free(reply);
+  free(body);
+  free(plain);
+}
+
+int main() {
+  signal(SIGPIPE, SIG_IGN);
+  mkdir("/tmp/data", 0755);
+  mkdir("/tmp/data/codecrafters.io", 0755);
+  mkdir(FILES_DIR, 0755);
+  if (!http_routes_init() || !write_big_file() || !start_server()) {
+    perror("test setup");
+    return 1;
+  }
+
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("UringLoop", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "pipelined_behind_stream",
+                          test_pipelined_behind_stream)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+  remove_big_file();
+
+  return CU_get_error();
+}
@@ -0,0 +1,200 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "app/arena.h"
+#include "app/files.h"
+#include "app/str.h"
+#include "app/zlib_pool.h"
+
+#define BODY_LEN (40 << 10) // inflates well past mydecompress's first 1KB
+#define OUT_CAP (BODY_LEN + 1024)
+
+static byte body[BODY_LEN];
+static byte out[OUT_CAP];
+static byte check[OUT_CAP];
+
+static void fill_body(void) {
+  unsigned seed = 7;
+  for (size_t i = 0; i < BODY_LEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    body[i] = "abcdefgh \n"[(seed >> 16) % 10];
+  }
+}
+
+// Compresses body whole with strm. Returns the output length, 0 on error.
+static size_t deflate_body(z_stream *strm) {
+  strm->next_in = (Bytef *)body;
+  strm->avail_in = BODY_LEN;
+  strm->next_out = (Bytef *)out;
+  strm->avail_out = OUT_CAP;
+  return deflate(strm, Z_FINISH) == Z_STREAM_END ? strm->total_out : 0;
+}
+
+// Inflates gzip or zlib data with a fresh stream and compares it with body.
+static bool inflates_to_body(const byte *data, size_t len) {
+  z_stream strm = {0};
+  if (inflateInit2(&strm, 15 + 32) != Z_OK)
+    return false;
+  strm.next_in = (Bytef *)data;
+  strm.avail_in = len;
+  strm.next_out = (Bytef *)check;
+  strm.avail_out = OUT_CAP;
+  bool ok = inflate(&strm, Z_FINISH) == Z_STREAM_END &&
+            strm.total_out == BODY_LEN && memcmp(check, body, BODY_LEN) == 0;
+  inflateEnd(&strm);
+  return ok;
+}
+
+static bool is_gzip(const byte *data) {
+  const unsigned char *b = (const unsigned char *)data;
+  return b[0] == 0x1f && b[1] == 0x8b;
+}
+
+// The zlib header's level hint: 0 fastest .. 3 best (RFC 1950).
+static int zlib_level_hint(const byte *data) {
+  const unsigned char *b = (const unsigned char *)data;
+  if ((b[0] & 0x0f) != Z_DEFLATED || (b[0] * 256 + b[1]) % 31 != 0)
+    return -1;
+  return b[1] >> 6;
+}
+
+void test_deflater_formats_and_levels(void) {
+  struct {
+    zlib_format_t format;
+    int level;
+    int hint; // zlib only
+  } uses[] = {
+      {ZLIB_FORMAT_ZLIB, 1, 0},   {ZLIB_FORMAT_ZLIB, 9, 3},
+      {ZLIB_FORMAT_GZIP, 9, 0},   {ZLIB_FORMAT_ZLIB, 6, 2},
+      {ZLIB_FORMAT_GZIP, 1, 0},   {ZLIB_FORMAT_ZLIB, 1, 0},
+      {ZLIB_FORMAT_GZIP, 0, 0},   {ZLIB_FORMAT_ZLIB, 4, 1},
+      {ZLIB_FORMAT_ZLIB, ZLIB_POOL_LEVEL, 2}, // zlib's default, 6
+  };
+  for (size_t i = 0; i < sizeof(uses) / sizeof(uses[0]); i++) {
+    z_stream *strm = zlib_deflater_get(uses[i].format, uses[i].level);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(strm);
+    size_t len = deflate_body(strm);
+    zlib_deflater_put(strm);
+    CU_ASSERT_FATAL(len > 0);
+
+    if (uses[i].format == ZLIB_FORMAT_GZIP)
+      CU_ASSERT_TRUE(is_gzip(out));
+    else
+      CU_ASSERT_EQUAL(zlib_level_hint(out), uses[i].hint);
+    if (uses[i].level == 0)
+      CU_ASSERT(len > BODY_LEN); // stored
+    else
+      CU_ASSERT(len < BODY_LEN);
+    CU_ASSERT_TRUE(inflates_to_body(out, len));
+  }
+}
+
+void test_deflater_reused(void) {
+  z_stream *gz = zlib_deflater_get(ZLIB_FORMAT_GZIP, 1);
+  z_stream *zl = zlib_deflater_get(ZLIB_FORMAT_ZLIB, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(gz);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(zl);
+  // Half a stream, then back to the pool: the next user starts afresh.
+  gz->next_in = (Bytef *)body;
+  gz->avail_in = BODY_LEN / 2;
+  gz->next_out = (Bytef *)out;
+  gz->avail_out = OUT_CAP;
+  CU_ASSERT_EQUAL(deflate(gz, Z_NO_FLUSH), Z_OK);
+  zlib_deflater_put(gz);
+  zlib_deflater_put(zl);
+
+  // Each format gets its own stream back, whatever the level.
+  z_stream *again = zlib_deflater_get(ZLIB_FORMAT_GZIP, 9);
+  CU_ASSERT_PTR_EQUAL(again, gz);
+  size_t len = deflate_body(again);
+  CU_ASSERT_EQUAL(again->total_in, BODY_LEN);
+  CU_ASSERT_TRUE(is_gzip(out));
+  CU_ASSERT_TRUE(inflates_to_body(out, len));
+  zlib_deflater_put(again);
+
+  again = zlib_deflater_get(ZLIB_FORMAT_ZLIB, 9);
+  CU_ASSERT_PTR_EQUAL(again, zl);
+  len = deflate_body(again);
+  CU_ASSERT_EQUAL(zlib_level_hint(out), 3);
+  CU_ASSERT_TRUE(inflates_to_body(out, len));
+  zlib_deflater_put(again);
+}
+
+void test_mydecompress_round_trip(void) {
+  Arena a = arena_new(1 << 12);
+  str_t src = {.data = body, .len = BODY_LEN};
+  str_t gz = mycompress(&a, src);
+  CU_ASSERT_FATAL(gz.len > 0);
+  CU_ASSERT_TRUE(is_gzip(gz.data));
+  str_t plain = mydecompress(&a, gz);
+  CU_ASSERT_EQUAL_FATAL(plain.len, BODY_LEN);
+  CU_ASSERT_EQUAL(memcmp(plain.data, body, BODY_LEN), 0);
+
+  // zlib input goes through the same pooled inflater.
+  z_stream *strm = zlib_deflater_get(ZLIB_FORMAT_ZLIB, 6);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(strm);
+  size_t len = deflate_body(strm);
+  zlib_deflater_put(strm);
+  plain = mydecompress(&a, (str_t){.data = out, .len = len});
+  CU_ASSERT_EQUAL_FATAL(plain.len, BODY_LEN);
+  CU_ASSERT_EQUAL(memcmp(plain.data, body, BODY_LEN), 0);
+  arena_destroy(&a);
+}
+
+void test_mydecompress_truncated(void) {
+  Arena a = arena_new(1 << 12);
+  str_t gz = mycompress(&a, (str_t){.data = body, .len = BODY_LEN});
+  CU_ASSERT_FATAL(gz.len > 16);
+  size_t cuts[] = {0, 1, 9, 10, gz.len / 2, gz.len - 8, gz.len - 1};
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+    str_t plain = mydecompress(&a, (str_t){.data = gz.data, .len = cuts[i]});
+    CU_ASSERT_PTR_NULL(plain.data);
+    CU_ASSERT_EQUAL(plain.len, 0);
+  }
+  // Corrupt data fails too, and leaves the pooled inflater usable.
+  byte *bad = arena_alloc_align(&a, gz.len, 1);
+  memcpy(bad, gz.data, gz.len);
+  bad[gz.len / 2] ^= 0x55;
+  bad[gz.len / 2 + 1] ^= 0x55;
+  CU_ASSERT_PTR_NULL(mydecompress(&a, (str_t){.data = bad, .len = gz.len}).data);
+  CU_ASSERT_EQUAL(mydecompress(&a, gz).len, BODY_LEN);
+  arena_destroy(&a);
+}
+
+int main() {
+  fill_body();
+
+  // Initialize CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  // Create suite
+  CU_pSuite suite = CU_add_suite("ZlibPool", 0, 0);
+  if (NULL == suite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Add tests to suite
+  if (NULL == CU_add_test(suite, "deflater_formats_and_levels",
+                          test_deflater_formats_and_levels) ||
+      NULL == CU_add_test(suite, "deflater_reused", test_deflater_reused) ||
+      NULL == CU_add_test(suite, "mydecompress_round_trip",
+                          test_mydecompress_round_trip) ||
+      NULL == CU_add_test(suite, "mydecompress_truncated",
+                          test_mydecompress_truncated)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run tests
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}